@@ -0,0 +1,168 @@
+#include "activity_filter.hpp"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+const double maxActiveShare = 0.5;  // above this share of a region, search all of it
+//skin range in YCrCb (Chai and Ngan), loose enough for most lighting
+const Scalar skinLow(0, 133, 77), skinHigh(255, 173, 127);
+
+ActivityParams::ActivityParams()
+  : mode(ACTIVITY_OFF), cellSize(16), motionThreshold(8), minSkinShare(0.25),
+    refreshInterval(30) {
+}
+
+ActivityFilter::ActivityFilter(const ActivityParams &params)
+  : params(params), updatesSinceRefresh(0), share(1.0) {
+  this->params.cellSize = max(1, params.cellSize);
+}
+
+bool ActivityFilter::enabled() const {
+  return params.mode != ACTIVITY_OFF;
+}
+
+double ActivityFilter::activeShare() const {
+  return share;
+}
+
+void ActivityFilter::update(const Mat &frame) {
+  if (!enabled() || frame.empty()) {
+    return;
+  }
+  int cell = params.cellSize;
+  Size grid((frame.cols + cell - 1) / cell, (frame.rows + cell - 1) / cell);
+  bool refresh = grid != active.size() ||
+                 (params.refreshInterval > 0 && ++updatesSinceRefresh >= params.refreshInterval);
+
+  cv::resize(frame, samples, Size(grid.width * 2, grid.height * 2), 0, 0, INTER_AREA);
+  cv::resize(samples, cells, grid, 0, 0, INTER_AREA);
+  active.create(grid, CV_8UC1);
+  active.setTo(Scalar(0));
+  if (params.mode & ACTIVITY_MOTION) {
+    cvtColor(cells, gray, COLOR_BGR2GRAY);
+    if (previousGray.size() == grid) {
+      absdiff(gray, previousGray, diff);
+      threshold(diff, motion, params.motionThreshold, 255, THRESH_BINARY);
+      active |= motion;
+    }
+    swap(gray, previousGray);
+  }
+  if (params.mode & ACTIVITY_SKIN) {
+    cvtColor(samples, ycrcb, COLOR_BGR2YCrCb);
+    inRange(ycrcb, skinLow, skinHigh, skin);
+    cv::resize(skin, ycrcb, grid, 0, 0, INTER_AREA); //share of skin samples per cell
+    threshold(ycrcb, skin, params.minSkinShare * 255, 255, THRESH_BINARY);
+    active |= skin;
+  }
+  if (refresh) {
+    active.setTo(Scalar(255));
+    updatesSinceRefresh = 0;
+  }
+  dilate(active, active, Mat());
+  share = (double)countNonZero(active) / grid.area();
+
+  boxes.clear();
+  Rect frameRect(Point(0, 0), frame.size());
+  int groups = connectedComponentsWithStats(active, labels, stats, centroids, 8, CV_32S);
+  for (int i = 1; i < groups; i++) { //label 0 is the static background
+    const int *s = stats.ptr<int>(i);
+    Rect box(s[CC_STAT_LEFT] * cell, s[CC_STAT_TOP] * cell,
+             s[CC_STAT_WIDTH] * cell, s[CC_STAT_HEIGHT] * cell);
+    boxes.push_back(box & frameRect);
+  }
+}
+
+void ActivityFilter::regions(const Rect &region, int margin, vector<Rect> &parts) const {
+  parts.clear();
+  if (!enabled() || active.empty()) {
+    parts.push_back(region);
+    return;
+  }
+  for (size_t i = 0; i < boxes.size(); i++) {
+    const Rect &b = boxes[i];
+    Rect padded = Rect(b.x - margin, b.y - margin, b.width + 2*margin, b.height + 2*margin) & region;
+    if (padded.area() > 0) {
+      parts.push_back(padded);
+    }
+  }
+  //merge until no two parts overlap, so no window is evaluated twice
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (size_t i = 0; i < parts.size(); i++) {
+      for (size_t j = i + 1; j < parts.size(); j++) {
+        if ((parts[i] & parts[j]).area() > 0) {
+          parts[i] |= parts[j];
+          parts.erase(parts.begin() + j--);
+          merged = true;
+        }
+      }
+    }
+  }
+  int area = 0;
+  for (size_t i = 0; i < parts.size(); i++) {
+    area += parts[i].area();
+  }
+  if (area > maxActiveShare * region.area()) {
+    parts.assign(1, region);
+  }
+}
+
+void ActivityFilter::carry(const Rect &region, vector<Rect> &faces, vector<int> *tags) const {
+  if (!enabled()) {
+    return;
+  }
+  for (size_t i = 0; i < previous.size(); i++) {
+    const Rect &face = previous[i];
+    if ((face & region) != face) {
+      continue;
+    }
+    bool still = true;
+    for (size_t j = 0; j < boxes.size() && still; j++) {
+      still = (face & boxes[j]).area() == 0;
+    }
+    if (still) {
+      faces.push_back(face);
+      if (tags) {
+        tags->push_back(previousTags[i]);
+      }
+    }
+  }
+}
+
+void ActivityFilter::remember(const vector<Rect> &faces, const Rect &region, const vector<int> *tags) {
+  if (!enabled()) {
+    return;
+  }
+  //results elsewhere in the frame still stand
+  size_t kept = 0;
+  for (size_t i = 0; i < previous.size(); i++) {
+    if ((previous[i] & region).area() == 0) {
+      previousTags[kept] = previousTags[i];
+      previous[kept++] = previous[i];
+    }
+  }
+  previous.resize(kept);
+  previousTags.resize(kept);
+  previous.insert(previous.end(), faces.begin(), faces.end());
+  if (tags) {
+    previousTags.insert(previousTags.end(), tags->begin(), tags->end());
+  } else {
+    previousTags.resize(previous.size(), 0);
+  }
+}
+
+int activityModeByName(const string &name) {
+  if (name == "off") {
+    return ACTIVITY_OFF;
+  } else if (name == "motion") {
+    return ACTIVITY_MOTION;
+  } else if (name == "skin") {
+    return ACTIVITY_SKIN;
+  } else if (name == "any") {
+    return ACTIVITY_ANY;
+  }
+  return -1;
+}
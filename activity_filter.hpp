@@ -0,0 +1,79 @@
+#ifndef ACTIVITY_FILTER_HPP
+#define ACTIVITY_FILTER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+/* what makes a part of the frame worth running the cascade on; flags combine */
+enum ActivityMode {
+  ACTIVITY_OFF = 0,     // search everywhere
+  ACTIVITY_MOTION = 1,  // changed since the last search
+  ACTIVITY_SKIN = 2,    // skin-coloured
+  ACTIVITY_ANY = 3      // either
+};
+
+struct ActivityParams {
+  ActivityParams();
+
+  int mode;               // ActivityMode flags
+  int cellSize;           // frame pixels per mask cell side
+  int motionThreshold;    // mean gray level change of a moving cell
+  double minSkinShare;    // share of a cell's samples that must look like skin
+  int refreshInterval;    // searches between unconditional full searches, 0 for never
+};
+
+/**
+Coarse mask of the parts of a frame the cascade should look at.
+update() shrinks the frame to one cell per cellSize x cellSize pixels
+(2 x 2 samples per cell for the skin test) and marks cells whose mean gray
+level changed by more than motionThreshold since the previous update() and/or
+enough of whose samples fall into a fixed YCrCb skin range. Marked cells are
+grown by one cell and grouped into boxes.
+Faces found in a search are remembered per area, so a part of the frame that
+stayed static keeps its previous result instead of being searched again.
+Every refreshInterval updates, and whenever the frame size changes, the whole
+frame is marked so faces that never moved are still found.
+Call update() once per search, with the frame the search runs on: motion is
+measured against the previous search, not the previous camera frame.
+*/
+class ActivityFilter {
+public:
+  explicit ActivityFilter(const ActivityParams &params = ActivityParams());
+
+  void update(const cv::Mat &frame);
+
+  /*
+  parts of region to search, each active box padded by margin frame pixels and
+  merged with the boxes it then overlaps; region itself when the filter is off
+  or most of region is active
+  */
+  void regions(const cv::Rect &region, int margin, std::vector<cv::Rect> &parts) const;
+  /*
+  append the remembered faces inside region that no active box touches, and
+  to tags, if given, the tags they were remembered with
+  */
+  void carry(const cv::Rect &region, std::vector<cv::Rect> &faces, std::vector<int> *tags = NULL) const;
+  /* faces is the complete result of searching region, carried faces included; tags[i] goes with faces[i] */
+  void remember(const std::vector<cv::Rect> &faces, const cv::Rect &region,
+                const std::vector<int> *tags = NULL);
+
+  bool enabled() const;
+  /* share of the last frame's cells that were active */
+  double activeShare() const;
+
+private:
+  ActivityParams params;
+  int updatesSinceRefresh;
+  double share;
+  cv::Mat samples, cells, gray, previousGray, diff, motion, ycrcb, skin, active;
+  cv::Mat labels, stats, centroids;
+  std::vector<cv::Rect> boxes;      // active cell groups in frame pixels
+  std::vector<cv::Rect> previous;   // faces of the last search of every area
+  std::vector<int> previousTags;    // their tags, 0 if none were given
+};
+
+/* ActivityMode flags from "off", "motion", "skin" or "any"; -1 if unknown */
+int activityModeByName(const std::string &name);
+
+#endif
@@ -0,0 +1,175 @@
+#include "actuator_link.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+/*angle look-up tables*/
+const float angleThreshold[15] = {-26, -22, -18, -14, -10, -6, -2, 2, 6, 10, 14, 18, 22, 26, 30};
+const char *const angleCommands[16] = {"0\n", "1\n", "2\n", "3\n", "4\n", "5\n", "6\n", "7\n",
+                                       "8\n", "9\n", "10\n", "11\n", "12\n", "13\n", "14\n", "15\n"};
+
+const int64_t writerPollNs = 1000000; // writer wake-up period while idle
+
+LinkParams::LinkParams()
+  : asciiProtocol(false), angleDeadband(0.1), keepaliveInterval(0.25), minSendInterval(0.01) {
+}
+
+uint8_t crc8(const uint8_t *data, size_t size) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+void encodeAngleFrame(const AngleFrame &frame, uint8_t out[angleFrameSize]) {
+  double centi = max(-32768.0, min(32767.0, round(frame.angle * 100)));
+  uint16_t angle = (uint16_t)(int16_t)centi;
+  out[0] = angleFrameSync;
+  out[1] = frame.seq;
+  out[2] = angle & 0xff;
+  out[3] = angle >> 8;
+  out[4] = frame.flags;
+  out[5] = crc8(out + 1, 4);
+}
+
+bool decodeAngleFrame(const uint8_t in[angleFrameSize], AngleFrame &frame) {
+  if (in[0] != angleFrameSync || crc8(in + 1, 4) != in[5]) {
+    return false;
+  }
+  frame.seq = in[1];
+  frame.angle = (int16_t)(uint16_t)(in[2] | (in[3] << 8)) / 100.0;
+  frame.flags = in[4];
+  return true;
+}
+
+/**
+command for the MBED based on angle value
+quantizes the angle into 16 ranges:
+{ -Inf to -26, -26 to 22, ... 26 to 30, 30 to Inf }
+and returns the range index as a line of text, from a constant table
+*/
+const char *angleCommand(double angled) {
+  //only compare to second last threshold, since last is infinite
+  for (int i = 0; i < 15; i++) {
+    if (angled < angleThreshold[i]) {
+      return angleCommands[i];
+    }
+  }
+  return angleCommands[15];
+}
+
+ActuatorLink::ActuatorLink(const string &name, const LinkParams &params)
+  : name(name), params(params), running(false), pending(1), seq(0), sent(0),
+    writeStats(name, "serial") {
+}
+
+ActuatorLink::~ActuatorLink() {
+  stop();
+}
+
+bool ActuatorLink::open(const string &portName, unsigned long baud) {
+  serial::Timeout timeout = serial::Timeout::simpleTimeout(1000);
+  port.setPort(portName);
+  port.setTimeout(timeout);
+  port.setBaudrate(baud);
+  port.open();
+  if (!port.isOpen()) {
+    cout << name << ": could not open connection with mbed" << endl;
+    return false;
+  }
+  printf("%s: mbed opened with baud rate:%u\n", name.c_str(), port.getBaudrate());
+  return true;
+}
+
+bool ActuatorLink::isOpen() const {
+  return port.isOpen();
+}
+
+void ActuatorLink::start() {
+  if (!running && port.isOpen()) {
+    running = true;
+    writeThread = thread(&ActuatorLink::writeLoop, this);
+  }
+}
+
+void ActuatorLink::stop() {
+  running = false;
+  if (writeThread.joinable()) {
+    writeThread.join();
+  }
+}
+
+void ActuatorLink::submit(double angled) {
+  pending.push(angled);
+}
+
+unsigned long ActuatorLink::framesSent() const {
+  return sent.load();
+}
+
+void ActuatorLink::reportStats() {
+  writeStats.report();
+}
+
+/**
+writer thread: pick up the newest angle and decide whether it is worth a frame
+*/
+void ActuatorLink::writeLoop() {
+  const int64_t keepaliveNs = (int64_t)(params.keepaliveInterval * 1e9);
+  const int64_t minIntervalNs = (int64_t)(params.minSendInterval * 1e9);
+  double angle = 0, lastSent = 0;
+  bool haveAngle = false, sentAny = false;
+  int64_t lastSendNs = 0;
+
+  while (running) {
+    double next;
+    if (pending.popLatest(next)) {
+      angle = next;
+      haveAngle = true;
+    }
+    int64_t now = nowNs();
+    bool changed = haveAngle && (!sentAny || fabs(angle - lastSent) >= params.angleDeadband);
+    bool keepalive = sentAny && now - lastSendNs >= keepaliveNs;
+    if ((changed || keepalive) && (!sentAny || now - lastSendNs >= minIntervalNs)) {
+      send(angle, changed ? 0 : ANGLE_KEEPALIVE);
+      lastSent = angle;
+      lastSendNs = now;
+      sentAny = true;
+    } else {
+      this_thread::sleep_for(chrono::nanoseconds(writerPollNs));
+    }
+  }
+}
+
+void ActuatorLink::send(double angled, uint8_t flags) {
+  int64_t start = nowNs();
+  try {
+    if (params.asciiProtocol) {
+      const char *command = angleCommand(angled);
+      port.write((const uint8_t *)command, strlen(command));
+    } else {
+      AngleFrame frame;
+      frame.seq = seq++;
+      frame.angle = angled;
+      frame.flags = flags;
+      uint8_t bytes[angleFrameSize];
+      encodeAngleFrame(frame, bytes);
+      port.write(bytes, angleFrameSize);
+    }
+    sent++;
+  } catch (const exception &e) {
+    cout << name << ": serial write failed: " << e.what() << endl;
+    writeStats.drop();
+    return;
+  }
+  writeStats.record(nowNs() - start);
+}
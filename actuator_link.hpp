@@ -0,0 +1,90 @@
+#ifndef ACTUATOR_LINK_HPP
+#define ACTUATOR_LINK_HPP
+
+#include <serial/serial.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include "ring_buffer.hpp"
+#include "stage_stats.hpp"
+
+/**
+Binary angle frame, angleFrameSize bytes on the wire:
+  0xA5 | seq | angle low | angle high | flags | crc8
+angle is a signed 16 bit little-endian value in hundredths of a degree.
+seq counts frames modulo 256 so the mbed can spot lost frames.
+crc8 (polynomial 0x07) covers seq, angle and flags.
+*/
+const uint8_t angleFrameSync = 0xA5;
+const size_t angleFrameSize = 6;
+
+enum AngleFrameFlags {
+  ANGLE_KEEPALIVE = 1      // repeat of the last angle, nothing changed
+};
+
+struct AngleFrame {
+  uint8_t seq;
+  double angle;            // degrees, resolution 0.01
+  uint8_t flags;
+};
+
+void encodeAngleFrame(const AngleFrame &frame, uint8_t out[angleFrameSize]);
+/* false if the sync byte or checksum don't match */
+bool decodeAngleFrame(const uint8_t in[angleFrameSize], AngleFrame &frame);
+uint8_t crc8(const uint8_t *data, size_t size);
+
+/* legacy ASCII protocol: angle quantized into 16 buckets, "0\n" to "15\n" */
+const char *angleCommand(double angled);
+
+/* when the link sends */
+struct LinkParams {
+  LinkParams();
+
+  bool asciiProtocol;         // send the legacy bucket commands instead
+  double angleDeadband;       // degrees an angle must move before it is resent
+  double keepaliveInterval;   // seconds after which an unchanged angle is repeated
+  double minSendInterval;     // seconds between frames, keeps the port from backing up
+};
+
+/**
+Serial link to one mbed, written from its own thread.
+submit() only hands the newest angle to the writer and never blocks, so
+neither capture nor actuation ever waits on the port. The writer sends when
+the angle moved by more than angleDeadband or a keepalive is due, and never
+faster than minSendInterval; angles submitted in between are superseded.
+*/
+class ActuatorLink {
+public:
+  ActuatorLink(const std::string &name, const LinkParams &params = LinkParams());
+  ~ActuatorLink();
+
+  /* open the port, printing what failed */
+  bool open(const std::string &port, unsigned long baud);
+  bool isOpen() const;
+  void start();
+  void stop();
+
+  void submit(double angled);
+  unsigned long framesSent() const;
+  void reportStats();
+
+private:
+  ActuatorLink(const ActuatorLink &);
+  ActuatorLink &operator=(const ActuatorLink &);
+
+  void writeLoop();
+  void send(double angled, uint8_t flags);
+
+  std::string name;
+  LinkParams params;
+  serial::Serial port;
+  std::atomic<bool> running;
+  std::thread writeThread;
+  RingBuffer<double> pending;
+  uint8_t seq;
+  std::atomic<unsigned long> sent;
+  StageStats writeStats;
+};
+
+#endif
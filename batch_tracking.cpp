@@ -0,0 +1,300 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "cascade_cache.hpp"
+#include "tracking_session.hpp"
+
+using namespace std;
+using namespace cv;
+
+/* one recorded input: a video file or a directory of images */
+class FrameSource {
+public:
+  bool open(const string &path, double defaultFps);
+  bool read(Mat &frame);
+  double fps() const { return rate; }
+
+private:
+  VideoCapture video;
+  vector<String> images;
+  size_t next;
+  double rate;
+};
+
+/* Function Headers */
+void processSource(const string &path, TiledDetector &detector, FaceVerifier &verifier,
+                   const SessionConfig &config);
+void writeRecord(const string &source, unsigned long frame, double t, const TrackResult &result);
+string jsonEscape(const string &text);
+string csvQuote(const string &text);
+bool isDirectory(const string &path);
+
+/* global variables */
+FILE *output = stdout;
+bool csvOutput = false;
+mutex outputLock;
+atomic<unsigned long> framesDone(0);
+double imageFps = 30.0;             // timestamps for image directories
+
+/**
+Runs the tracker over recorded footage with no camera attached, as fast as
+the CPU allows, and streams one record per frame: every detected face box,
+the index of the selected face (-1 if none), the track id of the target
+(-1 if none) and the pan and tilt angles.
+
+usage: batchFaceTracking [-j files-in-parallel] [-w detection-workers]
+                         [-f jsonl|csv] [-o output] [-s scale] [-c calibration] [-v] [-p] input...
+each input is a video file or a directory of images (read in name order)
+-v drops detections without eyes, nose or mouth
+-p also finds faces in profile
+*/
+int main(int argc, char **argv) {
+  int jobs = 1;
+  int workers = 0;
+  SessionConfig config;
+  vector<string> inputs;
+  const char *outputPath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "-j" && hasValue) {
+      jobs = max(1, atoi(argv[++i]));
+    } else if (arg == "-w" && hasValue) {
+      workers = atoi(argv[++i]);
+    } else if (arg == "-f" && hasValue) {
+      csvOutput = string(argv[++i]) == "csv";
+    } else if (arg == "-o" && hasValue) {
+      outputPath = argv[++i];
+    } else if (arg == "-s" && hasValue) {
+      config.scale = atof(argv[++i]);
+    } else if (arg == "-v") {
+      config.tracker.verifyFaces = true;
+    } else if (arg == "-p") {
+      config.tracker.multiPose = true;
+    } else if (arg == "-c" && hasValue) {
+      if (!config.calibration.load(argv[++i])) {
+        return -1;
+      }
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  if (inputs.empty() || config.scale <= 0) {
+    cout << "usage: batchFaceTracking [-j files-in-parallel] [-w detection-workers]" << endl
+         << "                         [-f jsonl|csv] [-o output] [-s scale] [-c calibration]"
+         << " [-v] [-p] input..." << endl;
+    return -1;
+  }
+  if (outputPath && !(output = fopen(outputPath, "w"))) {
+    cout << "error opening " << outputPath << endl;
+    return -1;
+  }
+
+  TiledDetector detector(workers, 4, 2, 3);
+  if (!detector.load(classifierPath("haarcascade_frontalface_alt.xml"))) {
+    cout << "error loading face classifier" << endl;
+    return -1;
+  }
+  if (config.tracker.multiPose && !detector.loadProfile(classifierPath("haarcascade_profileface.xml"))) {
+    cout << "error loading profile classifier" << endl;
+    return -1;
+  }
+  FaceVerifier verifier(detector.threadPool());
+  if (config.tracker.verifyFaces && !verifier.load()) {
+    cout << "error loading feature classifiers" << endl;
+    return -1;
+  }
+  setNumThreads(1); //the detector pool already keeps every core busy
+
+  if (csvOutput) {
+    fprintf(output, "source,frame,t,selected,target,x,y,width,height,angle,tilt,faces\n");
+  }
+
+  // Files are independent sessions; up to jobs of them share the detector pool
+  int64_t start = nowNs();
+  atomic<size_t> nextInput(0);
+  vector<thread> threads;
+  for (int j = 0; j < min(jobs, (int)inputs.size()); j++) {
+    threads.push_back(thread([&]() {
+      for (size_t i = nextInput++; i < inputs.size(); i = nextInput++) {
+        processSource(inputs[i], detector, verifier, config);
+      }
+    }));
+  }
+  for (size_t j = 0; j < threads.size(); j++) {
+    threads[j].join();
+  }
+  double seconds = (nowNs() - start) / 1e9;
+
+  if (output != stdout) {
+    fclose(output);
+  }
+  fprintf(stderr, "%lu frames in %.2f s, %.1f fps\n",
+          framesDone.load(), seconds, framesDone.load() / max(seconds, 1e-9));
+  return 0;
+}
+
+/**
+track every frame of one input with a fresh session
+frames are timestamped from their index and the source frame rate, so runs
+are repeatable regardless of how fast they are processed
+*/
+void processSource(const string &path, TiledDetector &detector, FaceVerifier &verifier,
+                   const SessionConfig &config) {
+  FrameSource source;
+  if (!source.open(path, imageFps)) {
+    fprintf(stderr, "could not open %s\n", path.c_str());
+    return;
+  }
+  SessionConfig sessionConfig = config;
+  sessionConfig.name = path;
+  TrackingSession session(sessionConfig, detector, &verifier);
+
+  Mat frame, small;
+  TrackResult result;
+  for (unsigned long n = 0; source.read(frame); n++) {
+    cv::resize(frame, small, Size(cvRound(frame.cols/config.scale), cvRound(frame.rows/config.scale)));
+    double t = n / source.fps();
+    session.process(small, (int64_t)(t * 1e9), n, result);
+    writeRecord(path, n, t, result);
+    framesDone++;
+  }
+}
+
+/**
+one line per frame, JSON Lines by default:
+{"source":"a.mp4","frame":3,"t":0.100,"faces":[[x,y,w,h],...],"selected":0,"target":7,"angle":-4.21,"tilt":1.07}
+with -f csv the face list is a single "x y w h;..." column
+selected is -1 when the target was not detected in this frame: then the
+faces are in detection order and the target box is where it was last seen
+*/
+void writeRecord(const string &source, unsigned long frame, double t, const TrackResult &result) {
+  //the session puts the target's detection first and takes its box
+  bool targetSeen = result.targetId >= 0 && !result.faces.empty() && result.faces[0] == result.face;
+  int selected = targetSeen ? 0 : -1;
+  string line;
+  char buf[128];
+
+  if (csvOutput) {
+    string faceList;
+    for (size_t i = 0; i < result.faces.size(); i++) {
+      const Rect &f = result.faces[i];
+      snprintf(buf, sizeof(buf), "%s%d %d %d %d", i ? ";" : "", f.x, f.y, f.width, f.height);
+      faceList += buf;
+    }
+    line = csvQuote(source);
+    snprintf(buf, sizeof(buf), ",%lu,%.3f,%d,%d,%d,%d,%d,%d,", frame, t, selected, result.targetId,
+             result.face.x, result.face.y, result.face.width, result.face.height);
+    line += buf;
+    if (result.tracking) {
+      snprintf(buf, sizeof(buf), "%.2f,%.2f", result.angled, result.tiltd);
+      line += buf;
+    } else {
+      line += ",";
+    }
+    line += "," + faceList + "\n";
+  } else {
+    line = "{\"source\":\"" + jsonEscape(source) + "\"";
+    snprintf(buf, sizeof(buf), ",\"frame\":%lu,\"t\":%.3f,\"faces\":[", frame, t);
+    line += buf;
+    for (size_t i = 0; i < result.faces.size(); i++) {
+      const Rect &f = result.faces[i];
+      snprintf(buf, sizeof(buf), "%s[%d,%d,%d,%d]", i ? "," : "", f.x, f.y, f.width, f.height);
+      line += buf;
+    }
+    if (result.tracking) {
+      snprintf(buf, sizeof(buf), "],\"selected\":%d,\"target\":%d,\"angle\":%.2f,\"tilt\":%.2f}\n",
+               selected, result.targetId, result.angled, result.tiltd);
+    } else {
+      snprintf(buf, sizeof(buf), "],\"selected\":%d,\"target\":%d,\"angle\":null,\"tilt\":null}\n",
+               selected, result.targetId);
+    }
+    line += buf;
+  }
+
+  lock_guard<mutex> guard(outputLock);
+  fputs(line.c_str(), output);
+}
+
+string jsonEscape(const string &text) {
+  string escaped;
+  for (size_t i = 0; i < text.size(); i++) {
+    char c = text[i];
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+string csvQuote(const string &text) {
+  string quoted("\"");
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '"') {
+      quoted += '"';
+    }
+    quoted += text[i];
+  }
+  return quoted + "\"";
+}
+
+bool isDirectory(const string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+bool FrameSource::open(const string &path, double defaultFps) {
+  next = 0;
+  rate = defaultFps;
+  if (!isDirectory(path)) {
+    if (!video.open(path)) {
+      return false;
+    }
+    double fps = video.get(CV_CAP_PROP_FPS);
+    if (fps > 0) {
+      rate = fps;
+    }
+    return true;
+  }
+
+  vector<String> files;
+  glob(path, files, false);
+  const char *extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".ppm", ".pgm"};
+  for (size_t i = 0; i < files.size(); i++) {
+    string lower = files[i];
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    for (size_t e = 0; e < sizeof(extensions)/sizeof(extensions[0]); e++) {
+      size_t len = strlen(extensions[e]);
+      if (lower.size() > len && lower.compare(lower.size() - len, len, extensions[e]) == 0) {
+        images.push_back(files[i]);
+        break;
+      }
+    }
+  }
+  sort(images.begin(), images.end());
+  return !images.empty();
+}
+
+bool FrameSource::read(Mat &frame) {
+  if (!images.empty()) {
+    while (next < images.size()) {
+      frame = imread(images[next++]);
+      if (!frame.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return video.read(frame);
+}
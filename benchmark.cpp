@@ -0,0 +1,385 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+#include "cascade_cache.hpp"
+#include "tracking_session.hpp"
+
+using namespace std;
+using namespace cv;
+
+/* Function Headers */
+vector<Mat> syntheticCorpus(Size resolution, int faceCount, int frames);
+vector<Mat> recordedCorpus(const string &dir, Size resolution, int frames);
+vector<Rect> randomFaces(RNG &rng, int count, Size frameSize);
+void runCase(const string &benchmark, const string &corpus, int faceCount, int iterations,
+             const function<void(int)> &body);
+void testFrameAllocations(TiledDetector &detector);
+
+/* global variables */
+atomic<unsigned long> heapAllocs(0);
+atomic<unsigned long> matAllocs(0);
+atomic<unsigned long> largeMatAllocs(0);  // buffers of at least largeMatBytes
+size_t largeMatBytes = 0;
+FILE *output = stdout;
+
+/* every operator new in the process is counted */
+void *operator new(size_t size) {
+  heapAllocs.fetch_add(1, memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+/**
+Mat buffers come from OpenCV's own allocator rather than operator new,
+so count them by wrapping the standard MatAllocator
+*/
+class CountingAllocator : public MatAllocator {
+public:
+  UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                     int flags, UMatUsageFlags usageFlags) const {
+    matAllocs.fetch_add(1, memory_order_relaxed);
+    size_t bytes = CV_ELEM_SIZE(type);
+    for (int i = 0; i < dims; i++) {
+      bytes *= sizes[i];
+    }
+    if (largeMatBytes && bytes >= largeMatBytes) {
+      largeMatAllocs.fetch_add(1, memory_order_relaxed);
+    }
+    return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+  }
+  bool allocate(UMatData *data, int accessFlags, UMatUsageFlags usageFlags) const {
+    return Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+  }
+  void deallocate(UMatData *data) const {
+    Mat::getStdAllocator()->deallocate(data);
+  }
+};
+
+/**
+Benchmarks the per-frame hot paths: detectFace (full-frame scan, the same
+scan for frontal and profile faces, the same scan of a static scene with the
+motion pre-filter, and the default ROI/hybrid tracking path), face selection sorts and the mbed command
+formatting. Each case prints one JSON line with p50/p95/p99 latency in
+microseconds, frames (iterations) per second, and heap and Mat allocations
+per iteration, so two builds can be diffed directly.
+Frames are synthetic and seeded, or taken from a directory of recorded images.
+-t runs the steady-state allocation test instead.
+
+usage: faceTrackingBenchmark [-t] [-n iterations] [-w workers] [-d recorded-dir] [-o output]
+*/
+int main(int argc, char **argv) {
+  int iterations = 50;
+  int workers = 0;
+  bool test = false;
+  string recordedDir;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-t") {
+      test = true;
+      continue;
+    }
+    if (++i >= argc) {
+      break;
+    }
+    if (arg == "-n") {
+      iterations = max(1, atoi(argv[i]));
+    } else if (arg == "-w") {
+      workers = atoi(argv[i]);
+    } else if (arg == "-d") {
+      recordedDir = argv[i];
+    } else if (arg == "-o" && !(output = fopen(argv[i], "w"))) {
+      cout << "error opening " << argv[i] << endl;
+      return -1;
+    }
+  }
+
+  CountingAllocator counting;
+  Mat::setDefaultAllocator(&counting);
+
+  TiledDetector detector(workers, 4, 2, 3);
+  if (!detector.load(classifierPath("haarcascade_frontalface_alt.xml"))) {
+    cout << "error loading face classifier" << endl;
+    return -1;
+  }
+  if (!detector.loadProfile(classifierPath("haarcascade_profileface.xml"))) {
+    cout << "error loading profile classifier" << endl;
+    return -1;
+  }
+  setNumThreads(1); //the detector pool already keeps every core busy
+
+  if (test) {
+    testFrameAllocations(detector);
+    Mat::setDefaultAllocator(NULL);
+    return 0;
+  }
+
+  // detectFace over every resolution and face count
+  const Size resolutions[] = {Size(640, 360), Size(960, 540), Size(1920, 1080)};
+  const int faceCounts[] = {0, 1, 4};
+  for (int r = 0; r < 3; r++) {
+    for (int f = 0; f < (recordedDir.empty() ? 3 : 1); f++) {
+      vector<Mat> corpus = recordedDir.empty() ? syntheticCorpus(resolutions[r], faceCounts[f], 8)
+                                               : recordedCorpus(recordedDir, resolutions[r], 8);
+      if (corpus.empty()) {
+        cout << "no images in " << recordedDir << endl;
+        return -1;
+      }
+      char name[32];
+      snprintf(name, sizeof(name), "%dx%d", resolutions[r].width, resolutions[r].height);
+      int faces = recordedDir.empty() ? faceCounts[f] : -1;
+
+      SessionConfig fullScan;
+      fullScan.tracker.roiTracking = false;
+      fullScan.tracker.hybridTracking = false;
+      TrackingSession fullSession(fullScan, detector);
+      runCase("detectFace", name, faces, iterations, [&](int i) {
+        fullSession.detectFace(corpus[i % corpus.size()]);
+      });
+
+      // the same scan through CascadeClassifier instead of the compiled model
+      if (detector.usesCompiled()) {
+        detector.useCompiled(false);
+        runCase("detectFaceInterpreted", name, faces, iterations, [&](int i) {
+          fullSession.detectFace(corpus[i % corpus.size()]);
+        });
+        detector.useCompiled(true);
+      }
+
+      // the same full scan for frontal and profile faces
+      SessionConfig poseScan = fullScan;
+      poseScan.tracker.multiPose = true;
+      TrackingSession poseSession(poseScan, detector);
+      runCase("detectFacePoses", name, faces, iterations, [&](int i) {
+        poseSession.detectFace(corpus[i % corpus.size()]);
+      });
+
+      // the same full scan on a camera that sees no motion
+      SessionConfig stillScan = fullScan;
+      stillScan.tracker.activity.mode = ACTIVITY_MOTION;
+      TrackingSession stillSession(stillScan, detector);
+      runCase("detectFaceStill", name, faces, iterations, [&](int) {
+        stillSession.detectFace(corpus[0]);
+      });
+
+      // the same full scan on a still scene, reusing the result between refreshes
+      SessionConfig cachedScan = fullScan;
+      cachedScan.tracker.sceneCache.enabled = true;
+      TrackingSession cachedSession(cachedScan, detector);
+      runCase("detectFaceCached", name, faces, iterations, [&](int) {
+        cachedSession.detectFace(corpus[0]);
+      });
+
+      TrackingSession trackingSession(SessionConfig(), detector);
+      TrackResult result;
+      runCase("process", name, faces, iterations, [&](int i) {
+        trackingSession.process(corpus[i % corpus.size()], i * 33333333LL, i, result);
+      });
+    }
+  }
+
+  // selection sorts over a fixed set of candidate lists
+  const int candidateCounts[] = {1, 4, 16, 64};
+  for (int c = 0; c < 4; c++) {
+    RNG rng(1234);
+    vector<vector<Rect> > lists;
+    for (int i = 0; i < 64; i++) {
+      lists.push_back(randomFaces(rng, candidateCounts[c], Size(960, 540)));
+    }
+    Rect prior(400, 200, 120, 120);
+    vector<Rect> faces;
+    faces.reserve(64);
+    runCase("compareBigger", "synthetic", candidateCounts[c], iterations * 200, [&](int i) {
+      faces.assign(lists[i % lists.size()].begin(), lists[i % lists.size()].end());
+      sort(faces.begin(), faces.end(), compareBigger);
+    });
+    runCase("compareDistance", "synthetic", candidateCounts[c], iterations * 200, [&](int i) {
+      faces.assign(lists[i % lists.size()].begin(), lists[i % lists.size()].end());
+      sort(faces.begin(), faces.end(), [prior](Rect a, Rect b) { return compareDistance(a, b, prior); });
+    });
+    runCase("comparePeripheral", "synthetic", candidateCounts[c], iterations * 200, [&](int i) {
+      faces.assign(lists[i % lists.size()].begin(), lists[i % lists.size()].end());
+      sort(faces.begin(), faces.end(), [](Rect a, Rect b) { return comparePeripheral(a, b, 960); });
+    });
+    // association and target selection the session does instead of sorting
+    TrackTable table;
+    NearestTarget nearest;
+    runCase("trackTable", "synthetic", candidateCounts[c], iterations * 200, [&](int i) {
+      table.update(lists[i % lists.size()], Rect(0, 0, 960, 540));
+      nearest.select(table.tracks(), prior, Size(960, 540));
+    });
+  }
+
+  // mbed command formatting
+  runCase("angleCommand", "sweep", 1, iterations * 200, [](int i) {
+    angleCommand((i % 80) - 40.0);
+  });
+
+  Mat::setDefaultAllocator(NULL);
+  if (output != stdout) {
+    fclose(output);
+  }
+  return 0;
+}
+
+/**
+time body over iterations (after a short warm-up) and print one JSON line
+*/
+void runCase(const string &benchmark, const string &corpus, int faceCount, int iterations,
+             const function<void(int)> &body) {
+  for (int i = 0; i < min(iterations, 5); i++) {
+    body(i);
+  }
+  vector<int64_t> samples(iterations);
+  unsigned long heapBefore = heapAllocs.load();
+  unsigned long matBefore = matAllocs.load();
+  int64_t start = nowNs();
+  for (int i = 0; i < iterations; i++) {
+    int64_t t0 = nowNs();
+    body(i);
+    samples[i] = nowNs() - t0;
+  }
+  double seconds = (nowNs() - start) / 1e9;
+  double heapPerIter = (double)(heapAllocs.load() - heapBefore) / iterations;
+  double matPerIter = (double)(matAllocs.load() - matBefore) / iterations;
+
+  sort(samples.begin(), samples.end());
+  double p50 = samples[min(samples.size() - 1, (size_t)(0.50 * samples.size()))] / 1e3;
+  double p95 = samples[min(samples.size() - 1, (size_t)(0.95 * samples.size()))] / 1e3;
+  double p99 = samples[min(samples.size() - 1, (size_t)(0.99 * samples.size()))] / 1e3;
+  fprintf(output, "{\"benchmark\":\"%s\",\"corpus\":\"%s\",\"faces\":%d,\"iterations\":%d,"
+          "\"p50_us\":%.2f,\"p95_us\":%.2f,\"p99_us\":%.2f,\"fps\":%.1f,"
+          "\"heap_allocs_per_iter\":%.2f,\"mat_allocs_per_iter\":%.2f}\n",
+          benchmark.c_str(), corpus.c_str(), faceCount, iterations,
+          p50, p95, p99, iterations / max(seconds, 1e-9), heapPerIter, matPerIter);
+  fflush(output);
+}
+
+/**
+After a warm-up, the per-frame path must not allocate frame buffers again:
+gray conversion, ROI and template-tracker scratch all reuse session storage.
+Face selection and mbed command formatting must not allocate at all.
+Heap and small Mat allocations made inside OpenCV (cascade evaluation,
+matchTemplate, resize tables) are reported, not asserted.
+*/
+void testFrameAllocations(TiledDetector &detector) {
+  const Size resolution(960, 540);
+  vector<Mat> corpus = syntheticCorpus(resolution, 1, 8);
+  largeMatBytes = resolution.area(); //one gray frame
+
+  SessionConfig fullScan;
+  fullScan.tracker.roiTracking = false;
+  fullScan.tracker.hybridTracking = false;
+  SessionConfig tracking; //ROI search and template tracking once a face is found
+
+  for (int mode = 0; mode < 2; mode++) {
+    TrackingSession session(mode ? tracking : fullScan, detector);
+    TrackResult result;
+    for (int i = 0; i < 32; i++) {
+      session.process(corpus[i % corpus.size()], i * 33333333LL, i, result);
+    }
+    unsigned long heapBefore = heapAllocs.load();
+    unsigned long matBefore = matAllocs.load();
+    unsigned long largeBefore = largeMatAllocs.load();
+    for (int i = 32; i < 96; i++) {
+      session.process(corpus[i % corpus.size()], i * 33333333LL, i, result);
+    }
+    printf("%s: %.2f heap, %.2f Mat allocations per frame inside OpenCV\n",
+           mode ? "tracking" : "full scan",
+           (heapAllocs.load() - heapBefore) / 64.0, (matAllocs.load() - matBefore) / 64.0);
+    assert(largeMatAllocs.load() == largeBefore);
+  }
+
+  RNG rng(7);
+  vector<vector<Rect> > lists;
+  for (int i = 0; i < 16; i++) {
+    lists.push_back(randomFaces(rng, 8, resolution));
+  }
+  vector<Rect> faces;
+  faces.reserve(64);
+  Rect prior(400, 200, 120, 120);
+  TrackTable table;
+  NearestTarget nearest;
+  size_t commandBytes = 0;
+  unsigned long heapBefore = heapAllocs.load();
+  unsigned long matBefore = matAllocs.load();
+  for (int i = 0; i < 1000; i++) {
+    faces.assign(lists[i % lists.size()].begin(), lists[i % lists.size()].end());
+    sort(faces.begin(), faces.end(), [prior](Rect a, Rect b) { return compareDistance(a, b, prior); });
+    table.update(faces, Rect(Point(0, 0), resolution));
+    nearest.select(table.tracks(), prior, resolution);
+    commandBytes += strlen(angleCommand((i % 80) - 40.0));
+  }
+  assert(heapAllocs.load() == heapBefore);
+  assert(matAllocs.load() == matBefore);
+  assert(commandBytes > 0);
+
+  largeMatBytes = 0;
+  cout << "frame allocation test passed" << endl;
+}
+
+/**
+seeded noise frames with faceCount simple face-like blobs (skin ellipse,
+dark eyes, mouth) drifting a few pixels from frame to frame
+*/
+vector<Mat> syntheticCorpus(Size resolution, int faceCount, int frames) {
+  RNG rng(42);
+  vector<Rect> faces = randomFaces(rng, faceCount, resolution);
+  vector<Mat> corpus;
+  for (int n = 0; n < frames; n++) {
+    Mat frame(resolution, CV_8UC3);
+    rng.fill(frame, RNG::UNIFORM, Scalar::all(40), Scalar::all(200));
+    for (size_t i = 0; i < faces.size(); i++) {
+      Rect f = faces[i] + Point(2 * n, n);
+      Point c(f.x + f.width/2, f.y + f.height/2);
+      ellipse(frame, c, Size(f.width/2, f.height*6/10), 0, 0, 360, Scalar(140, 170, 220), -1);
+      ellipse(frame, c + Point(-f.width/5, -f.height/8), Size(f.width/10, f.height/20), 0, 0, 360, Scalar(40, 40, 40), -1);
+      ellipse(frame, c + Point(f.width/5, -f.height/8), Size(f.width/10, f.height/20), 0, 0, 360, Scalar(40, 40, 40), -1);
+      line(frame, c + Point(-f.width/6, f.height/4), c + Point(f.width/6, f.height/4), Scalar(60, 60, 120), 3);
+    }
+    corpus.push_back(frame);
+  }
+  return corpus;
+}
+
+vector<Mat> recordedCorpus(const string &dir, Size resolution, int frames) {
+  vector<String> files;
+  glob(dir, files, false);
+  sort(files.begin(), files.end());
+  vector<Mat> corpus;
+  for (size_t i = 0; i < files.size() && (int)corpus.size() < frames; i++) {
+    Mat image = imread(files[i]);
+    if (!image.empty()) {
+      Mat frame;
+      cv::resize(image, frame, resolution);
+      corpus.push_back(frame);
+    }
+  }
+  return corpus;
+}
+
+vector<Rect> randomFaces(RNG &rng, int count, Size frameSize) {
+  vector<Rect> faces;
+  int maxSide = max(40, min(frameSize.width, frameSize.height) / 4);
+  for (int i = 0; i < count; i++) {
+    int side = rng.uniform(40, maxSide);
+    faces.push_back(Rect(rng.uniform(0, frameSize.width - side - 20),
+                         rng.uniform(0, frameSize.height - side - 20), side, side));
+  }
+  return faces;
+}
@@ -0,0 +1,539 @@
+#include "camera_capture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+const char fakeMagic[8] = {'F', 'T', 'F', 'A', 'K', 'E', 'C', 'M'};
+const int driverBuffers = 4;
+
+/* BT.601 fixed point, the constants cvtColor's YUV conversions use */
+const int yuvShift = 20;
+const int yuvCY = 1220542, yuvCUB = 2116026, yuvCUG = -409993, yuvCVG = -852492, yuvCVR = 1673527;
+
+/* bytes of one frame of a raw format, 0 for compressed ones */
+static size_t frameBytes(uint32_t format, int width, int height) {
+  if (format == fourcc('Y', 'U', 'Y', 'V')) {
+    return (size_t)width * height * 2;
+  } else if (format == fourcc('N', 'V', '1', '2')) {
+    return (size_t)width * height * 3 / 2;
+  }
+  return 0;
+}
+
+V4L2Device::V4L2Device()
+  : fd(-1), current(-1), used(0), frameWidth(0), frameHeight(0), rowBytes(0), pixelFormat(0),
+    fakeMap(NULL), fakeSize(0), fakeFrames(0), fakeFrameBytes(0), fakeNext(0) {
+}
+
+V4L2Device::~V4L2Device() {
+  close();
+}
+
+bool V4L2Device::isOpen() const {
+  return fd >= 0 || fakeMap != NULL;
+}
+
+int V4L2Device::width() const {
+  return frameWidth;
+}
+
+int V4L2Device::height() const {
+  return frameHeight;
+}
+
+int V4L2Device::stride() const {
+  return rowBytes;
+}
+
+uint32_t V4L2Device::format() const {
+  return pixelFormat;
+}
+
+const uint8_t *V4L2Device::data() const {
+  if (fakeMap) {
+    return (const uint8_t *)fakeMap + sizeof(FakeCaptureHeader) + fakeNext * fakeFrameBytes;
+  }
+  return current >= 0 ? (const uint8_t *)buffers[current] : NULL;
+}
+
+size_t V4L2Device::bytes() const {
+  return used;
+}
+
+bool V4L2Device::open(const string &path, int width, int height, const vector<uint32_t> &formats) {
+  close();
+  struct stat info;
+  if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+    return openFake(path);
+  }
+#ifdef __linux__
+  fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
+  if (fd < 0) {
+    return false;
+  }
+  v4l2_capability caps;
+  memset(&caps, 0, sizeof(caps));
+  if (ioctl(fd, VIDIOC_QUERYCAP, &caps) < 0 ||
+      !(caps.capabilities & V4L2_CAP_VIDEO_CAPTURE) || !(caps.capabilities & V4L2_CAP_STREAMING) ||
+      !negotiate(width, height, formats)) {
+    close();
+    return false;
+  }
+
+  v4l2_requestbuffers request;
+  memset(&request, 0, sizeof(request));
+  request.count = driverBuffers;
+  request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  request.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2) {
+    close();
+    return false;
+  }
+  for (unsigned i = 0; i < request.count; i++) {
+    v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    if (ioctl(fd, VIDIOC_QUERYBUF, &buffer) < 0) {
+      close();
+      return false;
+    }
+    void *mapped = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+    if (mapped == MAP_FAILED) {
+      close();
+      return false;
+    }
+    buffers.push_back(mapped);
+    lengths.push_back(buffer.length);
+    if (ioctl(fd, VIDIOC_QBUF, &buffer) < 0) {
+      close();
+      return false;
+    }
+  }
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+    close();
+    return false;
+  }
+  return true;
+#else
+  (void)width;
+  (void)height;
+  (void)formats;
+  return false;
+#endif
+}
+
+/* first of formats the driver accepts as is */
+bool V4L2Device::negotiate(int width, int height, const vector<uint32_t> &formats) {
+#ifdef __linux__
+  for (size_t i = 0; i < formats.size(); i++) {
+    v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = width;
+    format.fmt.pix.height = height;
+    format.fmt.pix.pixelformat = formats[i];
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+    if (ioctl(fd, VIDIOC_S_FMT, &format) < 0 || format.fmt.pix.pixelformat != formats[i]) {
+      continue;
+    }
+    frameWidth = format.fmt.pix.width;
+    frameHeight = format.fmt.pix.height;
+    rowBytes = format.fmt.pix.bytesperline;
+    pixelFormat = formats[i];
+    return true;
+  }
+#endif
+  return false;
+}
+
+bool V4L2Device::openFake(const string &path) {
+  int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(FakeCaptureHeader)) {
+    ::close(file);
+    return false;
+  }
+  void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+  ::close(file); //the mapping keeps the file
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  FakeCaptureHeader header;
+  memcpy(&header, mapped, sizeof(header));
+  size_t bytes = frameBytes(header.format, header.width, header.height);
+  if (memcmp(header.magic, fakeMagic, sizeof(header.magic)) != 0 || bytes == 0 ||
+      header.frameCount == 0 ||
+      sizeof(header) + header.frameCount * bytes > (size_t)info.st_size) {
+    munmap(mapped, info.st_size);
+    cout << path << " is not a fake capture file" << endl;
+    return false;
+  }
+  fakeMap = mapped;
+  fakeSize = info.st_size;
+  fakeFrames = header.frameCount;
+  fakeFrameBytes = bytes;
+  fakeNext = fakeFrames - 1; //next() starts at frame 0
+  frameWidth = header.width;
+  frameHeight = header.height;
+  rowBytes = header.format == fourcc('Y', 'U', 'Y', 'V') ? header.width * 2 : header.width;
+  pixelFormat = header.format;
+  return true;
+}
+
+void V4L2Device::close() {
+  if (fakeMap) {
+    munmap(fakeMap, fakeSize);
+    fakeMap = NULL;
+  }
+#ifdef __linux__
+  if (fd >= 0) {
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ioctl(fd, VIDIOC_STREAMOFF, &type);
+  }
+#endif
+  for (size_t i = 0; i < buffers.size(); i++) {
+    munmap(buffers[i], lengths[i]);
+  }
+  buffers.clear();
+  lengths.clear();
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+  current = -1;
+  used = 0;
+}
+
+#ifdef __linux__
+/* give buffer index back to the driver to fill */
+static bool queueBuffer(int fd, int index) {
+  v4l2_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.index = index;
+  while (ioctl(fd, VIDIOC_QBUF, &buffer) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+bool V4L2Device::next(int timeoutMs) {
+  if (fakeMap) {
+    fakeNext = (fakeNext + 1) % fakeFrames;
+    used = fakeFrameBytes;
+    return true;
+  }
+#ifdef __linux__
+  if (fd < 0) {
+    return false;
+  }
+  if (current >= 0) { //the caller is done with it
+    int done = current;
+    current = -1;
+    if (!queueBuffer(fd, done)) {
+      return false;
+    }
+  }
+  //DQBUF hands out the oldest filled buffer: take every filled one, keep the
+  //last and give the older ones straight back, so a caller that fell behind
+  //skips to the newest frame instead of working through stale ones
+  int newest = -1;
+  size_t newestBytes = 0;
+  for (;;) {
+    v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(fd, VIDIOC_DQBUF, &buffer) == 0) {
+      if (newest >= 0 && !queueBuffer(fd, newest)) {
+        queueBuffer(fd, buffer.index);
+        return false;
+      }
+      newest = buffer.index;
+      newestBytes = buffer.bytesused;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN) {
+      break;
+    }
+    if (newest >= 0) {
+      break; //drained
+    }
+    pollfd wait = {fd, POLLIN, 0};
+    int ready = poll(&wait, 1, timeoutMs);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ready <= 0) {
+      return false; //timed out or failed
+    }
+  }
+  if (newest < 0) {
+    return false;
+  }
+  current = newest;
+  used = newestBytes;
+  return true;
+#else
+  (void)timeoutMs;
+  return false;
+#endif
+}
+
+bool writeFakeCapture(const string &path, uint32_t format, const vector<Mat> &frames) {
+  if (frames.empty()) {
+    return false;
+  }
+  bool nv12 = format == fourcc('N', 'V', '1', '2');
+  FakeCaptureHeader header;
+  memcpy(header.magic, fakeMagic, sizeof(header.magic));
+  header.width = frames[0].cols;
+  header.height = nv12 ? frames[0].rows * 2 / 3 : frames[0].rows;
+  header.format = format;
+  header.frameCount = (uint32_t)frames.size();
+  size_t bytes = frameBytes(format, header.width, header.height);
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file || bytes == 0) {
+    if (file) {
+      fclose(file);
+    }
+    return false;
+  }
+  fwrite(&header, sizeof(header), 1, file);
+  for (size_t i = 0; i < frames.size(); i++) {
+    Mat frame = frames[i].isContinuous() ? frames[i] : frames[i].clone();
+    if (frame.total() * frame.elemSize() != bytes) {
+      fclose(file);
+      return false;
+    }
+    fwrite(frame.data, 1, bytes, file);
+  }
+  return fclose(file) == 0;
+}
+
+/* BT.601 conversion of one pixel, u and v centered on 0 */
+static inline void yuvPixel(int y, int u, int v, uchar *bgr) {
+  const int round = 1 << (yuvShift - 1);
+  int luma = max(0, y - 16) * yuvCY;
+  bgr[0] = saturate_cast<uchar>((luma + round + yuvCUB * u) >> yuvShift);
+  bgr[1] = saturate_cast<uchar>((luma + round + yuvCVG * v + yuvCUG * u) >> yuvShift);
+  bgr[2] = saturate_cast<uchar>((luma + round + yuvCVR * v) >> yuvShift);
+}
+
+void yuyvToBgr(const Mat &yuyv, Mat &bgr, int factor) {
+  CV_Assert(yuyv.type() == CV_8UC2 && factor >= 1);
+  Size size(yuyv.cols / factor, yuyv.rows / factor);
+  bgr.create(size, CV_8UC3);
+  int area = factor * factor;
+  for (int oy = 0; oy < size.height; oy++) {
+    uchar *out = bgr.ptr<uchar>(oy);
+    for (int ox = 0; ox < size.width; ox++, out += 3) {
+      int x0 = ox * factor;
+      //macropixels (Y0 U Y1 V) covering the block
+      int p0 = x0 / 2, p1 = (x0 + factor - 1) / 2;
+      int ySum = 0, uSum = 0, vSum = 0;
+      for (int r = 0; r < factor; r++) {
+        const uchar *row = yuyv.ptr<uchar>(oy * factor + r);
+        for (int x = x0; x < x0 + factor; x++) {
+          ySum += row[2 * x];
+        }
+        for (int p = p0; p <= p1; p++) {
+          uSum += row[4 * p + 1];
+          vSum += row[4 * p + 3];
+        }
+      }
+      int chroma = factor * (p1 - p0 + 1);
+      yuvPixel((ySum + area / 2) / area, (uSum + chroma / 2) / chroma - 128,
+               (vSum + chroma / 2) / chroma - 128, out);
+    }
+  }
+}
+
+void nv12ToBgr(const Mat &y, const Mat &uv, Mat &bgr, int factor) {
+  CV_Assert(y.type() == CV_8UC1 && uv.type() == CV_8UC2 && factor >= 1);
+  Size size(y.cols / factor, y.rows / factor);
+  bgr.create(size, CV_8UC3);
+  int area = factor * factor;
+  for (int oy = 0; oy < size.height; oy++) {
+    uchar *out = bgr.ptr<uchar>(oy);
+    int y0 = oy * factor;
+    int r0 = y0 / 2, r1 = (y0 + factor - 1) / 2;
+    for (int ox = 0; ox < size.width; ox++, out += 3) {
+      int x0 = ox * factor;
+      int c0 = x0 / 2, c1 = (x0 + factor - 1) / 2;
+      int ySum = 0, uSum = 0, vSum = 0;
+      for (int r = y0; r < y0 + factor; r++) {
+        const uchar *row = y.ptr<uchar>(r);
+        for (int x = x0; x < x0 + factor; x++) {
+          ySum += row[x];
+        }
+      }
+      for (int r = r0; r <= r1; r++) {
+        const uchar *row = uv.ptr<uchar>(r);
+        for (int c = c0; c <= c1; c++) {
+          uSum += row[2 * c];
+          vSum += row[2 * c + 1];
+        }
+      }
+      int chroma = (r1 - r0 + 1) * (c1 - c0 + 1);
+      yuvPixel((ySum + area / 2) / area, (uSum + chroma / 2) / chroma - 128,
+               (vSum + chroma / 2) / chroma - 128, out);
+    }
+  }
+}
+
+CameraCapture::CameraCapture()
+  : direct(false) {
+}
+
+bool CameraCapture::open(int index, const string &path, Size requested, bool useDirect) {
+  device.close();
+  cap.release();
+  direct = false;
+  if (useDirect) {
+    vector<uint32_t> formats;
+    formats.push_back(fourcc('N', 'V', '1', '2'));
+    formats.push_back(fourcc('Y', 'U', 'Y', 'V'));
+    formats.push_back(fourcc('M', 'J', 'P', 'G'));
+    string name = path.empty() ? "/dev/video" + to_string(index) : path;
+    direct = device.open(name, requested.width, requested.height, formats);
+    if (direct) {
+      return true;
+    }
+    if (!path.empty()) {
+      cout << "could not open " << path << endl;
+      return false;
+    }
+  }
+  if (!cap.open(index)) {
+    return false;
+  }
+  cap.set(CV_CAP_PROP_FRAME_WIDTH, requested.width);
+  cap.set(CV_CAP_PROP_FRAME_HEIGHT, requested.height);
+  return true;
+}
+
+bool CameraCapture::isOpen() const {
+  return direct ? device.isOpen() : cap.isOpened();
+}
+
+Size CameraCapture::size() const {
+  if (direct) {
+    return Size(device.width(), device.height());
+  }
+  return Size(cvRound(cap.get(CV_CAP_PROP_FRAME_WIDTH)), cvRound(cap.get(CV_CAP_PROP_FRAME_HEIGHT)));
+}
+
+const char *CameraCapture::backend() const {
+  if (!direct) {
+    return "VideoCapture";
+  }
+  uint32_t format = device.format();
+  if (format == fourcc('N', 'V', '1', '2')) {
+    return "V4L2 NV12";
+  } else if (format == fourcc('Y', 'U', 'Y', 'V')) {
+    return "V4L2 YUYV";
+  }
+  return "V4L2 MJPEG";
+}
+
+bool CameraCapture::grab() {
+  return direct ? device.next() : cap.grab();
+}
+
+bool CameraCapture::retrieve(Mat &out, Size size) {
+  if (direct) {
+    return retrieveDirect(out, size);
+  }
+  if (!cap.retrieve(full)) {
+    return false;
+  }
+  cv::resize(full, out, size);
+  return true;
+}
+
+bool CameraCapture::read(Mat &out, Size size) {
+  return grab() && retrieve(out, size);
+}
+
+/**
+convert the driver's buffer in place: nothing is copied at full size unless
+the target size is not a whole fraction of the camera's
+*/
+bool CameraCapture::retrieveDirect(Mat &out, Size size) {
+  if (!device.data()) {
+    return false;
+  }
+  int w = device.width(), h = device.height();
+  int factor = size.width > 0 ? w / size.width : 1;
+  bool whole = factor >= 1 && size.width * factor == w && size.height * factor == h;
+  uint8_t *data = (uint8_t *)device.data();
+  uint32_t format = device.format();
+
+  if (format == fourcc('Y', 'U', 'Y', 'V')) {
+    Mat yuyv(h, w, CV_8UC2, data, device.stride());
+    if (whole) {
+      yuyvToBgr(yuyv, out, factor);
+      return true;
+    }
+    cvtColor(yuyv, full, COLOR_YUV2BGR_YUYV);
+  } else if (format == fourcc('N', 'V', '1', '2')) {
+    Mat y(h, w, CV_8UC1, data, device.stride());
+    Mat uv(h / 2, w / 2, CV_8UC2, data + (size_t)device.stride() * h, device.stride());
+    if (whole) {
+      nv12ToBgr(y, uv, out, factor);
+      return true;
+    }
+    Mat planes(h * 3 / 2, w, CV_8UC1, data, device.stride());
+    cvtColor(planes, full, COLOR_YUV2BGR_NV12);
+  } else {
+    //MJPEG: let the decoder skip the detail we would throw away
+    Mat jpeg(1, (int)device.bytes(), CV_8UC1, data);
+    int flags = IMREAD_COLOR;
+    if (whole && factor >= 8) {
+      flags = IMREAD_REDUCED_COLOR_8;
+    } else if (whole && factor >= 4) {
+      flags = IMREAD_REDUCED_COLOR_4;
+    } else if (whole && factor >= 2) {
+      flags = IMREAD_REDUCED_COLOR_2;
+    }
+    full = imdecode(jpeg, flags);
+    if (full.empty()) {
+      return false;
+    }
+    if (full.size() == size) {
+      full.copyTo(out);
+      return true;
+    }
+  }
+  cv::resize(full, out, size, 0, 0, INTER_AREA);
+  return true;
+}
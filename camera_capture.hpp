@@ -0,0 +1,121 @@
+#ifndef CAMERA_CAPTURE_HPP
+#define CAMERA_CAPTURE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* little-endian FourCC, as V4L2 defines pixel formats */
+inline uint32_t fourcc(char a, char b, char c, char d) {
+  return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+/**
+A V4L2 capture device streaming into driver buffers mapped into this process.
+next() hands out the newest filled buffer as is, without a copy, and gives
+the previous one back to the driver, so a buffer stays valid until the
+following next(). Older filled buffers are given back unread, so a caller that
+falls behind skips frames instead of lagging behind the camera.
+A regular file written by writeFakeCapture() opens as a fake device that
+serves its frames in a loop, straight from a mapping of the file, for tests
+and for machines without a camera (v4l2loopback devices open as real ones).
+*/
+class V4L2Device {
+public:
+  V4L2Device();
+  ~V4L2Device();
+
+  /*
+  device: /dev/videoN or a fake capture file
+  formats: pixel formats to ask for, in order of preference; the driver may
+  adjust the size, see width() and height()
+  */
+  bool open(const std::string &device, int width, int height, const std::vector<uint32_t> &formats);
+  void close();
+  bool isOpen() const;
+
+  /* wait up to timeoutMs for the next frame */
+  bool next(int timeoutMs = 2000);
+  const uint8_t *data() const;
+  size_t bytes() const;         // bytes of the current frame
+
+  int width() const;
+  int height() const;
+  int stride() const;           // bytes per row of the first plane
+  uint32_t format() const;
+
+private:
+  V4L2Device(const V4L2Device &);
+  V4L2Device &operator=(const V4L2Device &);
+
+  bool negotiate(int width, int height, const std::vector<uint32_t> &formats);
+  bool openFake(const std::string &path);
+
+  int fd;
+  std::vector<void *> buffers;
+  std::vector<size_t> lengths;
+  int current;                  // buffer held by the caller, -1 for none
+  size_t used;
+  int frameWidth, frameHeight, rowBytes;
+  uint32_t pixelFormat;
+
+  /* fake device: the whole file is mapped, frames follow the header */
+  void *fakeMap;
+  size_t fakeSize, fakeFrames, fakeFrameBytes, fakeNext;
+};
+
+/* header of a fake capture file; frames follow, fakeFrameBytes each */
+struct FakeCaptureHeader {
+  char magic[8];                // "FTFAKECM"
+  uint32_t width, height, format, frameCount;
+};
+
+/* frames as the device would deliver them: YUYV as CV_8UC2, NV12 as CV_8UC1 of height*3/2 rows */
+bool writeFakeCapture(const std::string &path, uint32_t format, const std::vector<cv::Mat> &frames);
+
+/**
+YUYV (4:2:2) or NV12 (4:2:0) straight to BGR at 1/factor of the size: each output
+pixel averages its factor x factor block of luma and the chroma samples
+covering it, then converts with the BT.601 coefficients cvtColor uses.
+Reading the camera buffer once replaces a full-size color conversion, a
+full-size copy and a resize; factor 1 matches cvtColor to within one level.
+*/
+void yuyvToBgr(const cv::Mat &yuyv, cv::Mat &bgr, int factor);
+void nv12ToBgr(const cv::Mat &y, const cv::Mat &uv, cv::Mat &bgr, int factor);
+
+/**
+Camera frames, downscaled to the size detection runs at.
+On Linux, the camera is opened through V4L2 asking for NV12, YUYV, then
+MJPEG, and every frame is converted from the driver's buffer directly at
+the target size: raw formats with the kernels above when the size divides
+evenly, MJPEG decoded at 1/2, 1/4 or 1/8 scale by the JPEG decoder itself;
+other sizes are converted at full size, then resized.
+Other systems and cameras V4L2 can't stream fall back to VideoCapture.
+*/
+class CameraCapture {
+public:
+  CameraCapture();
+
+  /* device: V4L2 device or fake capture file, empty for /dev/video<index> */
+  bool open(int index, const std::string &device, cv::Size requested, bool direct = true);
+  bool isOpen() const;
+  cv::Size size() const;        // the camera's frame size
+  const char *backend() const;
+
+  /* wait for the next frame */
+  bool grab();
+  /* the grabbed frame, as BGR of the given size, into out */
+  bool retrieve(cv::Mat &out, cv::Size size);
+  bool read(cv::Mat &out, cv::Size size);
+
+private:
+  bool retrieveDirect(cv::Mat &out, cv::Size size);
+
+  V4L2Device device;
+  cv::VideoCapture cap;
+  cv::Mat full;                 // full-size BGR of the fallback paths
+  bool direct;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "camera_model.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+CameraCalibration::CameraCalibration()
+  : K(Matx33d::eye()) {
+}
+
+CameraCalibration CameraCalibration::pinhole(double f, double cx, double cy, Size imageSize) {
+  CameraCalibration calibration;
+  calibration.K = Matx33d(f, 0, cx, 0, f, cy, 0, 0, 1);
+  calibration.imageSize = imageSize;
+  return calibration;
+}
+
+bool CameraCalibration::load(const string &path) {
+  FileStorage fs(path, FileStorage::READ);
+  if (!fs.isOpened()) {
+    cout << "could not open calibration " << path << endl;
+    return false;
+  }
+  if (!read(fs.root())) {
+    cout << path << ": camera_matrix must be 3x3" << endl;
+    return false;
+  }
+  return true;
+}
+
+bool CameraCalibration::read(const FileNode &node) {
+  Mat cameraMatrix, coefficients;
+  node["camera_matrix"] >> cameraMatrix;
+  node["distortion_coefficients"] >> coefficients;
+  if (cameraMatrix.rows != 3 || cameraMatrix.cols != 3) {
+    return false;
+  }
+  cameraMatrix.convertTo(cameraMatrix, CV_64F);
+  K = Matx33d((const double *)cameraMatrix.data);
+  distortion = coefficients.empty() ? Mat() : coefficients.reshape(1, 1);
+  int width, height;
+  cv::read(node["image_width"], width, 0);
+  cv::read(node["image_height"], height, 0);
+  imageSize = Size(width, height);
+  return true;
+}
+
+void CameraCalibration::write(FileStorage &fs) const {
+  fs << "image_width" << imageSize.width << "image_height" << imageSize.height;
+  fs << "camera_matrix" << Mat(K);
+  if (!distortion.empty()) {
+    fs << "distortion_coefficients" << distortion;
+  }
+}
+
+void AngleTable::build(const CameraCalibration &calibration, Size frameSize, double scale) {
+  if (frameSize.area() == 0) {
+    table.release();
+    return;
+  }
+  double sx = scale, sy = scale;
+  if (calibration.imageSize.area() > 0) {
+    sx = (double)calibration.imageSize.width / frameSize.width;
+    sy = (double)calibration.imageSize.height / frameSize.height;
+  }
+
+  // every frame pixel in capture coordinates, undistorted to the normalized image plane
+  Mat points(1, frameSize.area(), CV_32FC2);
+  Point2f *p = points.ptr<Point2f>();
+  for (int y = 0; y < frameSize.height; y++) {
+    for (int x = 0; x < frameSize.width; x++) {
+      *p++ = Point2f((float)(x * sx), (float)(y * sy));
+    }
+  }
+  Mat normalized;
+  undistortPoints(points, normalized, Mat(calibration.K), calibration.distortion);
+
+  table.create(frameSize, CV_32FC2);
+  const Point2f *n = normalized.ptr<Point2f>();
+  for (int y = 0; y < frameSize.height; y++) {
+    Point2f *row = table.ptr<Point2f>(y);
+    for (int x = 0; x < frameSize.width; x++, n++) {
+      row[x] = Point2f((float)(atan(n->x) * 180 / CV_PI), (float)(atan(n->y) * 180 / CV_PI));
+    }
+  }
+}
+
+bool AngleTable::empty() const {
+  return table.empty();
+}
+
+Size AngleTable::size() const {
+  return table.size();
+}
+
+Point2f AngleTable::angles(double x, double y) const {
+  int col = min(max(cvRound(x), 0), table.cols - 1);
+  int row = min(max(cvRound(y), 0), table.rows - 1);
+  return table.at<Point2f>(row, col);
+}
@@ -0,0 +1,52 @@
+#ifndef CAMERA_MODEL_HPP
+#define CAMERA_MODEL_HPP
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+/**
+Intrinsics of one camera, as calibrated at imageSize.
+load() reads the YAML or JSON files OpenCV's calibration sample writes:
+camera_matrix (3x3, row-major), distortion_coefficients (k1 k2 p1 p2 [k3 ...],
+optional), image_width and image_height.
+*/
+struct CameraCalibration {
+  CameraCalibration();
+
+  /* distortion-free camera with square pixels */
+  static CameraCalibration pinhole(double f, double cx, double cy, cv::Size imageSize = cv::Size());
+
+  /* false, printing why, if path can't be read or has no camera_matrix */
+  bool load(const std::string &path);
+  /* the same keys from a map node; false if it has no 3x3 camera_matrix */
+  bool read(const cv::FileNode &node);
+  /* the keys load() reads, into the current map of fs */
+  void write(cv::FileStorage &fs) const;
+
+  cv::Matx33d K;
+  cv::Mat distortion;     // empty for none
+  cv::Size imageSize;     // empty if unknown: frames are then scaled by SessionConfig::scale
+};
+
+/**
+Pan and tilt of every pixel of a frame, in degrees, undistorted once when
+the table is built, so mapping a face to angles is one load instead of
+undistortion and two atan per frame.
+Pan is positive to the right of the optical axis, tilt below it. Points
+outside the frame take the angles of the nearest edge pixel.
+*/
+class AngleTable {
+public:
+  /* frameSize: frames the angles are looked up in; scale: capture pixels per frame pixel */
+  void build(const CameraCalibration &calibration, cv::Size frameSize, double scale);
+  bool empty() const;
+  cv::Size size() const;
+
+  /* (pan, tilt) at a frame position */
+  cv::Point2f angles(double x, double y) const;
+
+private:
+  cv::Mat table;  // CV_32FC2
+};
+
+#endif
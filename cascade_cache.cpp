@@ -0,0 +1,291 @@
+#include "cascade_cache.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cv;
+
+const char cacheMagic[8] = {'F', 'T', 'C', 'A', 'S', 'C', 0, 0};
+const uint32_t cacheVersion = 2;      // 2: stump tables instead of YAML
+
+// the payload is raw structs: a layout change needs a new cacheVersion
+static_assert(sizeof(CascadeCacheHeader) == 48 && sizeof(CascadeCacheTables) == 16, "cache header layout");
+static_assert(sizeof(HaarStageSpec) == 12 && sizeof(HaarStumpSpec) == 76, "cache table layout");
+
+MappedFile::MappedFile() : addr(NULL), length(0) {
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const string &path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+  void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd); //the mapping keeps the file alive
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  addr = mapped;
+  length = st.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (addr) {
+    munmap(addr, length);
+  }
+  addr = NULL;
+  length = 0;
+}
+
+const uint8_t *MappedFile::data() const {
+  return (const uint8_t *)addr;
+}
+
+size_t MappedFile::size() const {
+  return length;
+}
+
+uint64_t fnv1a64(const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+string classifierPath(const string &file) {
+  const char *dir = getenv("FT_CLASSIFIERS");
+  return string(dir && *dir ? dir : "src/classifiers") + "/" + file;
+}
+
+string cascadeCachePath(const string &xmlPath) {
+  size_t dot = xmlPath.rfind('.');
+  size_t slash = xmlPath.rfind('/');
+  if (dot == string::npos || (slash != string::npos && dot < slash)) {
+    return xmlPath + ".ftc";
+  }
+  return xmlPath.substr(0, dot) + ".ftc";
+}
+
+/* CascadeClassifier lowers every stage threshold by this much */
+const float stageThresholdEps = 1e-5f;
+
+bool readStumpTables(const string &xmlPath, StumpTables &tables) {
+  FileStorage fs(xmlPath, FileStorage::READ);
+  FileNode root = fs.getFirstTopLevelNode();
+  if (!fs.isOpened() || (string)root["stageType"] != "BOOST" || (string)root["featureType"] != "HAAR") {
+    cout << xmlPath << " is not a HAAR boost cascade in the current format" << endl;
+    return false;
+  }
+  tables.window = Size((int)root["width"], (int)root["height"]);
+  tables.stages.clear();
+  tables.stumps.clear();
+
+  vector<HaarRectSpec> featureRects;
+  vector<int> featureRectCount;
+  FileNode features = root["features"];
+  for (FileNodeIterator f = features.begin(); f != features.end(); ++f) {
+    if ((int)(*f)["tilted"] != 0) {
+      cout << xmlPath << " has tilted features" << endl;
+      return false;
+    }
+    HaarRectSpec rects[3] = {};
+    int ri = 0;
+    FileNode rnode = (*f)["rects"];
+    for (FileNodeIterator r = rnode.begin(); r != rnode.end() && ri < 3; ++r, ri++) {
+      FileNodeIterator v = (*r).begin();
+      v >> rects[ri].x >> rects[ri].y >> rects[ri].width >> rects[ri].height >> rects[ri].weight;
+    }
+    featureRects.insert(featureRects.end(), rects, rects + 3);
+    featureRectCount.push_back(rects[2].weight != 0.0f ? 3 : 2);
+  }
+
+  FileNode stageNodes = root["stages"];
+  for (FileNodeIterator s = stageNodes.begin(); s != stageNodes.end(); ++s) {
+    HaarStageSpec stage;
+    stage.first = (int)tables.stumps.size();
+    stage.threshold = (float)(*s)["stageThreshold"] - stageThresholdEps;
+    FileNode weak = (*s)["weakClassifiers"];
+    for (FileNodeIterator w = weak.begin(); w != weak.end(); ++w) {
+      FileNode internal = (*w)["internalNodes"], leaves = (*w)["leafValues"];
+      if (internal.size() != 4 || leaves.size() != 2) {
+        cout << xmlPath << " has trees deeper than stumps" << endl;
+        return false;
+      }
+      int featureIdx = (int)internal[2];
+      if (featureIdx < 0 || featureIdx >= (int)featureRectCount.size()) {
+        cout << xmlPath << " refers to a missing feature" << endl;
+        return false;
+      }
+      HaarStumpSpec stump;
+      copy(&featureRects[3 * featureIdx], &featureRects[3 * featureIdx] + 3, stump.rects);
+      stump.rectCount = featureRectCount[featureIdx];
+      stump.threshold = (float)(double)internal[3];
+      stump.left = (float)(double)leaves[0];
+      stump.right = (float)(double)leaves[1];
+      tables.stumps.push_back(stump);
+    }
+    stage.count = (int)tables.stumps.size() - stage.first;
+    tables.stages.push_back(stage);
+  }
+  if (tables.stages.empty()) {
+    cout << xmlPath << " has no stages" << endl;
+    return false;
+  }
+  return true;
+}
+
+bool compileCascadeCache(const string &xmlPath, const string &cachePath) {
+  MappedFile xml;
+  StumpTables tables;
+  if (!xml.open(xmlPath) || !readStumpTables(xmlPath, tables)) {
+    return false;
+  }
+  CascadeCacheTables counts;
+  counts.windowWidth = tables.window.width;
+  counts.windowHeight = tables.window.height;
+  counts.stageCount = (int32_t)tables.stages.size();
+  counts.stumpCount = (int32_t)tables.stumps.size();
+  string payload((const char *)&counts, sizeof(counts));
+  payload.append((const char *)tables.stages.data(), tables.stages.size() * sizeof(HaarStageSpec));
+  payload.append((const char *)tables.stumps.data(), tables.stumps.size() * sizeof(HaarStumpSpec));
+
+  CascadeCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, cacheMagic, sizeof(header.magic));
+  header.version = cacheVersion;
+  header.headerSize = sizeof(header);
+  header.sourceSize = xml.size();
+  header.sourceHash = fnv1a64(xml.data(), xml.size());
+  header.payloadSize = payload.size();
+  header.payloadHash = fnv1a64(payload.data(), payload.size());
+
+  // write beside the target and rename, so readers never map a half-written cache
+  string tmpPath = cachePath + ".tmp" + to_string(getpid());
+  FILE *file = fopen(tmpPath.c_str(), "wb");
+  if (!file) {
+    cout << "error creating " << tmpPath << endl;
+    return false;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+  written = fclose(file) == 0 && written;
+  if (!written || rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+    cout << "error writing " << cachePath << endl;
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+CascadeCache::CascadeCache()
+  : tables(NULL), stageTable(NULL), stumpTable(NULL) {
+}
+
+/* every stage's stumps exist and every rect lies inside the window */
+static bool tablesConsistent(const CascadeCacheTables &t, const HaarStageSpec *stages,
+                             const HaarStumpSpec *stumps) {
+  if (t.windowWidth < 3 || t.windowHeight < 3 || t.stageCount <= 0 || t.stumpCount <= 0) {
+    return false;
+  }
+  for (int i = 0; i < t.stageCount; i++) {
+    if (stages[i].first < 0 || stages[i].count <= 0 || stages[i].first > t.stumpCount - stages[i].count) {
+      return false;
+    }
+  }
+  for (int i = 0; i < t.stumpCount; i++) {
+    if (stumps[i].rectCount != 2 && stumps[i].rectCount != 3) {
+      return false;
+    }
+    for (int r = 0; r < stumps[i].rectCount; r++) {
+      const HaarRectSpec &rect = stumps[i].rects[r];
+      if (rect.x < 0 || rect.y < 0 || rect.width < 0 || rect.height < 0 ||
+          rect.x + rect.width > t.windowWidth || rect.y + rect.height > t.windowHeight) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool CascadeCache::open(const string &xmlPath, const MappedFile &xml) {
+  tables = NULL;
+  if (!file.open(cascadeCachePath(xmlPath))) {
+    return false;
+  }
+  CascadeCacheHeader header;
+  if (file.size() < sizeof(header) + sizeof(CascadeCacheTables)) {
+    return false;
+  }
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, cacheMagic, sizeof(header.magic)) != 0 ||
+      header.version != cacheVersion || header.headerSize != sizeof(header) ||
+      header.payloadSize != file.size() - header.headerSize) {
+    return false;
+  }
+  const uint8_t *payload = file.data() + header.headerSize; //page aligned + 48: the tables' alignment holds
+  if (header.sourceSize != xml.size() ||
+      header.sourceHash != fnv1a64(xml.data(), xml.size()) ||
+      header.payloadHash != fnv1a64(payload, header.payloadSize)) {
+    return false;
+  }
+  const CascadeCacheTables *t = (const CascadeCacheTables *)payload;
+  const HaarStageSpec *stages = (const HaarStageSpec *)(t + 1);
+  const HaarStumpSpec *stumps = (const HaarStumpSpec *)(stages + max(t->stageCount, 0));
+  if (t->stageCount < 0 || t->stumpCount < 0 ||
+      header.payloadSize != sizeof(*t) + (uint64_t)t->stageCount * sizeof(HaarStageSpec) +
+                            (uint64_t)t->stumpCount * sizeof(HaarStumpSpec) ||
+      !tablesConsistent(*t, stages, stumps)) {
+    return false;
+  }
+  tables = t;
+  stageTable = stages;
+  stumpTable = stumps;
+  xmlName = xmlPath.substr(xmlPath.find_last_of('/') + 1);
+  return true;
+}
+
+const char *CascadeCache::name() const {
+  return xmlName.c_str();
+}
+
+Size CascadeCache::windowSize() const {
+  return tables ? Size(tables->windowWidth, tables->windowHeight) : Size();
+}
+
+int CascadeCache::stageCount() const {
+  return tables ? tables->stageCount : 0;
+}
+
+int CascadeCache::stumpCount() const {
+  return tables ? tables->stumpCount : 0;
+}
+
+const HaarStageSpec *CascadeCache::stages() const {
+  return stageTable;
+}
+
+const HaarStumpSpec *CascadeCache::stumps() const {
+  return stumpTable;
+}
@@ -0,0 +1,111 @@
+#ifndef CASCADE_CACHE_HPP
+#define CASCADE_CACHE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "compiled_cascade.hpp"
+
+/**
+Precompiled classifier cache.
+A cache file is a fixed header followed by the stump tables of a HAAR stump
+cascade, exactly as the compiled evaluator uses them (compiled_cascade.hpp):
+a CascadeCacheTables record, then the HaarStageSpec and HaarStumpSpec arrays,
+in the byte order and struct layout of the machine that wrote it. Nothing is
+parsed on load: the tables are used in place from a read-only shared mapping,
+so every process that opens the same cache shares its pages. The header
+records the size and FNV-1a hash of the XML it was built from, so an edited
+or replaced XML is detected and loaded directly.
+Only HAAR stump cascades in the current format fit the tables; tree, LBP and
+old-format cascades stay XML and are read by CascadeClassifier.
+*/
+struct CascadeCacheHeader {
+  char magic[8];            // "FTCASC\0\0"
+  uint32_t version;
+  uint32_t headerSize;      // payload starts right after the header
+  uint64_t sourceSize;      // XML file size in bytes
+  uint64_t sourceHash;      // FNV-1a 64 of the XML file
+  uint64_t payloadSize;
+  uint64_t payloadHash;     // catches truncated or corrupted caches
+};
+
+/* start of the payload: the stage array follows, then the stump array */
+struct CascadeCacheTables {
+  int32_t windowWidth, windowHeight;
+  int32_t stageCount, stumpCount;
+};
+
+/* read-only shared mapping of a whole file */
+class MappedFile {
+public:
+  MappedFile();
+  ~MappedFile();
+
+  bool open(const std::string &path);
+  void close();
+  const uint8_t *data() const;
+  size_t size() const;
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+  void *addr;
+  size_t length;
+};
+
+uint64_t fnv1a64(const void *data, size_t size);
+
+/* classifier file under the classifier directory ($FT_CLASSIFIERS, default src/classifiers) */
+std::string classifierPath(const std::string &file);
+/* cache file that belongs to a classifier XML */
+std::string cascadeCachePath(const std::string &xmlPath);
+
+/* stages and stumps of a HAAR stump cascade, with every value as CascadeClassifier reads it */
+struct StumpTables {
+  cv::Size window;
+  std::vector<HaarStageSpec> stages;
+  std::vector<HaarStumpSpec> stumps;
+};
+
+/**
+read the cascade at xmlPath the way CascadeClassifier's Data::read and
+HaarEvaluator::Feature::read do; false, printing why, for anything but HAAR
+stumps without tilted features
+*/
+bool readStumpTables(const std::string &xmlPath, StumpTables &tables);
+
+/* build the cache for xmlPath, replacing cachePath atomically; false, printing why, if it can't */
+bool compileCascadeCache(const std::string &xmlPath, const std::string &cachePath);
+
+/**
+The stump tables of one cache file, straight from its mapping.
+open() checks the cache against the XML and the tables against themselves
+(stage ranges, rects inside the window), so an evaluator can index them
+without further checks.
+*/
+class CascadeCache {
+public:
+  CascadeCache();
+
+  /* map the cache of the XML at xmlPath, whose contents are xml; false if it is missing, stale or damaged */
+  bool open(const std::string &xmlPath, const MappedFile &xml);
+
+  /* file name of the XML */
+  const char *name() const;
+  cv::Size windowSize() const;
+  int stageCount() const;
+  int stumpCount() const;
+  const HaarStageSpec *stages() const;
+  const HaarStumpSpec *stumps() const;
+
+private:
+  MappedFile file;
+  std::string xmlName;
+  const CascadeCacheTables *tables;
+  const HaarStageSpec *stageTable;
+  const HaarStumpSpec *stumpTable;
+};
+
+#endif
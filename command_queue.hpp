@@ -0,0 +1,78 @@
+#ifndef COMMAND_QUEUE_HPP
+#define COMMAND_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/**
+Bounded lock-free queue from any number of producers to one consumer, for
+commands that must not be lost or reordered, unlike the frames RingBuffer
+drops: push() fails instead of evicting when the queue is full.
+Producers claim a slot by advancing head with a compare-and-swap and publish
+it through the slot's sequence number (Vyukov's bounded queue); the consumer
+owns tail, so pop() is a load, a copy and a store. Commands of one producer
+come out in the order it pushed them.
+*/
+template <typename T>
+class CommandQueue {
+public:
+  explicit CommandQueue(size_t capacity)
+    : capacity(capacity < 1 ? 1 : capacity),
+      slots(new Slot[capacity < 1 ? 1 : capacity]),
+      head(0), tail(0) {
+    for (size_t i = 0; i < this->capacity; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /* add value from any thread; returns false if the queue is full */
+  bool push(const T &value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &slot = slots[pos % capacity];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < pos) {
+        return false; //the consumer hasn't freed this slot yet
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /* take the oldest command, from the consumer thread only; false if there is none */
+  bool pop(T &out) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Slot &slot = slots[pos % capacity];
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1) {
+      return false;
+    }
+    out = slot.value;
+    slot.value = T();
+    slot.seq.store(pos + capacity, std::memory_order_release);
+    tail.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  CommandQueue(const CommandQueue &);
+  CommandQueue &operator=(const CommandQueue &);
+
+  const size_t capacity;
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "cascade_cache.hpp"
+#include "compiled_cascade.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+compile classifier XMLs into their caches, by default every classifier in the
+classifier directory that is a HAAR stump cascade; the others are skipped
+run again after replacing a classifier; until then it is loaded from the XML
+*/
+int main(int argc, char **argv) {
+  vector<string> xmlPaths;
+  for (int i = 1; i < argc; i++) {
+    xmlPaths.push_back(argv[i]);
+  }
+  bool all = xmlPaths.empty();
+  if (all) {
+    vector<String> found;
+    glob(classifierPath("*.xml"), found);
+    xmlPaths.assign(found.begin(), found.end());
+  }
+
+  int failed = 0;
+  for (size_t i = 0; i < xmlPaths.size(); i++) {
+    string cachePath = cascadeCachePath(xmlPaths[i]);
+    if (!compileCascadeCache(xmlPaths[i], cachePath)) {
+      cout << (all ? "skipped " : "error compiling ") << xmlPaths[i] << endl;
+      failed += all ? 0 : 1;
+      continue;
+    }
+
+    // time both loads and check the cache is the one picked up
+    CascadeClassifier cascade;
+    int64 start = getTickCount();
+    cascade.load(xmlPaths[i]);
+    double xmlMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+    start = getTickCount();
+    unique_ptr<CompiledCascade> cached = CompiledCascade::createCached(xmlPaths[i]);
+    double cacheMs = (getTickCount() - start) * 1000.0 / getTickFrequency();
+    if (!cached) {
+      cout << "error reading back " << cachePath << endl;
+      failed++;
+      continue;
+    }
+    MappedFile xml, cache;
+    xml.open(xmlPaths[i]);
+    cache.open(cachePath);
+    printf("%s: %zu -> %zu bytes, load %.1f ms -> %.1f ms\n", cachePath.c_str(),
+           xml.size(), cache.size(), xmlMs, cacheMs);
+  }
+  return failed ? -1 : 0;
+}
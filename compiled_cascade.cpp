@@ -0,0 +1,473 @@
+#include "compiled_cascade.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include "cascade_cache.hpp"
+#include "frame_context.hpp"
+#include "cascade_tables.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LANES_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+/* the interpolation CascadeClassifier builds its image pyramid with: the bit-exact
+   one from 3.4.2 on, testCompiledCascade compares the two paths */
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && (CV_VERSION_MINOR > 4 || \
+    (CV_VERSION_MINOR == 4 && CV_VERSION_REVISION >= 2)))
+const int pyramidInterpolation = INTER_LINEAR_EXACT;
+#else
+const int pyramidInterpolation = INTER_LINEAR;
+#endif
+
+/* sum of a rect of an integral image, from the offsets of its 4 corners */
+template <class T>
+static inline T rectSum(const T *p, const int *ofs) {
+  return p[ofs[0]] - p[ofs[1]] - p[ofs[2]] + p[ofs[3]];
+}
+
+static inline void cornerOffsets(int *ofs, int x, int y, int width, int height, int step) {
+  ofs[0] = x + step * y;
+  ofs[1] = x + width + step * y;
+  ofs[2] = x + step * (y + height);
+  ofs[3] = x + width + step * (y + height);
+}
+
+IntegralLevel::IntegralLevel()
+  : scale(0), step(0) {
+}
+
+void IntegralLevel::build(const Mat &gray, float scale) {
+  this->scale = scale;
+  size = Size(max(cvRound(gray.cols / scale), 0), max(cvRound(gray.rows / scale), 0));
+  step = size.width + 1;
+  Mat image = gray;
+  if (size != gray.size()) {
+    image = reuseBuffer(resizedStorage, size, CV_8UC1);
+    cv::resize(gray, image, size, 0, 0, pyramidInterpolation);
+  }
+  size_t total = (size_t)step * (size.height + 1);
+  if (sum.size() < total) {
+    sum.resize(total);
+    sqsum.resize(total);
+  }
+  fill(sum.begin(), sum.begin() + step, 0);
+  fill(sqsum.begin(), sqsum.begin() + step, 0u);
+  for (int y = 0; y < image.rows; y++) {
+    const uchar *row = image.ptr<uchar>(y);
+    int *s = &sum[(size_t)(y + 1) * step];
+    unsigned *sq = &sqsum[(size_t)(y + 1) * step];
+    int rowSum = 0;
+    unsigned rowSqsum = 0;
+    s[0] = 0;
+    sq[0] = 0;
+    for (int x = 0; x < image.cols; x++) {
+      rowSum += row[x];
+      rowSqsum += (unsigned)row[x] * row[x];
+      s[x + 1] = s[x + 1 - step] + rowSum;
+      sq[x + 1] = sq[x + 1 - step] + rowSqsum;
+    }
+  }
+}
+
+bool laneKernelSupported(LaneKernel kernel) {
+  switch (kernel) {
+  case LANE_AUTO:
+  case LANE_SCALAR:
+    return true;
+#ifdef LANES_X86
+  case LANE_AVX2:
+    return checkHardwareSupport(CV_CPU_AVX2);
+#endif
+  default:
+    return false;
+  }
+}
+
+CompiledCascade::CompiledCascade()
+  : kernel(laneKernelSupported(LANE_AVX2) ? LANE_AVX2 : LANE_SCALAR) {
+}
+
+void CompiledCascade::setKernel(LaneKernel kernel) {
+  if (kernel == LANE_AUTO) {
+    kernel = laneKernelSupported(LANE_AVX2) ? LANE_AVX2 : LANE_SCALAR;
+  }
+  CV_Assert(laneKernelSupported(kernel));
+  this->kernel = kernel;
+}
+
+#ifdef LANES_X86
+/* rectSum() of 8 lanes at once, converted to float as the scalar code does */
+__attribute__((target("avx2")))
+static inline __m256 rectSumLanes(const int *base, __m256i lanes, const int *ofs) {
+  __m256i a = _mm256_i32gather_epi32(base, _mm256_add_epi32(lanes, _mm256_set1_epi32(ofs[0])), 4);
+  __m256i b = _mm256_i32gather_epi32(base, _mm256_add_epi32(lanes, _mm256_set1_epi32(ofs[1])), 4);
+  __m256i c = _mm256_i32gather_epi32(base, _mm256_add_epi32(lanes, _mm256_set1_epi32(ofs[2])), 4);
+  __m256i d = _mm256_i32gather_epi32(base, _mm256_add_epi32(lanes, _mm256_set1_epi32(ofs[3])), 4);
+  return _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_sub_epi32(_mm256_sub_epi32(a, b), c), d));
+}
+
+/*
+Stage votes of lanes [0, count & ~7), 8 at a time: the lanes' scores stay in
+registers across the stage's stumps. Every float operation is the scalar
+one, in the same order and without fused multiply-adds, and votes add up
+in double like laneScore, so the scores match the scalar kernel exactly.
+Returns the number of lanes done; the scalar kernel finishes the rest.
+*/
+__attribute__((target("avx2")))
+static size_t stageLanesAVX2(const int *base, const int *laneOffset, const float *laneNorm,
+                             double *laneScore, size_t count, const HaarStumpSpec *stumps,
+                             const int *offsets, const HaarStageSpec &stage) {
+  size_t k = 0;
+  for (; k + 8 <= count; k += 8) {
+    __m256i lanes = _mm256_loadu_si256((const __m256i *)(laneOffset + k));
+    __m256 norm = _mm256_loadu_ps(laneNorm + k);
+    __m256d scoreLo = _mm256_setzero_pd(), scoreHi = _mm256_setzero_pd();
+    for (int t = stage.first; t < stage.first + stage.count; t++) {
+      const HaarStumpSpec &stump = stumps[t];
+      const int *o = offsets + 12 * t;
+      __m256 value = _mm256_add_ps(
+          _mm256_mul_ps(_mm256_set1_ps(stump.rects[0].weight), rectSumLanes(base, lanes, o)),
+          _mm256_mul_ps(_mm256_set1_ps(stump.rects[1].weight), rectSumLanes(base, lanes, o + 4)));
+      if (stump.rectCount == 3) {
+        value = _mm256_add_ps(value, _mm256_mul_ps(_mm256_set1_ps(stump.rects[2].weight),
+                                                   rectSumLanes(base, lanes, o + 8)));
+      }
+      value = _mm256_mul_ps(value, norm);
+      __m256 left = _mm256_cmp_ps(value, _mm256_set1_ps(stump.threshold), _CMP_LT_OQ);
+      __m256 vote = _mm256_blendv_ps(_mm256_set1_ps(stump.right), _mm256_set1_ps(stump.left), left);
+      scoreLo = _mm256_add_pd(scoreLo, _mm256_cvtps_pd(_mm256_castps256_ps128(vote)));
+      scoreHi = _mm256_add_pd(scoreHi, _mm256_cvtps_pd(_mm256_extractf128_ps(vote, 1)));
+    }
+    _mm256_storeu_pd(laneScore + k, scoreLo);
+    _mm256_storeu_pd(laneScore + k + 4, scoreHi);
+  }
+  return k;
+}
+#endif
+
+/* window sizes detectMultiScale visits, as CascadeClassifier picks them; false past the last */
+static bool scanWindow(Size base, double factor, Size gray, Size minSize, Size maxSize, bool &scan) {
+  Size window(cvRound(base.width * factor), cvRound(base.height * factor));
+  if (window.width > maxSize.width || window.height > maxSize.height ||
+      window.width > gray.width || window.height > gray.height) {
+    return false;
+  }
+  scan = window.width >= minSize.width && window.height >= minSize.height;
+  return true;
+}
+
+void CompiledCascade::detectMultiScale(const Mat &gray, vector<Rect> &objects, double scaleFactor,
+                                       Size minSize, Size maxSize) {
+  objects.clear();
+  CV_Assert(gray.type() == CV_8UC1 && scaleFactor > 1);
+  if (maxSize.width <= 0 || maxSize.height <= 0) {
+    maxSize = gray.size();
+  }
+  bool scan;
+  for (double factor = 1; scanWindow(windowSize(), factor, gray.size(), minSize, maxSize, scan);
+       factor *= scaleFactor) {
+    if (scan) {
+      level.build(gray, (float)factor);
+      scanLevel(level, objects);
+    }
+  }
+}
+
+void CompiledCascadeSet::add(unique_ptr<CompiledCascade> model, int tag) {
+  models.push_back(move(model));
+  modelTags.push_back(tag);
+}
+
+bool CompiledCascadeSet::empty() const {
+  return models.empty();
+}
+
+void CompiledCascadeSet::detectMultiScale(const Mat &gray, vector<Rect> &objects, vector<int> &tags,
+                                          double scaleFactor, Size minSize, Size maxSize) {
+  objects.clear();
+  tags.clear();
+  CV_Assert(gray.type() == CV_8UC1 && scaleFactor > 1);
+  if (maxSize.width <= 0 || maxSize.height <= 0) {
+    maxSize = gray.size();
+  }
+  for (double factor = 1; ; factor *= scaleFactor) {
+    bool more = false, built = false;
+    for (size_t m = 0; m < models.size(); m++) {
+      bool scan;
+      if (!scanWindow(models[m]->windowSize(), factor, gray.size(), minSize, maxSize, scan)) {
+        continue;
+      }
+      more = true;
+      if (!scan) {
+        continue;
+      }
+      if (!built) { //the first model to scan this level builds it
+        level.build(gray, (float)factor);
+        built = true;
+      }
+      models[m]->scanLevel(level, objects);
+      tags.resize(objects.size(), modelTags[m]);
+    }
+    if (!more) {
+      break;
+    }
+  }
+}
+
+/* the tables of a model generated into cascade_tables.hpp, constants the compiler folds */
+template <class Model>
+struct BuiltInTables {
+  int windowWidth() const { return Model::windowWidth; }
+  int windowHeight() const { return Model::windowHeight; }
+  int stageCount() const { return Model::stageCount; }
+  int stumpCount() const { return Model::stumpCount; }
+  const HaarStageSpec *stages() const { return Model::stages(); }
+  const HaarStumpSpec *stumps() const { return Model::stumps(); }
+  const char *name() const { return Model::name(); }
+};
+
+/* the tables of a compiled cascade cache, used in place from its mapping */
+struct CachedTables {
+  int windowWidth() const { return cache->windowSize().width; }
+  int windowHeight() const { return cache->windowSize().height; }
+  int stageCount() const { return cache->stageCount(); }
+  int stumpCount() const { return cache->stumpCount(); }
+  const HaarStageSpec *stages() const { return cache->stages(); }
+  const HaarStumpSpec *stumps() const { return cache->stumps(); }
+  const char *name() const { return cache->name(); }
+
+  shared_ptr<const CascadeCache> cache;   // shared by clones, so the file is mapped once
+};
+
+/**
+evaluator of one model's tables, Mirrored for its left-right flip
+per instance scratch: like CascadeClassifier, one instance per thread
+*/
+template <class Tables, bool Mirrored>
+class StumpCascade : public CompiledCascade {
+public:
+  explicit StumpCascade(const Tables &tables) : tables(tables), offsetStep(-1), laneCount(0) {}
+
+  unique_ptr<CompiledCascade> clone() const {
+    return unique_ptr<CompiledCascade>(new StumpCascade<Tables, Mirrored>(tables));
+  }
+
+  const char *name() const {
+    return tables.name();
+  }
+
+  Size windowSize() const {
+    return Size(tables.windowWidth(), tables.windowHeight());
+  }
+
+  /* every window position of one pyramid level, row by row */
+  void scanLevel(const IntegralLevel &level, vector<Rect> &objects) {
+    int yStep = level.scale >= 2 ? 1 : 2;
+    Size working(level.step - tables.windowWidth(), level.size.height + 1 - tables.windowHeight());
+    if (working.width <= 0 || working.height <= 0) {
+      return;
+    }
+    if (level.step != offsetStep) {
+      updateOffsets(level.step);
+    }
+    float scale = level.scale;
+    Size window(cvRound(tables.windowWidth() * scale), cvRound(tables.windowHeight() * scale));
+    for (int y = 0; y < working.height; y += yStep) {
+      scanRow(level, y * level.step, working.width, yStep);
+      for (size_t i = 0; i < laneCount; i++) {
+        objects.push_back(Rect(cvRound(laneX[i] * scale), cvRound(y * scale), window.width, window.height));
+      }
+    }
+  }
+
+private:
+  void updateOffsets(int step) {
+    offsets.resize(tables.stumpCount() * 12);
+    const HaarStumpSpec *stumps = tables.stumps();
+    for (int i = 0; i < tables.stumpCount(); i++) {
+      for (int r = 0; r < 3; r++) {
+        const HaarRectSpec &rect = stumps[i].rects[r];
+        int x = Mirrored ? tables.windowWidth() - rect.x - rect.width : rect.x;
+        cornerOffsets(&offsets[12 * i + 4 * r], x, rect.y, rect.width, rect.height, step);
+      }
+    }
+    cornerOffsets(normOffsets, 1, 1, tables.windowWidth() - 2, tables.windowHeight() - 2, step);
+    offsetStep = step;
+  }
+
+  /**
+  windows of one row, left to right every xStep, through the cascade;
+  leaves the accepted ones in the first laneCount entries of laneX
+  */
+  void scanRow(const IntegralLevel &level, int rowOffset, int width, int xStep) {
+    int positions = (width + xStep - 1) / xStep;
+    if ((int)laneX.size() < positions) {
+      laneX.resize(positions);
+      laneOffset.resize(positions);
+      laneNorm.resize(positions);
+      laneScore.resize(positions);
+      laneResult.resize(positions);
+    }
+
+    //variance normalization; flat windows are rejected before stage 0
+    const double area = (tables.windowWidth() - 2) * (tables.windowHeight() - 2);
+    laneCount = 0;
+    for (int i = 0; i < positions; i++) {
+      int x = i * xStep;
+      int valsum = rectSum(&level.sum[rowOffset + x], normOffsets);
+      unsigned valsqsum = rectSum(&level.sqsum[rowOffset + x], normOffsets);
+      double nf = area * valsqsum - (double)valsum * valsum;
+      laneResult[i] = -1;
+      if (nf > 0.) {
+        float norm = (float)(1. / sqrt(nf));
+        if (area * norm < 1e-1) {
+          laneX[laneCount] = i;
+          laneOffset[laneCount] = rowOffset + x;
+          laneNorm[laneCount] = norm;
+          laneCount++;
+        }
+      }
+    }
+
+    //stage 0 on every lane, then the scan order decides which were visited:
+    //a window rejected by stage 0 makes the scan skip the next position
+    evaluateStage(level, tables.stages()[0]);
+    for (size_t k = 0; k < laneCount; k++) {
+      laneResult[laneX[k]] = laneScore[k] < tables.stages()[0].threshold ? 0 : 1;
+    }
+    size_t kept = 0;
+    for (size_t k = 0; k < laneCount; k++) {
+      int i = laneX[k];
+      bool skipped = i > 0 && laneResult[i - 1] == 0;
+      if (skipped) {
+        laneResult[i] = -1; //not visited, so it can't skip the next one either
+      } else if (laneResult[i] == 1) {
+        laneX[kept] = i;
+        laneOffset[kept] = laneOffset[k];
+        laneNorm[kept] = laneNorm[k];
+        kept++;
+      }
+    }
+    laneCount = kept;
+
+    for (int s = 1; s < tables.stageCount() && laneCount > 0; s++) {
+      const HaarStageSpec &stage = tables.stages()[s];
+      evaluateStage(level, stage);
+      kept = 0;
+      for (size_t k = 0; k < laneCount; k++) {
+        if (laneScore[k] >= stage.threshold) {
+          laneX[kept] = laneX[k];
+          laneOffset[kept] = laneOffset[k];
+          laneNorm[kept] = laneNorm[k];
+          kept++;
+        }
+      }
+      laneCount = kept;
+    }
+    for (size_t k = 0; k < laneCount; k++) {
+      laneX[k] *= xStep; //position index to x
+    }
+  }
+
+  /**
+  stage votes of every lane: one stump at a time over all lanes, with the
+  float operations in CascadeClassifier's order; the AVX2 kernel takes the
+  lanes it can fill 8 at a time
+  */
+  void evaluateStage(const IntegralLevel &level, const HaarStageSpec &stage) {
+    const HaarStumpSpec *stumps = tables.stumps();
+    const int *base = level.sum.data();
+    size_t done = 0;
+#ifdef LANES_X86
+    if (kernel == LANE_AVX2) {
+      done = stageLanesAVX2(base, laneOffset.data(), laneNorm.data(), laneScore.data(), laneCount,
+                            stumps, offsets.data(), stage);
+    }
+#endif
+    fill(laneScore.begin() + done, laneScore.begin() + laneCount, 0.0);
+    for (int t = stage.first; t < stage.first + stage.count; t++) {
+      const HaarStumpSpec &stump = stumps[t];
+      const int *o = &offsets[12 * t];
+      const float w0 = stump.rects[0].weight, w1 = stump.rects[1].weight, w2 = stump.rects[2].weight;
+      if (stump.rectCount == 3) {
+        for (size_t k = done; k < laneCount; k++) {
+          const int *p = base + laneOffset[k];
+          float value = w0 * rectSum(p, o) + w1 * rectSum(p, o + 4);
+          value += w2 * rectSum(p, o + 8);
+          value *= laneNorm[k];
+          laneScore[k] += value < stump.threshold ? stump.left : stump.right;
+        }
+      } else {
+        for (size_t k = done; k < laneCount; k++) {
+          const int *p = base + laneOffset[k];
+          float value = (w0 * rectSum(p, o) + w1 * rectSum(p, o + 4)) * laneNorm[k];
+          laneScore[k] += value < stump.threshold ? stump.left : stump.right;
+        }
+      }
+    }
+  }
+
+  Tables tables;
+  vector<int> offsets;              // 4 corners x 3 rects per stump at offsetStep
+  int normOffsets[4];
+  int offsetStep;
+
+  /* lanes: window positions of the current row still in the cascade */
+  vector<int> laneX, laneOffset;
+  vector<float> laneNorm;
+  vector<double> laneScore;
+  vector<signed char> laneResult;   // per position: -1 not evaluated, 0 rejected by stage 0, 1 passed
+  size_t laneCount;
+};
+
+template <class Tables>
+static unique_ptr<CompiledCascade> newCascade(const Tables &tables, bool mirrored) {
+  return unique_ptr<CompiledCascade>(mirrored ? (CompiledCascade *)new StumpCascade<Tables, true>(tables)
+                                              : new StumpCascade<Tables, false>(tables));
+}
+
+/* the evaluator of xmlPath's cache, NULL if it has none that matches xml */
+static unique_ptr<CompiledCascade> cachedCascade(const string &xmlPath, const MappedFile &xml, bool mirrored) {
+  shared_ptr<CascadeCache> cache = make_shared<CascadeCache>();
+  if (!cache->open(xmlPath, xml)) {
+    return unique_ptr<CompiledCascade>();
+  }
+  CachedTables tables;
+  tables.cache = cache;
+  return newCascade(tables, mirrored);
+}
+
+unique_ptr<CompiledCascade> CompiledCascade::create(const string &xmlPath, bool mirrored) {
+  MappedFile xml;
+  if (!xml.open(xmlPath)) {
+    return unique_ptr<CompiledCascade>();
+  }
+  uint64_t hash = fnv1a64(xml.data(), xml.size());
+#define CREATE_IF_SAME(Model) \
+  if (hash == Model::sourceHash()) { \
+    return newCascade(BuiltInTables<Model>(), mirrored); \
+  }
+  COMPILED_CASCADES(CREATE_IF_SAME)
+#undef CREATE_IF_SAME
+  return cachedCascade(xmlPath, xml, mirrored);
+}
+
+unique_ptr<CompiledCascade> CompiledCascade::createCached(const string &xmlPath, bool mirrored) {
+  MappedFile xml;
+  if (!xml.open(xmlPath)) {
+    return unique_ptr<CompiledCascade>();
+  }
+  return cachedCascade(xmlPath, xml, mirrored);
+}
+
+vector<string> CompiledCascade::models() {
+  vector<string> names;
+#define ADD_NAME(Model) names.push_back(Model::name());
+  COMPILED_CASCADES(ADD_NAME)
+#undef ADD_NAME
+  return names;
+}
@@ -0,0 +1,134 @@
+#ifndef COMPILED_CASCADE_HPP
+#define COMPILED_CASCADE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* one rectangle of a Haar feature, in window coordinates */
+struct HaarRectSpec {
+  int x, y, width, height;
+  float weight;
+};
+
+/* a stump-based weak classifier with its feature inlined */
+struct HaarStumpSpec {
+  HaarRectSpec rects[3];
+  int rectCount;            // 2, or 3 if the third rect has a weight
+  float threshold, left, right;
+};
+
+/* stumps [first, first + count) vote; the stage passes at or above threshold */
+struct HaarStageSpec {
+  int first, count;
+  float threshold;          // already lowered by CascadeClassifier's epsilon
+};
+
+/**
+Stump cascades compiled into the program or loaded from a cascade cache.
+generateCascadeTables turns the classifiers the trackers deploy into constant
+tables at build time (cascade_tables.hpp in the build directory), and
+each table instantiates a templated evaluator; other stump cascades run the
+same evaluator on the tables of their cache, straight from its mapping. Windows are evaluated in
+lanes: every position of a row goes through stage 0 together, the survivors
+through stage 1, and so on, each stump applied to all lanes in one tight loop
+over a shared integral image, instead of walking the classifier's tree of
+stages and features window by window. On CPUs with AVX2, eight lanes go
+through each stump at once, their rect corners fetched with gathers.
+The scan replays what CascadeClassifier::detectMultiScale does for HAAR stump
+cascades with CASCADE_SCALE_IMAGE, scale for scale and window for window, so
+the raw hits are the same; only their order differs.
+*/
+class CompiledCascade;
+
+/* how lanes are evaluated; every kernel gives the scalar one's results bit for bit */
+enum LaneKernel {
+  LANE_AUTO,      // best kernel the CPU supports
+  LANE_SCALAR,
+  LANE_AVX2
+};
+
+bool laneKernelSupported(LaneKernel kernel);
+
+/**
+one level of the image pyramid CascadeClassifier scans: the frame resized by
+1/scale and its 32-bit integral and squared integral (squares wrap like
+CascadeClassifier's); any number of models can scan one level
+*/
+struct IntegralLevel {
+  IntegralLevel();
+
+  void build(const cv::Mat &gray, float scale);
+
+  float scale;
+  cv::Size size;              // of the resized frame
+  int step;                   // integral row length, size.width + 1
+  cv::Mat resizedStorage;
+  std::vector<int> sum;
+  std::vector<unsigned> sqsum;
+};
+
+class CompiledCascade {
+public:
+  CompiledCascade();
+  virtual ~CompiledCascade() {}
+
+  /**
+  the model compiled from the same XML content as xmlPath, else the one in
+  its up-to-date cascade cache (cascade_cache.hpp), NULL if there is neither
+  mirrored: the model with every feature flipped left to right, which finds
+  what the model finds in a flipped frame (right profiles from a left profile
+  model) without flipping the frame
+  */
+  static std::unique_ptr<CompiledCascade> create(const std::string &xmlPath, bool mirrored = false);
+  /* the model in xmlPath's cascade cache only, NULL if it is missing or stale */
+  static std::unique_ptr<CompiledCascade> createCached(const std::string &xmlPath, bool mirrored = false);
+  /* file names of the compiled models */
+  static std::vector<std::string> models();
+
+  /* a new evaluator of the same model, with its own scratch buffers */
+  virtual std::unique_ptr<CompiledCascade> clone() const = 0;
+  virtual const char *name() const = 0;
+  virtual cv::Size windowSize() const = 0;
+
+  /* CascadeClassifier::detectMultiScale on 8-bit gray with minNeighbors 0: raw, ungrouped hits */
+  void detectMultiScale(const cv::Mat &gray, std::vector<cv::Rect> &objects,
+                        double scaleFactor, cv::Size minSize = cv::Size(),
+                        cv::Size maxSize = cv::Size());
+  /* append the hits of every window position of one level, in frame coordinates */
+  virtual void scanLevel(const IntegralLevel &level, std::vector<cv::Rect> &objects) = 0;
+  /* evaluate lanes with kernel, which must be supported; clones start on LANE_AUTO */
+  void setKernel(LaneKernel kernel);
+
+protected:
+  LaneKernel kernel;          // resolved, never LANE_AUTO
+
+private:
+  IntegralLevel level;
+};
+
+/**
+Several compiled models over one pyramid: each level is resized and
+integrated once, then scanned by every model whose window fits it, so adding
+a model costs its cascade evaluation only. Hits are tagged with the tag of
+the model that found them.
+*/
+class CompiledCascadeSet {
+public:
+  void add(std::unique_ptr<CompiledCascade> model, int tag);
+  bool empty() const;
+
+  /* raw hits of every model, as CompiledCascade::detectMultiScale; tags[i] belongs to objects[i] */
+  void detectMultiScale(const cv::Mat &gray, std::vector<cv::Rect> &objects, std::vector<int> &tags,
+                        double scaleFactor, cv::Size minSize = cv::Size(),
+                        cv::Size maxSize = cv::Size());
+
+private:
+  std::vector<std::unique_ptr<CompiledCascade> > models;
+  std::vector<int> modelTags;
+  IntegralLevel level;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "detection_controller.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+const double pressureRise = 1.25;   // per pass over budget
+const double pressureDecay = 1.05;  // per pass under relaxedShare of the budget
+const double relaxedShare = 0.7;
+const double minDownscale = 1.1;    // below this, detect at full resolution
+
+DetectionControlParams::DetectionControlParams()
+  : adaptive(true), budget(0.025), scaleFactor(1.1), maxScaleFactor(1.3),
+    detectFaceSide(48), maxDownscale(4.0), maxPressure(4.0) {
+}
+
+DetectionController::DetectionController(const DetectionControlParams &params,
+                                         Size minFaceSize, Size window)
+  : params(params), minFaceSize(minFaceSize), window(window), currentPressure(1.0) {
+}
+
+DetectionPlan DetectionController::plan(const Rect &face, double sizeMargin) const {
+  DetectionPlan plan;
+  plan.downscale = 1.0;
+  plan.scaleFactor = params.scaleFactor;
+  plan.minSize = minFaceSize;
+  plan.maxSize = Size();
+  int side = max(face.width, face.height);
+  if (side > 0) {
+    int minSide = max(minFaceSize.width, cvRound(side * (1 - sizeMargin)));
+    int maxSide = cvRound(side * (1 + sizeMargin));
+    plan.minSize = Size(minSide, minSide);
+    plan.maxSize = Size(maxSide, maxSide);
+  }
+  if (!params.adaptive) {
+    return plan;
+  }
+
+  double relief = sqrt(currentPressure); //pressure spread over resolution and pyramid step
+  double downscale = side > 0 ? plan.minSize.width / (double)params.detectFaceSide : 1.0;
+  downscale *= relief;
+  if (side == 0) {
+    //full scan: the smallest faces are what pressure gives up first
+    int minSide = cvRound(minFaceSize.width * relief);
+    plan.minSize = Size(minSide, minSide);
+  }
+  //the smallest face searched for must still cover the cascade window
+  downscale = min(downscale, (double)plan.minSize.width / window.width);
+  downscale = min(downscale, params.maxDownscale);
+  plan.downscale = downscale >= minDownscale ? downscale : 1.0;
+  plan.scaleFactor = min(params.maxScaleFactor, 1 + (params.scaleFactor - 1) * relief);
+  return plan;
+}
+
+void DetectionController::record(int64_t elapsedNs) {
+  if (!params.adaptive || params.budget <= 0) {
+    return;
+  }
+  double seconds = elapsedNs / 1e9;
+  if (seconds > params.budget) {
+    currentPressure = min(params.maxPressure, currentPressure * pressureRise);
+  } else if (seconds < params.budget * relaxedShare) {
+    currentPressure = max(1.0, currentPressure / pressureDecay);
+  }
+}
+
+double DetectionController::pressure() const {
+  return currentPressure;
+}
+
+void DetectionController::setPressure(double pressure) {
+  currentPressure = min(params.maxPressure, max(1.0, pressure));
+}
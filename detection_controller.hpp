@@ -0,0 +1,63 @@
+#ifndef DETECTION_CONTROLLER_HPP
+#define DETECTION_CONTROLLER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+/* how one cascade pass is run */
+struct DetectionPlan {
+  double downscale;       // the searched region is shrunk by this before detection
+  double scaleFactor;     // pyramid step
+  cv::Size minSize;       // face size bounds in frame pixels
+  cv::Size maxSize;       // empty for no upper bound
+};
+
+struct DetectionControlParams {
+  DetectionControlParams();
+
+  bool adaptive;          // false: always scaleFactor, minFaceSize, no downscale
+  double budget;          // seconds one cascade pass (gray + cascade) should take
+  double scaleFactor;     // finest pyramid step
+  double maxScaleFactor;  // coarsest pyramid step under budget pressure
+  int detectFaceSide;     // a known face is shrunk to about this many pixels
+  double maxDownscale;
+  double maxPressure;     // how far over budget pressure may push the plan
+};
+
+/**
+Picks the detection resolution, pyramid step and face size bounds of every
+cascade pass from the face being searched for and the time recent passes
+took.
+A known face is searched for at a resolution where it is about
+detectFaceSide pixels wide (never smaller than the cascade window), so a
+large, close face is found on a small image and a small one at full
+resolution. A lost face is searched for at full resolution.
+On top of that, a pressure factor rises multiplicatively while passes run
+over budget and decays slowly while they run well under it. Pressure shrinks
+the image further, coarsens the pyramid and, for full scans, raises the
+smallest face searched for: on slow hardware, distant faces are given up
+before the latency target is.
+*/
+class DetectionController {
+public:
+  DetectionController(const DetectionControlParams &params, cv::Size minFaceSize,
+                      cv::Size window = cv::Size(24, 24));
+
+  /*
+  plan a pass looking for a face of about face's size, +- sizeMargin
+  face empty: look for any face of at least minFaceSize
+  */
+  DetectionPlan plan(const cv::Rect &face, double sizeMargin) const;
+  /* feed back how long a pass took */
+  void record(int64_t elapsedNs);
+  double pressure() const;
+  /* replays force the pressure a recorded session had */
+  void setPressure(double pressure);
+
+private:
+  DetectionControlParams params;
+  cv::Size minFaceSize, window;
+  double currentPressure;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "face_tracker.hpp"
+#include "frame_context.hpp"
+
+#include <algorithm>
+
+using namespace cv;
+
+TemplateTracker::TemplateTracker(double searchExpand, int templateWidth)
+  : scale(1.0), searchExpand(searchExpand), templateWidth(templateWidth) {
+}
+
+void TemplateTracker::init(const Mat &frame, const Rect &face) {
+  Rect inside = face & Rect(Point(0, 0), frame.size());
+  if (inside.width < 4 || inside.height < 4) {
+    reset();
+    return;
+  }
+  Mat gray = reuseBuffer(grayStorage, inside.size(), CV_8UC1);
+  cvtColor(frame(inside), gray, COLOR_BGR2GRAY);
+  scale = std::min(1.0, (double)templateWidth / inside.width);
+  resize(gray, templ, Size(), scale, scale, INTER_AREA);
+  last = inside;
+}
+
+void TemplateTracker::reset() {
+  templ.release();
+}
+
+bool TemplateTracker::valid() const {
+  return !templ.empty();
+}
+
+double TemplateTracker::track(const Mat &frame, Rect &face) {
+  if (templ.empty()) {
+    return 0;
+  }
+  int padX = cvRound(last.width * searchExpand);
+  int padY = cvRound(last.height * searchExpand);
+  Rect window = Rect(last.x - padX, last.y - padY, last.width + 2*padX, last.height + 2*padY) &
+                Rect(Point(0, 0), frame.size());
+  if (window.width < last.width || window.height < last.height) {
+    return 0; //face is leaving the frame
+  }
+
+  //same rounding resize() applies to a scale factor
+  Size smallSize(cvRound(window.width * scale), cvRound(window.height * scale));
+  if (smallSize.width < templ.cols || smallSize.height < templ.rows) {
+    return 0;
+  }
+  Mat gray = reuseBuffer(grayStorage, window.size(), CV_8UC1);
+  Mat small = reuseBuffer(smallStorage, smallSize, CV_8UC1);
+  Mat response = reuseBuffer(responseStorage, smallSize - templ.size() + Size(1, 1), CV_32FC1);
+  cvtColor(frame(window), gray, COLOR_BGR2GRAY);
+  resize(gray, small, smallSize, scale, scale, INTER_AREA);
+  matchTemplate(small, templ, response, TM_CCOEFF_NORMED);
+  double best = 0;
+  Point loc;
+  minMaxLoc(response, 0, &best, 0, &loc);
+
+  last.x = window.x + cvRound(loc.x / scale);
+  last.y = window.y + cvRound(loc.y / scale);
+  face = last;
+  return best;
+}
@@ -0,0 +1,36 @@
+#ifndef FACE_TRACKER_HPP
+#define FACE_TRACKER_HPP
+
+#include <opencv2/opencv.hpp>
+
+/**
+Cheap frame-to-frame face tracker used between cascade runs.
+init() grabs a small grayscale template of the detected face; track() finds
+it again by normalized cross-correlation in a window around the last position.
+Both images are downscaled so the template is templateWidth pixels wide,
+which keeps a tracking step far cheaper than a cascade pass.
+*/
+class TemplateTracker {
+public:
+  TemplateTracker(double searchExpand = 0.5, int templateWidth = 32);
+
+  void init(const cv::Mat &frame, const cv::Rect &face);
+  void reset();
+  bool valid() const;
+
+  /*
+  follow the face into frame and move face onto it
+  returns the correlation peak in [-1, 1]; 0 if the face could not be searched
+  */
+  double track(const cv::Mat &frame, cv::Rect &face);
+
+private:
+  cv::Mat templ;
+  cv::Mat grayStorage, smallStorage, responseStorage; // reused every frame
+  cv::Rect last;
+  double scale;
+  double searchExpand;
+  int templateWidth;
+};
+
+#endif
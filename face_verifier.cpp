@@ -0,0 +1,124 @@
+#include "face_verifier.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include "cascade_cache.hpp"
+#include "frame_context.hpp"
+#include "gray_equalize.hpp"
+
+using namespace std;
+using namespace cv;
+
+/* where each feature is searched for, as a share of the face box */
+struct FeatureSpec {
+  int flag;
+  const char *file;
+  Rect2d area;
+};
+
+const FeatureSpec featureSpecs[] = {
+  {VERIFY_EYES, "haarcascade_eye_tree_eyeglasses.xml", Rect2d(0.0, 0.1, 1.0, 0.5)},
+  {VERIFY_NOSE, "haarcascade_mcs_nose.xml", Rect2d(0.2, 0.3, 0.6, 0.5)},
+  {VERIFY_MOUTH, "haarcascade_mcs_mouth.xml", Rect2d(0.15, 0.6, 0.7, 0.4)},
+};
+const int featureCount = sizeof(featureSpecs) / sizeof(featureSpecs[0]);
+
+VerifyParams::VerifyParams()
+  : features(VERIFY_ALL), minFeatures(1), faceSide(96), minNeighbors(2) {
+}
+
+FaceVerifier::FaceVerifier(ThreadPool &pool, const VerifyParams &params)
+  : pool(pool), params(params) {
+}
+
+bool FaceVerifier::load() {
+  loaded.clear();
+  cascades.assign(pool.size(), vector<CascadeClassifier>());
+  scratch.assign(pool.size(), Scratch());
+  for (int f = 0; f < featureCount; f++) {
+    if (!(params.features & featureSpecs[f].flag)) {
+      continue;
+    }
+    string path = classifierPath(featureSpecs[f].file);
+    // parse the file once and build every worker's classifier from the same tree;
+    // the old-format mcs cascades only convert through load(), once per worker
+    FileStorage fs(path, FileStorage::READ);
+    FileNode root = fs.isOpened() ? fs.getFirstTopLevelNode() : FileNode();
+    bool currentFormat = !root.empty() && !root["stageType"].empty();
+    for (size_t w = 0; w < cascades.size(); w++) {
+      CascadeClassifier cascade;
+      bool read = currentFormat ? cascade.read(root) : cascade.load(path);
+      if (!read) {
+        cout << "error loading " << path << endl;
+        cascades.clear();
+        loaded.clear();
+        return false;
+      }
+      cascades[w].push_back(cascade);
+    }
+    loaded.push_back(f);
+  }
+  return !loaded.empty();
+}
+
+bool FaceVerifier::empty() const {
+  return loaded.empty();
+}
+
+void FaceVerifier::verify(const Mat &frame, vector<Rect> &faces, vector<int> *tags) {
+  if (empty() || faces.empty() || params.minFeatures <= 0) {
+    return;
+  }
+  vector<char> keep(faces.size(), 0);
+  vector<ThreadPool::Task> tasks;
+  for (size_t i = 0; i < faces.size(); i++) {
+    tasks.push_back([&, i](int worker) {
+      keep[i] = countFeatures(frame, faces[i], worker) >= params.minFeatures;
+    });
+  }
+  pool.run(tasks);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < faces.size(); i++) {
+    if (keep[i]) {
+      if (tags) {
+        (*tags)[kept] = (*tags)[i];
+      }
+      faces[kept++] = faces[i];
+    }
+  }
+  faces.resize(kept);
+  if (tags) {
+    tags->resize(kept);
+  }
+}
+
+int FaceVerifier::countFeatures(const Mat &frame, const Rect &face, int worker) {
+  Rect box = face & Rect(Point(0, 0), frame.size());
+  if (box.area() == 0 || loaded.empty()) {
+    return 0;
+  }
+  Scratch &s = scratch[worker];
+  double k = (double)params.faceSide / box.width;
+  Size side(params.faceSide, max(1, cvRound(box.height * k)));
+  Mat scaled = reuseBuffer(s.scaledStorage, side, CV_8UC3);
+  cv::resize(frame(box), scaled, side, 0, 0, k < 1 ? INTER_AREA : INTER_LINEAR);
+  Mat gray = reuseBuffer(s.grayStorage, side, CV_8UC1);
+  equalizedGray(scaled, gray);
+
+  int found = 0;
+  int left = (int)loaded.size();
+  for (size_t i = 0; i < loaded.size() && found < params.minFeatures &&
+                     found + left >= params.minFeatures; i++, left--) {
+    const Rect2d &a = featureSpecs[loaded[i]].area;
+    Rect area = Rect(cvRound(a.x * side.width), cvRound(a.y * side.height),
+                     cvRound(a.width * side.width), cvRound(a.height * side.height)) &
+                Rect(Point(0, 0), side);
+    cascades[worker][i].detectMultiScale(gray(area), s.found, 1.1, params.minNeighbors,
+                                         0|CASCADE_SCALE_IMAGE);
+    if (!s.found.empty()) {
+      found++;
+    }
+  }
+  return found;
+}
@@ -0,0 +1,67 @@
+#ifndef FACE_VERIFIER_HPP
+#define FACE_VERIFIER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "thread_pool.hpp"
+
+/* facial features a candidate face can be verified with; flags combine */
+enum FaceFeature {
+  VERIFY_EYES = 1,    // haarcascade_eye_tree_eyeglasses, upper half of the face
+  VERIFY_NOSE = 2,    // haarcascade_mcs_nose, center of the face
+  VERIFY_MOUTH = 4,   // haarcascade_mcs_mouth, lower third of the face
+  VERIFY_ALL = 7
+};
+
+struct VerifyParams {
+  VerifyParams();
+
+  int features;       // FaceFeature flags to load, searched in the order above
+  int minFeatures;    // features a face must show to be kept
+  int faceSide;       // candidates are resized to this width before the search
+  int minNeighbors;
+};
+
+/**
+Rejects cascade false positives by looking for eyes, nose and mouth inside
+each candidate face.
+Every candidate is one task on the detector's worker pool, so verifying
+several faces takes about as long as verifying one. A candidate is resized to
+faceSide pixels wide, so the cost per face doesn't grow with its size, and
+each feature is only searched for in the part of the face where it belongs.
+Features are tried in order and the search stops as soon as minFeatures are
+found, or when the features left can no longer reach it.
+Like TiledDetector, one classifier per feature is built for every worker, all
+from a single parse of its file (old-format cascades are converted per worker).
+*/
+class FaceVerifier {
+public:
+  explicit FaceVerifier(ThreadPool &pool, const VerifyParams &params = VerifyParams());
+
+  /* load the classifiers of params.features, printing which one failed */
+  bool load();
+  bool empty() const;
+
+  /*
+  drop the faces of frame (BGR) that show fewer than minFeatures features;
+  tags, if given, has one entry per face and is compacted with faces
+  */
+  void verify(const cv::Mat &frame, std::vector<cv::Rect> &faces, std::vector<int> *tags = NULL);
+  /* features found in one face, counting up to minFeatures; worker picks the classifiers */
+  int countFeatures(const cv::Mat &frame, const cv::Rect &face, int worker);
+
+private:
+  /* per-worker scratch, only touched by the task running on that worker */
+  struct Scratch {
+    cv::Mat scaledStorage, grayStorage;
+    std::vector<cv::Rect> found;
+  };
+
+  ThreadPool &pool;
+  VerifyParams params;
+  std::vector<int> loaded;                              // indices into the feature table
+  std::vector<std::vector<cv::CascadeClassifier> > cascades; // [worker][loaded feature]
+  std::vector<Scratch> scratch;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "frame_context.hpp"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+Mat reuseBuffer(Mat &storage, Size size, int type) {
+  if (storage.type() != type || storage.cols < size.width || storage.rows < size.height) {
+    storage.create(max(storage.rows, size.height), max(storage.cols, size.width), type);
+  }
+  return storage(Rect(Point(0, 0), size));
+}
+
+FrameContext::FrameContext(size_t maxFaces) {
+  faces.reserve(maxFaces);
+  hits.reserve(maxFaces);
+  regions.reserve(maxFaces);
+}
+
+Mat FrameContext::gray(Size size) {
+  return reuseBuffer(grayStorage, size, CV_8UC1);
+}
+
+Mat FrameContext::scaled(Size size) {
+  return reuseBuffer(scaledStorage, size, CV_8UC3);
+}
+
+FramePool::FramePool(size_t size)
+  : frames(max<size_t>(size, 1)), index(0) {
+}
+
+Mat &FramePool::next() {
+  Mat &frame = frames[index++ % frames.size()];
+  //other stages release their references concurrently: read the count atomically,
+  //as OpenCV updates it; a stale count only errs towards allocating
+  if (frame.u && CV_XADD(&frame.u->refcount, 0) > 1) {
+    frame.release();
+  }
+  return frame;
+}
@@ -0,0 +1,52 @@
+#ifndef FRAME_CONTEXT_HPP
+#define FRAME_CONTEXT_HPP
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/**
+size x type view at the top-left of storage, growing storage only when it is
+too small. Functions like cvtColor or resize write straight into a view of
+the right size, so the same memory is reused frame after frame even when the
+region of interest changes size.
+*/
+cv::Mat reuseBuffer(cv::Mat &storage, cv::Size size, int type);
+
+/**
+Scratch state of one session's detection stage, reused across frames so the
+steady-state frame path does not go back to the allocator.
+*/
+struct FrameContext {
+  explicit FrameContext(size_t maxFaces = 64);
+
+  /* grayscale detection input of the given size, equalized in place */
+  cv::Mat gray(cv::Size size);
+  /* BGR region shrunk for detection at a coarser resolution */
+  cv::Mat scaled(cv::Size size);
+
+  cv::Mat grayStorage, scaledStorage;
+  std::vector<cv::Rect> faces;   // candidates of the current frame
+  std::vector<int> poses;        // FacePose of each candidate
+  std::vector<cv::Rect> hits;    // faces of one cascade pass, in pass coordinates
+  std::vector<int> hitPoses;     // FacePose of each hit
+  std::vector<cv::Rect> regions; // parts of the searched region given a pass
+};
+
+/**
+Fixed ring of frame buffers for the capture stage.
+A buffer is handed out again only once no later stage (queues, detection,
+display) still references it; otherwise it is dropped from the ring and the
+caller's next write allocates a fresh one.
+*/
+class FramePool {
+public:
+  explicit FramePool(size_t size);
+
+  cv::Mat &next();
+
+private:
+  std::vector<cv::Mat> frames;
+  size_t index;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <cctype>
+#include <string>
+#include <vector>
+#include "cascade_cache.hpp"
+#include "compiled_cascade.hpp"
+
+using namespace std;
+using namespace cv;
+
+/* Function Headers */
+bool writeTables(FILE *out, const string &xmlPath, string &model);
+
+/**
+Generates cascade_tables.hpp, the constant tables CompiledCascade
+evaluates, from HAAR stump cascades. The build runs it on the classifiers
+the trackers load; every value is read and rounded exactly like
+CascadeClassifier reads it, so the compiled evaluator votes with the same
+floats.
+
+usage: generateCascadeTables cascade_tables.hpp cascade.xml...
+*/
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    cout << "usage: generateCascadeTables cascade_tables.hpp cascade.xml..." << endl;
+    return -1;
+  }
+  string path = argv[1], tmpPath = path + ".tmp";
+  FILE *out = fopen(tmpPath.c_str(), "w");
+  if (!out) {
+    cout << "error creating " << tmpPath << endl;
+    return -1;
+  }
+  fprintf(out, "/* generated by generateCascadeTables, do not edit */\n");
+  fprintf(out, "#ifndef CASCADE_TABLES_HPP\n#define CASCADE_TABLES_HPP\n\n");
+  fprintf(out, "#include <cstdint>\n#include \"compiled_cascade.hpp\"\n\nnamespace cascade_tables {\n");
+  vector<string> models;
+  for (int i = 2; i < argc; i++) {
+    string model;
+    if (!writeTables(out, argv[i], model)) {
+      fclose(out);
+      remove(tmpPath.c_str());
+      return -1;
+    }
+    models.push_back(model);
+  }
+  fprintf(out, "\n} // namespace cascade_tables\n\n");
+  fprintf(out, "/* X(model) for every compiled model */\n#define COMPILED_CASCADES(X)");
+  for (size_t i = 0; i < models.size(); i++) {
+    fprintf(out, " \\\n  X(cascade_tables::%s)", models[i].c_str());
+  }
+  fprintf(out, "\n\n#endif\n");
+  if (fclose(out) != 0 || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    cout << "error writing " << path << endl;
+    return -1;
+  }
+  return 0;
+}
+
+/* "haarcascade_frontalface_alt.xml" -> "FrontalfaceAlt" */
+static string modelName(const string &file) {
+  string base = file.substr(0, file.rfind('.'));
+  if (base.compare(0, 12, "haarcascade_") == 0) {
+    base = base.substr(12);
+  }
+  string name;
+  bool upper = true;
+  for (size_t i = 0; i < base.size(); i++) {
+    if (!isalnum((unsigned char)base[i])) {
+      upper = true;
+    } else {
+      name += upper ? (char)toupper((unsigned char)base[i]) : base[i];
+      upper = false;
+    }
+  }
+  return name;
+}
+
+/* float literal that reads back as exactly f */
+static string literal(float f) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.9ef", f);
+  return text;
+}
+
+/* stages and stumps of one cascade as readStumpTables() reads them, as C++ tables */
+bool writeTables(FILE *out, const string &xmlPath, string &model) {
+  StumpTables tables;
+  MappedFile xml;
+  if (!readStumpTables(xmlPath, tables) || !xml.open(xmlPath)) {
+    return false;
+  }
+  string file = xmlPath.substr(xmlPath.find_last_of('/') + 1);
+  model = modelName(file);
+  const vector<HaarStageSpec> &stages = tables.stages;
+  const vector<HaarStumpSpec> &stumps = tables.stumps;
+
+  fprintf(out, "\n/* %s: %lu stages, %lu stumps */\n", file.c_str(),
+          (unsigned long)stages.size(), (unsigned long)stumps.size());
+  fprintf(out, "constexpr HaarStumpSpec %sStumps[] = {\n", model.c_str());
+  for (size_t i = 0; i < stumps.size(); i++) {
+    const HaarRectSpec *rects = stumps[i].rects;
+    fprintf(out, "  {{");
+    for (int r = 0; r < 3; r++) {
+      fprintf(out, "%s{%d, %d, %d, %d, %s}", r ? ", " : "",
+              rects[r].x, rects[r].y, rects[r].width, rects[r].height, literal(rects[r].weight).c_str());
+    }
+    fprintf(out, "}, %d, %s, %s, %s}%s\n", stumps[i].rectCount, literal(stumps[i].threshold).c_str(),
+            literal(stumps[i].left).c_str(), literal(stumps[i].right).c_str(),
+            i + 1 < stumps.size() ? "," : "");
+  }
+  fprintf(out, "};\nconstexpr HaarStageSpec %sStages[] = {\n", model.c_str());
+  for (size_t i = 0; i < stages.size(); i++) {
+    fprintf(out, "  {%d, %d, %s}%s\n", stages[i].first, stages[i].count,
+            literal(stages[i].threshold).c_str(), i + 1 < stages.size() ? "," : "");
+  }
+  fprintf(out, "};\n");
+  fprintf(out, "struct %s {\n", model.c_str());
+  fprintf(out, "  enum { windowWidth = %d, windowHeight = %d, stageCount = %lu, stumpCount = %lu };\n",
+          tables.window.width, tables.window.height, (unsigned long)stages.size(), (unsigned long)stumps.size());
+  fprintf(out, "  static const char *name() { return \"%s\"; }\n", file.c_str());
+  fprintf(out, "  static uint64_t sourceHash() { return 0x%016llxULL; }\n",
+          (unsigned long long)fnv1a64(xml.data(), xml.size()));
+  fprintf(out, "  static const HaarStumpSpec *stumps() { return %sStumps; }\n", model.c_str());
+  fprintf(out, "  static const HaarStageSpec *stages() { return %sStages; }\n", model.c_str());
+  fprintf(out, "};\n");
+  return true;
+}
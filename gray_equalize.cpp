@@ -0,0 +1,177 @@
+#include "gray_equalize.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAY_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+// cvtColor's fixed-point BGR2GRAY weights, scaled by 1 << 14
+const int lumaShift = 14;
+const int lumaB = 1868, lumaG = 9617, lumaR = 4899;
+
+static inline uint8_t lumaPixel(const uint8_t *p) {
+  return (uint8_t)((p[0]*lumaB + p[1]*lumaG + p[2]*lumaR + (1 << (lumaShift - 1))) >> lumaShift);
+}
+
+/* luma of pixels [x, width) of one row */
+static void lumaScalar(const uint8_t *bgr, uint8_t *gray, int x, int width) {
+  for (; x < width; x++) {
+    gray[x] = lumaPixel(bgr + 3*x);
+  }
+}
+
+#ifdef GRAY_X86
+/*
+Each 16 byte load starts at a pixel and covers 4 of them (plus 4 spare
+bytes). One shuffle spreads b and g of each pixel into the two 16-bit halves
+of a 32-bit lane, another r, so two madds give the weighted sum per pixel.
+Loads read 4 bytes past the last pixel they convert, hence the margins.
+*/
+__attribute__((target("ssse3")))
+static int lumaSSSE3(const uint8_t *bgr, uint8_t *gray, int width) {
+  const __m128i maskBG = _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+  const __m128i maskR = _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+  const __m128i coefBG = _mm_set1_epi32((lumaG << 16) | lumaB);
+  const __m128i coefR = _mm_set1_epi32(lumaR);
+  const __m128i round = _mm_set1_epi32(1 << (lumaShift - 1));
+  int x = 0;
+  for (; x + 18 <= width; x += 16) {
+    __m128i sums[4];
+    for (int k = 0; k < 4; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(bgr + 3*x + 12*k));
+      __m128i s = _mm_add_epi32(_mm_madd_epi16(_mm_shuffle_epi8(v, maskBG), coefBG),
+                                _mm_madd_epi16(_mm_shuffle_epi8(v, maskR), coefR));
+      sums[k] = _mm_srli_epi32(_mm_add_epi32(s, round), lumaShift);
+    }
+    __m128i lo = _mm_packs_epi32(sums[0], sums[1]);
+    __m128i hi = _mm_packs_epi32(sums[2], sums[3]);
+    _mm_storeu_si128((__m128i *)(gray + x), _mm_packus_epi16(lo, hi));
+  }
+  return x;
+}
+
+/* same as the SSSE3 kernel, with pixels 8k..8k+3 and 8k+4..8k+7 in the two lanes */
+__attribute__((target("avx2")))
+static int lumaAVX2(const uint8_t *bgr, uint8_t *gray, int width) {
+  const __m256i maskBG = _mm256_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1,
+                                          0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+  const __m256i maskR = _mm256_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1,
+                                         2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+  const __m256i coefBG = _mm256_set1_epi32((lumaG << 16) | lumaB);
+  const __m256i coefR = _mm256_set1_epi32(lumaR);
+  const __m256i round = _mm256_set1_epi32(1 << (lumaShift - 1));
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  int x = 0;
+  for (; x + 34 <= width; x += 32) {
+    __m256i sums[4];
+    for (int k = 0; k < 4; k++) {
+      const uint8_t *p = bgr + 3*x + 24*k;
+      __m256i v = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+          _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+      __m256i s = _mm256_add_epi32(_mm256_madd_epi16(_mm256_shuffle_epi8(v, maskBG), coefBG),
+                                   _mm256_madd_epi16(_mm256_shuffle_epi8(v, maskR), coefR));
+      sums[k] = _mm256_srli_epi32(_mm256_add_epi32(s, round), lumaShift);
+    }
+    //packs work per lane: the 4-pixel groups come out as 0 8 16 24 | 4 12 20 28
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(sums[0], sums[1]),
+                                         _mm256_packs_epi32(sums[2], sums[3]));
+    _mm256_storeu_si256((__m256i *)(gray + x), _mm256_permutevar8x32_epi32(packed, order));
+  }
+  return x;
+}
+#endif
+
+bool grayKernelSupported(GrayKernel kernel) {
+  switch (kernel) {
+  case GRAY_AUTO:
+  case GRAY_SCALAR:
+    return true;
+#ifdef GRAY_X86
+  case GRAY_SSSE3:
+    return checkHardwareSupport(CV_CPU_SSSE3);
+  case GRAY_AVX2:
+    return checkHardwareSupport(CV_CPU_AVX2);
+#endif
+  default:
+    return false;
+  }
+}
+
+void equalizedGray(const Mat &bgr, Mat &gray, GrayKernel kernel) {
+  CV_Assert(bgr.type() == CV_8UC3 && gray.type() == CV_8UC1 && bgr.size() == gray.size());
+  if (bgr.empty()) {
+    return;
+  }
+  if (kernel == GRAY_AUTO) {
+    kernel = grayKernelSupported(GRAY_AVX2) ? GRAY_AVX2 :
+             grayKernelSupported(GRAY_SSSE3) ? GRAY_SSSE3 : GRAY_SCALAR;
+  }
+  CV_Assert(grayKernelSupported(kernel));
+
+  // Pass 1: luma, and the histogram of each row while it is still in L1.
+  // Four interleaved counters keep repeated values from serializing on one slot.
+  int width = bgr.cols;
+  uint32_t hist4[4][256];
+  memset(hist4, 0, sizeof(hist4));
+  for (int y = 0; y < bgr.rows; y++) {
+    const uint8_t *src = bgr.ptr<uint8_t>(y);
+    uint8_t *dst = gray.ptr<uint8_t>(y);
+    int x = 0;
+#ifdef GRAY_X86
+    if (kernel == GRAY_AVX2) {
+      x = lumaAVX2(src, dst, width);
+    } else if (kernel == GRAY_SSSE3) {
+      x = lumaSSSE3(src, dst, width);
+    }
+#endif
+    lumaScalar(src, dst, x, width);
+
+    x = 0;
+    for (; x + 4 <= width; x += 4) {
+      hist4[0][dst[x]]++;
+      hist4[1][dst[x + 1]]++;
+      hist4[2][dst[x + 2]]++;
+      hist4[3][dst[x + 3]]++;
+    }
+    for (; x < width; x++) {
+      hist4[0][dst[x]]++;
+    }
+  }
+
+  // The table exactly as equalizeHist builds it
+  int hist[256];
+  for (int i = 0; i < 256; i++) {
+    hist[i] = hist4[0][i] + hist4[1][i] + hist4[2][i] + hist4[3][i];
+  }
+  int total = width * bgr.rows;
+  int i = 0;
+  while (!hist[i]) {
+    ++i;
+  }
+  if (hist[i] == total) {
+    gray.setTo(i);
+    return;
+  }
+  uchar lut[256];
+  float scale = (256 - 1.f) / (total - hist[i]);
+  int sum = 0;
+  for (lut[i++] = 0; i < 256; ++i) {
+    sum += hist[i];
+    lut[i] = saturate_cast<uchar>(sum * scale);
+  }
+
+  // Pass 2: apply it in place
+  for (int y = 0; y < gray.rows; y++) {
+    uint8_t *row = gray.ptr<uint8_t>(y);
+    for (int x = 0; x < width; x++) {
+      row[x] = lut[row[x]];
+    }
+  }
+}
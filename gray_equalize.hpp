@@ -0,0 +1,28 @@
+#ifndef GRAY_EQUALIZE_HPP
+#define GRAY_EQUALIZE_HPP
+
+#include <opencv2/opencv.hpp>
+
+/**
+Detection preprocessing in two passes instead of three.
+The first pass converts BGR to luma and counts the histogram of each row while
+it is still in L1; the second applies the equalization table in place. The
+result is bit-exact with cvtColor(COLOR_BGR2GRAY) followed by equalizeHist:
+same 14-bit fixed-point luma weights, same table rounding.
+*/
+enum GrayKernel {
+  GRAY_AUTO,      // best kernel the CPU supports
+  GRAY_SCALAR,
+  GRAY_SSSE3,
+  GRAY_AVX2
+};
+
+bool grayKernelSupported(GrayKernel kernel);
+
+/*
+bgr: CV_8UC3, gray: CV_8UC1 of the same size, typically a reuseBuffer() view
+either may be a region of a larger image
+*/
+void equalizedGray(const cv::Mat &bgr, cv::Mat &gray, GrayKernel kernel = GRAY_AUTO);
+
+#endif
@@ -2,20 +2,37 @@
 
 #include <iostream>
 #include <stdio.h>
+#include "activity_filter.hpp"
+#include "cascade_cache.hpp"
+#include "face_verifier.hpp"
+
+#define ACTIVITY_FILTER 0 // ActivityMode: 1 search moving parts, 2 skin-coloured, 3 either
 
 using namespace std;
 using namespace cv;
 
-CascadeClassifier face_cascade, eyes_cascade;
+CascadeClassifier face_cascade;
 String window_name = "Face Detection";
+ActivityFilter activity; // set up in main
+ThreadPool pool;
+
+VerifyParams eyesOnly() {
+  VerifyParams params;
+  params.features = VERIFY_EYES;
+  return params;
+}
+FaceVerifier eyes(pool, eyesOnly()); // loaded in main
 
 /**
  * Detects faces and draws an ellipse around them
+ * With ACTIVITY_FILTER, only the parts of the frame it marks are searched;
+ * faces found earlier in parts that stayed still are kept
  */
 void detectFaces(Mat frame) {
 
-  std::vector<Rect> faces;
+  std::vector<Rect> faces, found, parts;
   Mat frame_gray;
+  Rect whole(Point(0, 0), frame.size());
 
   // Convert to gray scale
   cvtColor(frame, frame_gray, COLOR_BGR2GRAY);
@@ -23,27 +40,28 @@ void detectFaces(Mat frame) {
   // Equalize histogram
   equalizeHist(frame_gray, frame_gray);
 
-  // Detect faces
-  face_cascade.detectMultiScale(frame_gray, faces, 1.1, 3,
-				0|CASCADE_SCALE_IMAGE, Size(30, 30));
+  // Detect faces in the active parts of the frame
+  activity.update(frame);
+  activity.regions(whole, 30, parts);
+  for(size_t p = 0; p < parts.size(); p++) {
+    face_cascade.detectMultiScale(frame_gray(parts[p]), found, 1.1, 3,
+				  0|CASCADE_SCALE_IMAGE, Size(30, 30));
+    for(size_t i = 0; i < found.size(); i++)
+      faces.push_back(found[i] + parts[p].tl());
+  }
 
-  // Iterate over all of the faces
-  for(size_t i = 0; i < faces.size(); i++) {
+  // Keep the faces with eyes in their upper half, checking all faces at once
+  eyes.verify(frame, faces);
 
+  // Faces in still parts keep their last result
+  activity.carry(whole, faces);
+  activity.remember(faces, whole);
+  for(size_t i = 0; i < faces.size(); i++) {
     // Find center of faces
     Point center(faces[i].x + faces[i].width/2, faces[i].y + faces[i].height/2);
-
-    Mat face = frame_gray(faces[i]);
-    std::vector<Rect> eyes;
-
-    // Try to detect eyes, inside each face
-    eyes_cascade.detectMultiScale(face, eyes, 1.1, 2,
-				  0 |CASCADE_SCALE_IMAGE, Size(30, 30) );
-
-    if(eyes.size() > 0)
-      // Draw ellipse around face
-      ellipse(frame, center, Size(faces[i].width/2, faces[i].height/2),
-	      0, 0, 360, Scalar( 255, 0, 255 ), 4, 8, 0 );
+    // Draw ellipse around face
+    ellipse(frame, center, Size(faces[i].width/2, faces[i].height/2),
+	    0, 0, 360, Scalar( 255, 0, 255 ), 4, 8, 0 );
   }
 
   // Display frame
@@ -56,8 +74,18 @@ int main() {
   VideoCapture cap(0); // Open default camera
   Mat frame;
 
-  face_cascade.load("haarcascade_frontalface_alt.xml"); // load faces
-  eyes_cascade.load("haarcascade_eye_tree_eyeglasses.xml"); // load eyes
+  if (!face_cascade.load(classifierPath("haarcascade_frontalface_alt.xml"))) { // load faces
+    cout << "error loading face classifier" << endl;
+    return -1;
+  }
+  if (!eyes.load()) { // load eyes
+    cout << "error loading eye classifier" << endl;
+    return -1;
+  }
+
+  ActivityParams params;
+  params.mode = ACTIVITY_FILTER;
+  activity = ActivityFilter(params);
 
   while(cap.read(frame)) {
     detectFaces(frame); // Call function to detect faces
@@ -0,0 +1,115 @@
+#include "metrics_server.hpp"
+#include "stage_stats.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+const int acceptPollMs = 100;       // how quickly stop() is noticed
+const int requestTimeoutMs = 1000;  // a client gets this long to send its request
+
+MetricsServer::MetricsServer() : listenFd(-1), boundPort(0), running(false) {
+}
+
+MetricsServer::~MetricsServer() {
+  stop();
+}
+
+bool MetricsServer::start(int port) {
+  stop();
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    perror("metrics socket");
+    return false;
+  }
+  int yes = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); //local scrapers only
+  addr.sin_port = htons(port);
+  socklen_t len = sizeof(addr);
+  if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 4) != 0 ||
+      getsockname(listenFd, (sockaddr *)&addr, &len) != 0) {
+    fprintf(stderr, "metrics: could not listen on port %d: %s\n", port, strerror(errno));
+    close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+  boundPort = ntohs(addr.sin_port);
+  running = true;
+  serveThread = thread(&MetricsServer::serveLoop, this);
+  return true;
+}
+
+void MetricsServer::stop() {
+  running = false;
+  if (serveThread.joinable()) {
+    serveThread.join();
+  }
+  if (listenFd >= 0) {
+    close(listenFd);
+    listenFd = -1;
+  }
+}
+
+int MetricsServer::port() const {
+  return boundPort;
+}
+
+void MetricsServer::serveLoop() {
+  pollfd listening = {listenFd, POLLIN, 0};
+  while (running) {
+    if (poll(&listening, 1, acceptPollMs) <= 0) {
+      continue;
+    }
+    int client = accept(listenFd, NULL, NULL);
+    if (client < 0) {
+      continue;
+    }
+    // read the request head and ignore it
+    char request[1024];
+    pollfd incoming = {client, POLLIN, 0};
+    if (poll(&incoming, 1, requestTimeoutMs) > 0) {
+      recv(client, request, sizeof(request), 0);
+    }
+    string body = renderMetrics();
+    char head[160];
+    snprintf(head, sizeof(head),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n", body.size());
+    string response = head + body;
+    for (size_t sent = 0; sent < response.size(); ) {
+      ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    close(client);
+  }
+}
+
+bool writeMetricsFile(const string &path) {
+  string body = renderMetrics();
+  string tmpPath = path + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+  bool written = fwrite(body.data(), 1, body.size(), file) == body.size();
+  written = fclose(file) == 0 && written;
+  if (!written || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,39 @@
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+/**
+Serves renderMetrics() over HTTP on 127.0.0.1, for Prometheus to scrape.
+Every request, whatever its path, gets the current metrics; one connection
+is handled at a time on the server's own thread, so a scrape never touches
+the pipeline threads beyond reading their atomic counters.
+*/
+class MetricsServer {
+public:
+  MetricsServer();
+  ~MetricsServer();
+
+  /* listen on port (0 picks a free one), printing what failed */
+  bool start(int port);
+  void stop();
+  int port() const;
+
+private:
+  MetricsServer(const MetricsServer &);
+  MetricsServer &operator=(const MetricsServer &);
+
+  void serveLoop();
+
+  int listenFd;
+  int boundPort;
+  std::atomic<bool> running;
+  std::thread serveThread;
+};
+
+/* write renderMetrics() to path, replacing it atomically so a scraper never sees half a file */
+bool writeMetricsFile(const std::string &path);
+
+#endif
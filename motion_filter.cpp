@@ -0,0 +1,90 @@
+#include "motion_filter.hpp"
+
+#include <algorithm>
+
+using namespace cv;
+
+//state: cx, cy, w, h and their velocities; measurement: cx, cy, w, h
+const int stateSize = 8;
+const int measSize = 4;
+//face size changes much more slowly than the face moves
+const double sizeNoiseRatio = 0.25;
+
+FaceMotionFilter::FaceMotionFilter(double processNoise, double measurementNoise, double maxCoast)
+  : kf(stateSize, measSize, 0, CV_32F), processNoise(processNoise),
+    measurementNoise(measurementNoise), maxCoast(maxCoast), lastTime(0), hasState(false) {
+  kf.measurementMatrix = Mat::zeros(measSize, stateSize, CV_32F);
+  for (int i = 0; i < measSize; i++) {
+    kf.measurementMatrix.at<float>(i, i) = 1;
+  }
+  setIdentity(kf.measurementNoiseCov, Scalar(measurementNoise));
+}
+
+bool FaceMotionFilter::initialized() const {
+  return hasState;
+}
+
+/**
+start over from a single observation with zero velocity, e.g. after a click
+*/
+void FaceMotionFilter::reset(const Rect &face, double t) {
+  kf.statePost = Mat::zeros(stateSize, 1, CV_32F);
+  kf.statePost.at<float>(0) = face.x + face.width/2.0f;
+  kf.statePost.at<float>(1) = face.y + face.height/2.0f;
+  kf.statePost.at<float>(2) = face.width;
+  kf.statePost.at<float>(3) = face.height;
+  kf.errorCovPost = Mat::zeros(stateSize, stateSize, CV_32F);
+  for (int i = 0; i < measSize; i++) {
+    kf.errorCovPost.at<float>(i, i) = measurementNoise;
+    kf.errorCovPost.at<float>(i + measSize, i + measSize) = 1e4f; //velocity unknown
+  }
+  lastTime = t;
+  hasState = true;
+}
+
+void FaceMotionFilter::correct(const Rect &face, double t) {
+  if (!hasState) {
+    reset(face, t);
+    return;
+  }
+  setDynamics(std::max(t - lastTime, 1e-3));
+  kf.predict();
+  //Matx on the stack, wrapped without a copy
+  Matx41f measurement(face.x + face.width/2.0f, face.y + face.height/2.0f,
+                      face.width, face.height);
+  kf.correct(Mat(measurement, false));
+  lastTime = t;
+}
+
+/**
+face box extrapolated to time t along the estimated velocity
+*/
+Rect2d FaceMotionFilter::predict(double t) const {
+  if (!hasState) {
+    return Rect2d(0, 0, 0, 0);
+  }
+  double dt = std::min(std::max(t - lastTime, 0.0), maxCoast);
+  const Mat &x = kf.statePost;
+  double cx = x.at<float>(0) + x.at<float>(4) * dt;
+  double cy = x.at<float>(1) + x.at<float>(5) * dt;
+  double w = std::max(0.0, x.at<float>(2) + x.at<float>(6) * dt);
+  double h = std::max(0.0, x.at<float>(3) + x.at<float>(7) * dt);
+  return Rect2d(cx - w/2, cy - h/2, w, h);
+}
+
+/**
+transition and process noise of a constant-velocity model over dt seconds
+*/
+void FaceMotionFilter::setDynamics(double dt) {
+  kf.transitionMatrix = Mat::eye(stateSize, stateSize, CV_32F);
+  kf.processNoiseCov = Mat::zeros(stateSize, stateSize, CV_32F);
+  for (int i = 0; i < measSize; i++) {
+    double q = i < 2 ? processNoise : processNoise * sizeNoiseRatio;
+    int v = i + measSize;
+    kf.transitionMatrix.at<float>(i, v) = dt;
+    kf.processNoiseCov.at<float>(i, i) = q * dt*dt*dt / 3;
+    kf.processNoiseCov.at<float>(i, v) = q * dt*dt / 2;
+    kf.processNoiseCov.at<float>(v, i) = q * dt*dt / 2;
+    kf.processNoiseCov.at<float>(v, v) = q * dt;
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef MOTION_FILTER_HPP
+#define MOTION_FILTER_HPP
+
+#include <opencv2/opencv.hpp>
+
+/**
+Constant-velocity Kalman filter on face center and size.
+correct() folds in a detection taken at time t (seconds); predict() extrapolates
+the last estimate to any later time without changing the filter, so the
+actuator can be fed at camera rate while detections arrive more slowly.
+Extrapolation stops after maxCoast seconds without a detection, after which
+the estimate holds still like the unfiltered tracker did.
+*/
+class FaceMotionFilter {
+public:
+  /*
+  processNoise: white acceleration noise of the center, (pixels/s^2)^2 per Hz
+  measurementNoise: detection jitter, pixels^2
+  */
+  FaceMotionFilter(double processNoise = 5000.0, double measurementNoise = 16.0,
+                   double maxCoast = 0.5);
+
+  void reset(const cv::Rect &face, double t);
+  void correct(const cv::Rect &face, double t);
+  cv::Rect2d predict(double t) const;
+  bool initialized() const;
+
+private:
+  void setDynamics(double dt);
+
+  cv::KalmanFilter kf;
+  double processNoise, measurementNoise, maxCoast;
+  double lastTime;
+  bool hasState;
+};
+
+#endif
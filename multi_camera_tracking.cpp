@@ -0,0 +1,120 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "cascade_cache.hpp"
+#include "metrics_server.hpp"
+#include "tracking_session.hpp"
+
+using namespace std;
+using namespace cv;
+
+const int statsInterval = 5;        // seconds between latency summaries
+
+/**
+Tracks several cameras in one process.
+Every session gets its own capture and serial threads, while detection for
+all of them goes through one scheduler and one shared detector pool, so the
+classifiers are loaded once and the CPU spent on detection is bounded by the
+pool size no matter how many cameras are attached.
+
+usage: multiCameraTracking sessions.yml
+*/
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    cout << "usage: multiCameraTracking sessions.yml" << endl;
+    return -1;
+  }
+  FileStorage fs(argv[1], FileStorage::READ);
+  if (!fs.isOpened()) {
+    cout << "error opening session list " << argv[1] << endl;
+    return -1;
+  }
+
+  int workers, metricsPort, logFrames;
+  String cascadePath, metricsFile;
+  read(fs["workers"], workers, 0);
+  read(fs["metricsPort"], metricsPort, 0);
+  read(fs["metricsFile"], metricsFile, "");
+  read(fs["logFrames"], logFrames, 0);
+  read(fs["cascade"], cascadePath, classifierPath("haarcascade_frontalface_alt.xml"));
+  TiledDetector detector(workers, 4, 2, 3);
+  if (!detector.load(cascadePath)) {
+    cout << "error loading face classifier" << endl;
+    return -1;
+  }
+  setNumThreads(1); //the detector pool already keeps every core busy
+
+  FaceVerifier verifier(detector.threadPool()); //loaded once a session asks for it
+
+  vector<unique_ptr<TrackingSession> > owned;
+  vector<TrackingSession *> sessions;
+  FileNode list = fs["sessions"];
+  for (FileNodeIterator it = list.begin(); it != list.end(); ++it) {
+    SessionConfig config;
+    config.logFrames = logFrames != 0;
+    if (!readSessionConfig(*it, config)) {
+      return -1;
+    }
+    if (config.tracker.verifyFaces && verifier.empty() && !verifier.load()) {
+      cout << "error loading feature classifiers" << endl;
+      return -1;
+    }
+    if (config.tracker.multiPose && !detector.hasProfile() &&
+        !detector.loadProfile(classifierPath("haarcascade_profileface.xml"))) {
+      cout << "error loading profile classifier" << endl;
+      return -1;
+    }
+    owned.push_back(unique_ptr<TrackingSession>(new TrackingSession(config, detector, &verifier)));
+    if (!owned.back()->open()) {
+      return -1;
+    }
+    sessions.push_back(owned.back().get());
+  }
+  if (sessions.empty()) {
+    cout << "no sessions in " << argv[1] << endl;
+    return -1;
+  }
+  printf("tracking %lu cameras on %d detection workers\n", sessions.size(), detector.threadPool().size());
+
+  MetricsServer metrics;
+  if (metricsPort > 0 && metrics.start(metricsPort)) {
+    printf("metrics on http://127.0.0.1:%d/metrics\n", metrics.port());
+  }
+
+  atomic<bool> running(true);
+  for (size_t i = 0; i < sessions.size(); i++) {
+    sessions[i]->start();
+  }
+  thread detectThread(runDetectionScheduler, std::cref(sessions), std::cref(running));
+
+  int64_t lastReport = nowNs();
+  while (running) {
+    this_thread::sleep_for(chrono::milliseconds(100));
+    bool anyRunning = false;
+    for (size_t i = 0; i < sessions.size(); i++) {
+      anyRunning = anyRunning || sessions[i]->isRunning();
+    }
+    running = anyRunning;
+
+    if (nowNs() - lastReport > statsInterval * 1000000000LL) {
+      for (size_t i = 0; i < sessions.size(); i++) {
+        sessions[i]->reportStats();
+      }
+      if (!metricsFile.empty() && !writeMetricsFile(metricsFile)) {
+        cout << "error writing " << metricsFile << endl;
+      }
+      lastReport = nowNs();
+    }
+  }
+
+  detectThread.join();
+  for (size_t i = 0; i < sessions.size(); i++) {
+    sessions[i]->stop();
+  }
+  return 0;
+}
@@ -0,0 +1,253 @@
+#include "preview_renderer.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+const int previewNice = 10;           // render thread priority below the tracking threads
+const size_t previewCopies = 3;       // the snapshot queued, the one rendering, and one to write
+const int requestTimeoutMs = 100;     // a stream client gets this long to send its request
+const int sendTimeoutMs = 200;        // a client that can't take a frame this fast is dropped
+const char *boundary = "previewframe";
+
+PreviewParams::PreviewParams()
+  : fps(10.0), size(960, 540), mjpegPort(0), quality(80), onMouse(NULL), mouseData(NULL) {
+}
+
+PreviewRenderer::PreviewRenderer(const PreviewParams &params, const string &name)
+  : params(params), snapshots(1), copies(previewCopies), nextRenderNs(0), running(false), key(-1),
+    renders(0), renderStats(name, "preview"), windowOpen(false), mjpegFile(NULL), listenFd(-1),
+    boundPort(0) {
+}
+
+PreviewRenderer::~PreviewRenderer() {
+  stop();
+}
+
+bool PreviewRenderer::enabled() const {
+  return !params.window.empty() || !params.mjpegPath.empty() || params.mjpegPort != 0;
+}
+
+bool PreviewRenderer::start() {
+  stop();
+  if (!params.mjpegPath.empty() && !(mjpegFile = fopen(params.mjpegPath.c_str(), "wb"))) {
+    fprintf(stderr, "preview: could not open %s: %s\n", params.mjpegPath.c_str(), strerror(errno));
+    return false;
+  }
+  if (params.mjpegPort != 0) {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); //local viewers only
+    addr.sin_port = htons(max(params.mjpegPort, 0));
+    socklen_t len = sizeof(addr);
+    if (listenFd < 0 || bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 4) != 0 ||
+        getsockname(listenFd, (sockaddr *)&addr, &len) != 0) {
+      fprintf(stderr, "preview: could not listen on port %d: %s\n", params.mjpegPort, strerror(errno));
+      stop();
+      return false;
+    }
+    boundPort = ntohs(addr.sin_port);
+  }
+  nextRenderNs = 0;
+  running = true;
+  renderThread = thread(&PreviewRenderer::renderLoop, this);
+  return true;
+}
+
+void PreviewRenderer::stop() {
+  running = false;
+  if (renderThread.joinable()) {
+    renderThread.join();
+  }
+  for (size_t i = 0; i < clients.size(); i++) {
+    close(clients[i]);
+  }
+  clients.clear();
+  if (listenFd >= 0) {
+    close(listenFd);
+    listenFd = -1;
+  }
+  if (mjpegFile) {
+    fclose(mjpegFile);
+    mjpegFile = NULL;
+  }
+}
+
+bool PreviewRenderer::publish(const TrackResult &result) {
+  int64_t now = nowNs();
+  if (!running || now < nextRenderNs || result.frame.empty()) {
+    return false;
+  }
+  nextRenderNs = now + (params.fps > 0 ? (int64_t)(1e9 / params.fps) : 0);
+  TrackResult snapshot = result;
+  Mat &copy = copies.next();
+  result.frame.copyTo(copy);
+  snapshot.frame = copy;
+  if (!snapshots.push(snapshot)) {
+    renderStats.drop(); //the render thread fell behind
+  }
+  return true;
+}
+
+int PreviewRenderer::takeKey() {
+  return key.exchange(-1);
+}
+
+int PreviewRenderer::port() const {
+  return boundPort;
+}
+
+unsigned long PreviewRenderer::rendered() const {
+  return renders.load();
+}
+
+void PreviewRenderer::drawFaces(Mat &canvas, const TrackResult &result, double scaleX, double scaleY) {
+  for (size_t i = 1; i < result.faces.size(); i++) {
+    const Rect &f = result.faces[i];
+    bool profile = i < result.poses.size() && result.poses[i] != POSE_FRONTAL;
+    Point center(cvRound((f.x + f.width / 2.0) * scaleX), cvRound((f.y + f.height / 2.0) * scaleY));
+    ellipse(canvas, center, Size(cvRound(f.width * scaleX / 2), cvRound(f.height * scaleY / 2)),
+            0, 0, 360, profile ? Scalar(0, 255, 255) : Scalar(255, 255, 255), 2, LINE_8);
+  }
+  const Rect &face = result.face;
+  if (face.width > 0) {
+    Point center(cvRound((face.x + face.width / 2.0) * scaleX), cvRound((face.y + face.height / 2.0) * scaleY));
+    ellipse(canvas, center, Size(cvRound(face.width * scaleX / 2), cvRound(face.height * scaleY / 2)),
+            0, 0, 360, Scalar(255, 0, 255), 4, LINE_8);
+  }
+}
+
+void PreviewRenderer::renderLoop() {
+#ifdef __linux__
+  setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), previewNice); //nice is per thread on Linux
+#endif
+  TrackResult result;
+  while (snapshots.waitPop(result, running, true)) {
+    int64_t start = nowNs();
+    render(result);
+    result = TrackResult(); //give the frame copy back to the pool
+    renderStats.record(nowNs() - start);
+    renders++;
+  }
+  if (windowOpen) {
+    destroyWindow(params.window);
+    windowOpen = false;
+  }
+}
+
+/* the preview of one snapshot, sent to every output */
+void PreviewRenderer::render(const TrackResult &result) {
+  const Mat &frame = result.frame;
+  Size size = params.size.area() > 0 ? params.size : frame.size();
+  Mat preview = reuseBuffer(canvas, size, CV_8UC3);
+  if (size == frame.size()) {
+    frame.copyTo(preview);
+  } else {
+    cv::resize(frame, preview, size, 0, 0, size.width < frame.cols ? INTER_AREA : INTER_LINEAR);
+  }
+  //the preview may not keep the frame's aspect ratio
+  drawFaces(preview, result, (double)size.width / frame.cols, (double)size.height / frame.rows);
+  if (!params.caption.empty()) {
+    putText(preview, params.caption, Point(30, 30), FONT_HERSHEY_PLAIN, 1.0, Scalar(0, 0, 0));
+  }
+
+  if (!params.window.empty()) {
+    if (!windowOpen) { //the window belongs to the thread pumping its events
+      namedWindow(params.window, WINDOW_AUTOSIZE);
+      if (params.onMouse) {
+        setMouseCallback(params.window, params.onMouse, params.mouseData);
+      }
+      windowOpen = true;
+    }
+    imshow(params.window, preview);
+    int pressed = waitKey(1);
+    if (pressed >= 0) {
+      key = pressed;
+    }
+  }
+  if (mjpegFile || listenFd >= 0) {
+    vector<int> options(1, IMWRITE_JPEG_QUALITY);
+    options.push_back(params.quality);
+    imencode(".jpg", preview, jpeg, options);
+    if (mjpegFile) {
+      fwrite(jpeg.data(), 1, jpeg.size(), mjpegFile);
+      fflush(mjpegFile);
+    }
+    if (listenFd >= 0) {
+      acceptClients();
+      stream(jpeg);
+    }
+  }
+}
+
+static bool sendAll(int fd, const void *data, size_t size) {
+  const char *bytes = (const char *)data;
+  for (size_t sent = 0; sent < size; ) {
+    ssize_t n = send(fd, bytes + sent, size - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+/* take the viewers waiting on the listening socket and start their streams */
+void PreviewRenderer::acceptClients() {
+  pollfd listening = {listenFd, POLLIN, 0};
+  while (poll(&listening, 1, 0) > 0) {
+    int client = accept(listenFd, NULL, NULL);
+    if (client < 0) {
+      return;
+    }
+    // read the request head and ignore it
+    char request[1024];
+    pollfd incoming = {client, POLLIN, 0};
+    if (poll(&incoming, 1, requestTimeoutMs) > 0) {
+      recv(client, request, sizeof(request), 0);
+    }
+    timeval timeout = {0, sendTimeoutMs * 1000};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    char head[192];
+    snprintf(head, sizeof(head),
+             "HTTP/1.0 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=%s\r\n"
+             "Cache-Control: no-cache\r\nConnection: close\r\n\r\n", boundary);
+    if (sendAll(client, head, strlen(head))) {
+      clients.push_back(client);
+    } else {
+      close(client);
+    }
+  }
+}
+
+void PreviewRenderer::stream(const vector<uchar> &encoded) {
+  char head[128];
+  snprintf(head, sizeof(head), "--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n",
+           boundary, encoded.size());
+  size_t kept = 0;
+  for (size_t i = 0; i < clients.size(); i++) {
+    if (sendAll(clients[i], head, strlen(head)) && sendAll(clients[i], encoded.data(), encoded.size()) &&
+        sendAll(clients[i], "\r\n", 2)) {
+      clients[kept++] = clients[i];
+    } else {
+      close(clients[i]); //gone, or too slow to keep up
+    }
+  }
+  clients.resize(kept);
+}
@@ -0,0 +1,92 @@
+#ifndef PREVIEW_RENDERER_HPP
+#define PREVIEW_RENDERER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ring_buffer.hpp"
+#include "frame_context.hpp"
+#include "stage_stats.hpp"
+#include "tracking_session.hpp"
+
+struct PreviewParams {
+  PreviewParams();
+
+  double fps;               // previews rendered per second, at most
+  cv::Size size;            // preview size, empty for the frame's own
+  std::string window;       // HighGUI window to show previews in, "" for none
+  std::string mjpegPath;    // file to append the previews to as JPEG frames, "" for none
+  int mjpegPort;            // multipart MJPEG over HTTP on 127.0.0.1, 0 for none, -1 for any free port
+  int quality;              // JPEG quality of the file and the stream
+  std::string caption;      // text drawn in the top left corner, "" for none
+  cv::MouseCallback onMouse; // window mouse events, in preview pixels; NULL for none
+  void *mouseData;          // passed to onMouse
+};
+
+/**
+Draws the tracker's faces over its frames and shows or streams the result
+from a thread of its own, at low priority, so the tracking loop never waits
+for a redraw. publish() returns right away while no preview is due: only one
+snapshot every 1/fps seconds is copied and handed over, and a snapshot the
+render thread has not picked up yet is replaced by the next one.
+Previews go to a HighGUI window and, for headless machines, as JPEG frames
+to a file (a raw MJPEG stream, e.g. for ffplay -f mjpeg) and to HTTP clients
+as a multipart MJPEG stream that browsers play directly.
+*/
+class PreviewRenderer {
+public:
+  explicit PreviewRenderer(const PreviewParams &params = PreviewParams(),
+                           const std::string &name = "preview");
+  ~PreviewRenderer();
+
+  /* open the outputs and start rendering, printing what failed */
+  bool start();
+  void stop();
+  /* true if params name any output */
+  bool enabled() const;
+
+  /* hand result over if a preview is due; its frame is copied, so the caller may overwrite it */
+  bool publish(const TrackResult &result);
+  /* the last key pressed in the window, -1 if none since the previous call */
+  int takeKey();
+  int port() const;
+  unsigned long rendered() const;
+
+  /*
+  result's faces on canvas, scaled from the frame by scaleX and scaleY: the
+  selected face pink, others white, profiles yellow
+  */
+  static void drawFaces(cv::Mat &canvas, const TrackResult &result, double scaleX, double scaleY);
+
+private:
+  PreviewRenderer(const PreviewRenderer &);
+  PreviewRenderer &operator=(const PreviewRenderer &);
+
+  void renderLoop();
+  void render(const TrackResult &result);
+  void acceptClients();
+  void stream(const std::vector<uchar> &encoded);
+
+  PreviewParams params;
+  RingBuffer<TrackResult> snapshots;
+  FramePool copies;             // publisher only
+  int64_t nextRenderNs;         // publisher only
+  std::atomic<bool> running;
+  std::atomic<int> key;
+  std::atomic<unsigned long> renders;
+  std::thread renderThread;
+  StageStats renderStats;
+
+  /* render thread only */
+  cv::Mat canvas;
+  std::vector<uchar> jpeg;
+  bool windowOpen;
+  FILE *mjpegFile;
+  int listenFd, boundPort;
+  std::vector<int> clients;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "cascade_cache.hpp"
+#include "tracking_session.hpp"
+
+using namespace std;
+using namespace cv;
+
+/* Function Headers */
+string trackLine(const TrackResult &result);
+
+/**
+Replays a session recording (see session_recording.hpp) through a fresh
+tracker, either as fast as possible or at the pace it was recorded, and
+writes one track line per frame. Replays are deterministic: the recording
+carries the UI commands and the detection controller state of every frame, so the
+same recording always produces the same track log, whatever the machine.
+Only recordings with raw frames (recordQuality 0, the default) replay what
+the live session decided; JPEG frames differ slightly from what it saw.
+With -g, the log is compared against a golden log and the first differing
+frames are printed; the exit code is 1 if any differ.
+Per-frame latency is summarized on stderr either way.
+
+usage: replayTracking [-p] [-w workers] [-s first-frame] [-n frames]
+                      [-o track.log] [-g golden.log] recording.ftr
+*/
+int main(int argc, char **argv) {
+  bool paced = false;
+  int workers = 0;
+  size_t first = 0, count = 0;
+  const char *outputPath = NULL, *goldenPath = NULL, *recordingPath = NULL;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "-p") {
+      paced = true;
+    } else if (arg == "-w" && hasValue) {
+      workers = atoi(argv[++i]);
+    } else if (arg == "-s" && hasValue) {
+      first = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "-n" && hasValue) {
+      count = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "-o" && hasValue) {
+      outputPath = argv[++i];
+    } else if (arg == "-g" && hasValue) {
+      goldenPath = argv[++i];
+    } else {
+      recordingPath = argv[i];
+    }
+  }
+  if (!recordingPath) {
+    cout << "usage: replayTracking [-p] [-w workers] [-s first-frame] [-n frames]" << endl
+         << "                      [-o track.log] [-g golden.log] recording.ftr" << endl;
+    return -1;
+  }
+
+  SessionRecording recording;
+  if (!recording.open(recordingPath)) {
+    return -1;
+  }
+  SessionConfig config;
+  FileStorage fs(recording.config(), FileStorage::READ | FileStorage::MEMORY | FileStorage::FORMAT_YAML);
+  if (!fs.isOpened() || !readSessionConfig(fs["session"], config)) {
+    cout << "bad session config in " << recordingPath << endl;
+    return -1;
+  }
+  config.port = "";
+  config.recordPath = "";
+
+  TiledDetector detector(workers, 4, 2, 3);
+  if (!detector.load(classifierPath("haarcascade_frontalface_alt.xml"))) {
+    cout << "error loading face classifier" << endl;
+    return -1;
+  }
+  if (config.tracker.multiPose && !detector.loadProfile(classifierPath("haarcascade_profileface.xml"))) {
+    cout << "error loading profile classifier" << endl;
+    return -1;
+  }
+  FaceVerifier verifier(detector.threadPool());
+  if (config.tracker.verifyFaces && !verifier.load()) {
+    cout << "error loading feature classifiers" << endl;
+    return -1;
+  }
+  setNumThreads(1); //the detector pool already keeps every core busy
+
+  vector<string> golden;
+  if (goldenPath) {
+    ifstream in(goldenPath);
+    if (!in) {
+      cout << "error opening " << goldenPath << endl;
+      return -1;
+    }
+    for (string line; getline(in, line); ) {
+      golden.push_back(line);
+    }
+  }
+  FILE *output = NULL;
+  if (outputPath && !(output = fopen(outputPath, "w"))) {
+    cout << "error opening " << outputPath << endl;
+    return -1;
+  }
+
+  TrackingSession session(config, detector, &verifier);
+  size_t last = count > 0 ? min(recording.frameCount(), first + count) : recording.frameCount();
+  RecordedFrame recorded;
+  TrackResult result;
+  vector<int64_t> latency;
+  size_t mismatches = 0;
+  int64_t start = nowNs(), firstCaptureNs = 0;
+  for (size_t i = first; i < last; i++) {
+    if (!recording.read(i, recorded)) {
+      cout << "frame " << i << " of " << recordingPath << " is damaged" << endl;
+      break;
+    }
+    if (i == first) {
+      firstCaptureNs = recorded.captureNs;
+    }
+    if (paced) {
+      this_thread::sleep_until(chrono::steady_clock::now() +
+                               chrono::nanoseconds(recorded.captureNs - firstCaptureNs - (nowNs() - start)));
+    }
+    for (size_t c = 0; c < recorded.clicks.size(); c++) {
+      SessionCommand cmd = {recorded.clicks[c].event, recorded.clicks[c].x, recorded.clicks[c].y};
+      session.command(cmd);
+    }
+    session.setDetectionPressure(recorded.pressure);
+    int64_t t0 = nowNs();
+    session.process(recorded.frame, recorded.captureNs, recorded.seq, result);
+    latency.push_back(nowNs() - t0);
+
+    string line = trackLine(result);
+    if (output) {
+      fprintf(output, "%s\n", line.c_str());
+    }
+    if (goldenPath) {
+      size_t g = i - first;
+      const string expected = g < golden.size() ? golden[g] : "(missing)";
+      if (line != expected && mismatches++ < 10) {
+        fprintf(stderr, "frame %lu differs\n  golden: %s\n  replay: %s\n",
+                (unsigned long)i, expected.c_str(), line.c_str());
+      }
+    }
+  }
+  double seconds = (nowNs() - start) / 1e9;
+  if (output) {
+    fclose(output);
+  }
+
+  sort(latency.begin(), latency.end());
+  if (!latency.empty()) {
+    fprintf(stderr, "%lu frames in %.2f s, %.1f fps, process p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            latency.size(), seconds, latency.size() / max(seconds, 1e-9),
+            latency[latency.size() / 2] / 1e6,
+            latency[min(latency.size() - 1, (size_t)(0.99 * latency.size()))] / 1e6,
+            latency.back() / 1e6);
+  }
+  if (goldenPath) {
+    if (golden.size() != latency.size()) {
+      fprintf(stderr, "golden log has %lu frames, replay %lu\n", golden.size(), latency.size());
+      mismatches++;
+    }
+    fprintf(stderr, "%s\n", mismatches ? "replay differs from the golden log" : "replay matches the golden log");
+  }
+  return mismatches ? 1 : 0;
+}
+
+/**
+one line per frame:
+seq tracking target-id face(x y w h) pan tilt face-count
+*/
+string trackLine(const TrackResult &result) {
+  char line[160];
+  snprintf(line, sizeof(line), "%lu %d %d %d %d %d %d %.3f %.3f %lu",
+           result.seq, (int)result.tracking, result.targetId,
+           result.face.x, result.face.y, result.face.width, result.face.height,
+           result.angled, result.tiltd, (unsigned long)result.faces.size());
+  return line;
+}
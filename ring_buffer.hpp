@@ -0,0 +1,139 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+/**
+Bounded ring buffer connecting two pipeline stages (one producer, one consumer)
+with "drop oldest" semantics: push() never blocks, and when the buffer is full
+the oldest queued element is evicted to make room for the new one.
+
+Every slot carries a sequence number (Vyukov style), so the producer can evict
+the oldest element with the same claim protocol the consumer uses, and a slot
+is never overwritten while the consumer is still copying out of it.
+*/
+template <typename T>
+class RingBuffer {
+public:
+  explicit RingBuffer(size_t capacity)
+    : capacity(capacity < 1 ? 1 : capacity),
+      slots(new Slot[capacity < 1 ? 1 : capacity]),
+      head(0), tail(0), dropped(0) {
+    for (size_t i = 0; i < this->capacity; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+  add value to the buffer, evicting the oldest element if it is full
+  returns false if an element had to be dropped
+  */
+  bool push(const T &value) {
+    bool evicted = false;
+    for (;;) {
+      size_t pos = head.load(std::memory_order_relaxed);
+      Slot &slot = slots[pos % capacity];
+      if (slot.seq.load(std::memory_order_acquire) == pos) {
+        slot.value = value;
+        slot.seq.store(pos + 1, std::memory_order_release);
+        head.store(pos + 1, std::memory_order_relaxed);
+        return !evicted;
+      }
+      if (tail.load(std::memory_order_acquire) + capacity > pos) {
+        //the consumer claimed this slot and is still copying out of it
+        std::this_thread::yield();
+        continue;
+      }
+      T oldest;
+      if (pop(oldest)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        evicted = true;
+      }
+    }
+  }
+
+  /**
+  take the oldest element out of the buffer
+  returns false if the buffer is empty
+  */
+  bool pop(T &out) {
+    for (;;) {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      Slot &slot = slots[pos % capacity];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq == pos + 1) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel)) {
+          out = slot.value;
+          slot.value = T(); //release the reference (e.g. a frame buffer) right away
+          slot.seq.store(pos + capacity, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < pos + 1) {
+        return false;
+      }
+    }
+  }
+
+  /**
+  take the newest element, discarding everything queued before it
+  stale elements count as dropped
+  */
+  bool popLatest(T &out) {
+    if (!pop(out)) {
+      return false;
+    }
+    while (pop(out)) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  /**
+  pop, waiting with a short back-off while the buffer is empty
+  returns false once running is cleared and nothing is left to pop
+  */
+  bool waitPop(T &out, const std::atomic<bool> &running, bool latest = false) {
+    int spins = 0;
+    while (!(latest ? popLatest(out) : pop(out))) {
+      if (!running.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      if (++spins < 64) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+    }
+    return true;
+  }
+
+  /* number of elements dropped so far, either evicted by push or skipped by popLatest */
+  unsigned long dropCount() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  RingBuffer(const RingBuffer &);
+  RingBuffer &operator=(const RingBuffer &);
+
+  const size_t capacity;
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+  std::atomic<unsigned long> dropped;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "scene_cache.hpp"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+SceneCacheParams::SceneCacheParams()
+  : enabled(false), blockSize(16), maxChange(3), maxAge(30) {
+}
+
+SceneCache::SceneCache(const SceneCacheParams &params)
+  : params(params), valid(false), age(0), change(-1) {
+  this->params.blockSize = max(1, params.blockSize);
+}
+
+bool SceneCache::enabled() const {
+  return params.enabled;
+}
+
+bool SceneCache::matches(const Mat &frame) {
+  if (!enabled() || frame.empty()) {
+    return false;
+  }
+  int side = params.blockSize;
+  Size grid(max(1, frame.cols / side), max(1, frame.rows / side));
+  cv::resize(frame, blocks, grid, 0, 0, INTER_AREA);
+  if (blocks.channels() == 3) {
+    cvtColor(blocks, signature, COLOR_BGR2GRAY);
+  } else {
+    blocks.copyTo(signature);
+  }
+  if (!valid || reference.size() != signature.size()) {
+    change = -1;
+    return false;
+  }
+  absdiff(signature, reference, diff);
+  double maxDiff;
+  minMaxLoc(diff, NULL, &maxDiff);
+  change = (int)maxDiff;
+  if (change > params.maxChange || (params.maxAge > 0 && age >= params.maxAge)) {
+    return false;
+  }
+  age++;
+  return true;
+}
+
+void SceneCache::store() {
+  if (!enabled() || signature.empty()) {
+    return;
+  }
+  signature.copyTo(reference);
+  valid = true;
+  age = 0;
+}
+
+void SceneCache::invalidate() {
+  valid = false;
+}
+
+int SceneCache::lastChange() const {
+  return change;
+}
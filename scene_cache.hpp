@@ -0,0 +1,50 @@
+#ifndef SCENE_CACHE_HPP
+#define SCENE_CACHE_HPP
+
+#include <opencv2/opencv.hpp>
+
+struct SceneCacheParams {
+  SceneCacheParams();
+
+  bool enabled;
+  int blockSize;          // frame pixels per signature block side
+  int maxChange;          // mean gray level change of the most changed block still counted as the same scene
+  int maxAge;             // frames a detection result is reused for at most, 0 for no limit
+};
+
+/**
+Tells whether a frame shows the same scene as the frame the last detection
+ran on, so a static camera watching a still subject can reuse that result
+instead of searching again.
+The signature of a frame is its luma averaged over blocks of blockSize x
+blockSize pixels, a few hundred bytes computed with one INTER_AREA shrink.
+A frame matches when no block's mean moved by more than maxChange gray levels
+since the reference, the signature of the last detected frame; comparing
+against that frame rather than the previous one lets slow drift add up to a
+change. After maxAge reused frames the scene counts as changed regardless.
+Checking costs a small fraction of a cascade pass, and a changed frame goes
+straight on to detection, so motion is picked up on the frame it shows.
+*/
+class SceneCache {
+public:
+  explicit SceneCache(const SceneCacheParams &params = SceneCacheParams());
+
+  bool enabled() const;
+  /* compute frame's signature; true if it matches the reference and the cached result may be reused */
+  bool matches(const cv::Mat &frame);
+  /* make the signature of the last frame checked the reference, the frame the cached result is from */
+  void store();
+  /* the next frame is detected on whatever it shows */
+  void invalidate();
+  /* largest block change of the last frame checked, in gray levels; -1 without a reference */
+  int lastChange() const;
+
+private:
+  SceneCacheParams params;
+  cv::Mat blocks, signature, reference, diff;
+  bool valid;
+  int age;
+  int change;
+};
+
+#endif
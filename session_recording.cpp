@@ -0,0 +1,230 @@
+#include "session_recording.hpp"
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+const char recordingMagic[8] = {'F', 'T', 'R', 'E', 'C', 0, 0, 0};
+const char indexMagic[8] = {'F', 'T', 'R', 'E', 'C', 'I', 'D', 'X'};
+const uint32_t recordingVersion = 1;
+const uint32_t chunkMagic = 0x4b435446;   // "FTCK"
+const size_t recordCopies = 8;            // frames queued or being encoded before the pool allocates
+
+SessionRecorder::SessionRecorder()
+  : file(NULL), quality(0), copies(recordCopies), closing(false) {
+}
+
+SessionRecorder::~SessionRecorder() {
+  close();
+}
+
+bool SessionRecorder::open(const string &path, const string &config, int quality) {
+  close();
+  file = fopen(path.c_str(), "wb");
+  if (!file) {
+    cout << "could not create recording " << path << endl;
+    return false;
+  }
+  RecordingHeader header;
+  memcpy(header.magic, recordingMagic, sizeof(header.magic));
+  header.version = recordingVersion;
+  header.configSize = (uint32_t)config.size();
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(config.data(), 1, config.size(), file);
+  this->quality = quality;
+  index.clear();
+  closing = false;
+  writer = thread(&SessionRecorder::writerLoop, this);
+  return true;
+}
+
+bool SessionRecorder::isOpen() const {
+  return file != NULL;
+}
+
+void SessionRecorder::write(unsigned long seq, int64_t captureNs, double pressure,
+                            const vector<RecordedClick> &clicks, const Mat &frame) {
+  //a copy: the caller's frame goes on to the display stage, which may draw on it
+  //while the writer thread encodes
+  RecordedFrame recorded;
+  Mat &copy = copies.next();
+  frame.copyTo(copy);
+  recorded.frame = copy;
+  recorded.seq = seq;
+  recorded.captureNs = captureNs;
+  recorded.pressure = pressure;
+  recorded.clicks = clicks;
+  {
+    lock_guard<mutex> guard(lock);
+    if (!file || closing) { //not open, or a late frame while stopping
+      return;
+    }
+    queue.push_back(recorded);
+  }
+  wake.notify_one();
+}
+
+void SessionRecorder::close() {
+  if (!file) {
+    return;
+  }
+  {
+    lock_guard<mutex> guard(lock);
+    closing = true;
+  }
+  wake.notify_one();
+  writer.join();
+
+  RecordingTrailer trailer;
+  trailer.indexOffset = (uint64_t)ftell(file);
+  trailer.frameCount = index.size();
+  memcpy(trailer.magic, indexMagic, sizeof(trailer.magic));
+  fwrite(index.data(), sizeof(uint64_t), index.size(), file);
+  fwrite(&trailer, sizeof(trailer), 1, file);
+  fclose(file);
+  lock_guard<mutex> guard(lock);
+  file = NULL;
+}
+
+void SessionRecorder::writerLoop() {
+  for (;;) {
+    RecordedFrame next;
+    {
+      unique_lock<mutex> guard(lock);
+      wake.wait(guard, [this]{ return closing || !queue.empty(); });
+      if (queue.empty()) {
+        return; //closing and drained
+      }
+      next = queue.front();
+      queue.pop_front();
+    }
+    append(next);
+  }
+}
+
+void SessionRecorder::append(const RecordedFrame &recorded) {
+  const Mat &frame = recorded.frame;
+  FramePayload payload;
+  payload.codec = quality > 0 ? RECORD_JPEG : RECORD_RAW;
+  payload.rows = frame.rows;
+  payload.cols = frame.cols;
+  payload.type = frame.type();
+  payload.pressure = recorded.pressure;
+  payload.clickCount = (uint32_t)recorded.clicks.size();
+  payload.reserved = 0;
+
+  size_t imageSize;
+  if (payload.codec == RECORD_JPEG) {
+    vector<int> params(2);
+    params[0] = IMWRITE_JPEG_QUALITY;
+    params[1] = quality;
+    imencode(".jpg", frame, encoded, params);
+    imageSize = encoded.size();
+  } else {
+    imageSize = frame.total() * frame.elemSize();
+  }
+
+  ChunkHeader chunk;
+  chunk.magic = chunkMagic;
+  chunk.size = (uint32_t)(sizeof(payload) + 3 * sizeof(int32_t) * recorded.clicks.size() + imageSize);
+  chunk.seq = recorded.seq;
+  chunk.captureNs = recorded.captureNs;
+  index.push_back((uint64_t)ftell(file));
+  fwrite(&chunk, sizeof(chunk), 1, file);
+  fwrite(&payload, sizeof(payload), 1, file);
+  for (size_t i = 0; i < recorded.clicks.size(); i++) {
+    int32_t click[3] = {recorded.clicks[i].event, recorded.clicks[i].x, recorded.clicks[i].y};
+    fwrite(click, sizeof(click), 1, file);
+  }
+  if (payload.codec == RECORD_JPEG) {
+    fwrite(encoded.data(), 1, encoded.size(), file);
+  } else {
+    for (int y = 0; y < frame.rows; y++) { //frames may be views with padded rows
+      fwrite(frame.ptr(y), frame.elemSize(), frame.cols, file);
+    }
+  }
+}
+
+bool SessionRecording::open(const string &path) {
+  index.clear();
+  if (!file.open(path) || file.size() < sizeof(RecordingHeader)) {
+    cout << "could not open recording " << path << endl;
+    return false;
+  }
+  RecordingHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, recordingMagic, sizeof(header.magic)) != 0 ||
+      header.version != recordingVersion ||
+      sizeof(header) + header.configSize > file.size()) {
+    cout << path << " is not a recording" << endl;
+    return false;
+  }
+  configText.assign((const char *)file.data() + sizeof(header), header.configSize);
+  uint64_t firstChunk = sizeof(header) + header.configSize;
+
+  RecordingTrailer trailer;
+  if (file.size() >= firstChunk + sizeof(trailer)) {
+    memcpy(&trailer, file.data() + file.size() - sizeof(trailer), sizeof(trailer));
+    if (memcmp(trailer.magic, indexMagic, sizeof(trailer.magic)) == 0 &&
+        trailer.indexOffset + trailer.frameCount * sizeof(uint64_t) + sizeof(trailer) == file.size()) {
+      index.resize(trailer.frameCount);
+      memcpy(index.data(), file.data() + trailer.indexOffset, trailer.frameCount * sizeof(uint64_t));
+      return true;
+    }
+  }
+
+  //no index, the recorder didn't close: walk the complete chunks
+  uint64_t offset = firstChunk;
+  while (offset + sizeof(ChunkHeader) <= file.size()) {
+    ChunkHeader chunk;
+    memcpy(&chunk, file.data() + offset, sizeof(chunk));
+    if (chunk.magic != chunkMagic || offset + sizeof(chunk) + chunk.size > file.size()) {
+      break;
+    }
+    index.push_back(offset);
+    offset += sizeof(chunk) + chunk.size;
+  }
+  cout << path << " has no index, recovered " << index.size() << " frames" << endl;
+  return true;
+}
+
+const string &SessionRecording::config() const {
+  return configText;
+}
+
+size_t SessionRecording::frameCount() const {
+  return index.size();
+}
+
+bool SessionRecording::read(size_t i, RecordedFrame &out) const {
+  if (i >= index.size()) {
+    return false;
+  }
+  const uint8_t *p = file.data() + index[i];
+  ChunkHeader chunk;
+  FramePayload payload;
+  memcpy(&chunk, p, sizeof(chunk));
+  memcpy(&payload, p + sizeof(chunk), sizeof(payload));
+  p += sizeof(chunk) + sizeof(payload);
+  out.seq = chunk.seq;
+  out.captureNs = chunk.captureNs;
+  out.pressure = payload.pressure;
+  out.clicks.resize(payload.clickCount);
+  for (uint32_t c = 0; c < payload.clickCount; c++, p += 3 * sizeof(int32_t)) {
+    int32_t click[3];
+    memcpy(click, p, sizeof(click));
+    out.clicks[c].event = click[0];
+    out.clicks[c].x = click[1];
+    out.clicks[c].y = click[2];
+  }
+  size_t imageSize = chunk.size - sizeof(payload) - 3 * sizeof(int32_t) * payload.clickCount;
+  if (payload.codec == RECORD_JPEG) {
+    out.frame = imdecode(Mat(1, (int)imageSize, CV_8UC1, (void *)p), IMREAD_COLOR);
+  } else {
+    //copy out of the mapping, the session keeps frames around
+    Mat(payload.rows, payload.cols, payload.type, (void *)p).copyTo(out.frame);
+  }
+  return !out.frame.empty();
+}
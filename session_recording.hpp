@@ -0,0 +1,131 @@
+#ifndef SESSION_RECORDING_HPP
+#define SESSION_RECORDING_HPP
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cascade_cache.hpp"
+#include "frame_context.hpp"
+
+/**
+Recording of what a session's detection stage saw, for replaying it offline.
+A file is a header with the session config (as a session list entry), then
+one chunk per frame, then an index of the chunk offsets and a trailer:
+
+  RecordingHeader, config text
+  ChunkHeader, FramePayload, commands (int32 type, x, y each), image data
+  ...
+  uint64 offset of every frame chunk
+  RecordingTrailer
+
+Frames are the downscaled frames detection ran on, stored as JPEG or raw.
+Each frame carries the UI commands applied right before it (clicks, as
+SessionCommandType codes) and the detection
+controller's pressure, the only tracker state that depends on wall-clock
+time, so a replay of raw frames makes exactly the decisions the live session
+made. JPEG frames come back close to, not exactly as, what detection saw.
+The index makes frames seekable; a file cut short by a crash has no index,
+and is read by walking its chunks instead.
+*/
+struct RecordingHeader {
+  char magic[8];            // "FTREC\0\0\0"
+  uint32_t version;
+  uint32_t configSize;      // config text follows the header
+};
+
+struct ChunkHeader {
+  uint32_t magic;           // chunkMagic
+  uint32_t size;            // payload bytes after this header
+  uint64_t seq;
+  int64_t captureNs;
+};
+
+struct FramePayload {
+  int32_t codec;            // RecordCodec
+  int32_t rows, cols, type;
+  double pressure;
+  uint32_t clickCount;
+  uint32_t reserved;
+};
+
+struct RecordingTrailer {
+  uint64_t indexOffset;
+  uint64_t frameCount;
+  char magic[8];            // "FTRECIDX"
+};
+
+enum RecordCodec { RECORD_RAW = 0, RECORD_JPEG = 1 };
+
+struct RecordedClick {
+  int event, x, y;
+};
+
+struct RecordedFrame {
+  cv::Mat frame;
+  unsigned long seq;
+  int64_t captureNs;
+  double pressure;
+  std::vector<RecordedClick> clicks;
+};
+
+/**
+Writes a recording. write() only copies the frame into a recycled buffer
+and queues it; a writer thread encodes and appends it, so recording costs the
+detection stage a copy, not an encode. Nothing is dropped: if the disk can't keep up, the queue grows.
+*/
+class SessionRecorder {
+public:
+  SessionRecorder();
+  ~SessionRecorder();
+
+  /* quality: JPEG quality, 0 stores frames raw */
+  bool open(const std::string &path, const std::string &config, int quality);
+  bool isOpen() const;
+  /* may be called from another thread than open() and close(); ignored when not open */
+  void write(unsigned long seq, int64_t captureNs, double pressure,
+             const std::vector<RecordedClick> &clicks, const cv::Mat &frame);
+  /* write what is queued, the index and the trailer */
+  void close();
+
+private:
+  SessionRecorder(const SessionRecorder &);
+  SessionRecorder &operator=(const SessionRecorder &);
+
+  void writerLoop();
+  void append(const RecordedFrame &frame);
+
+  FILE *file;
+  int quality;
+  std::vector<uint64_t> index;
+  std::vector<uchar> encoded;
+  FramePool copies;           // caller of write() only
+  std::thread writer;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::deque<RecordedFrame> queue;
+  bool closing;
+};
+
+/* reads a recording through a shared read-only mapping */
+class SessionRecording {
+public:
+  bool open(const std::string &path);
+  /* the session config, as a session list entry under the key "session" */
+  const std::string &config() const;
+  size_t frameCount() const;
+  /* frame i, decoded into out.frame */
+  bool read(size_t i, RecordedFrame &out) const;
+
+private:
+  MappedFile file;
+  std::string configText;
+  std::vector<uint64_t> index;
+};
+
+#endif
@@ -6,31 +6,46 @@
 #include <cassert>
 #include <serial/serial.h>
 #include <string>
+#include <memory>
+#include "cascade_cache.hpp"
+#include "gray_equalize.hpp"
+#include "camera_model.hpp"
+#include "tiled_detector.hpp"
+#include "face_verifier.hpp"
+#include "preview_renderer.hpp"
 
 #define PI 3.14159
 #define DISPLAY 1
+#define PREVIEW_FPS 15 // previews per second, drawn off the tracking loop
+#define PREVIEW_MJPEG "" // file to append previews to as MJPEG, "" to disable
+#define PREVIEW_PORT 0 // MJPEG stream on http://127.0.0.1:PORT for headless use, 0 to disable
 #define TEST 0
+#define TILED_DETECTION 1
+#define VERIFY_FACES 0 // drop detections without eyes, nose or mouth
+#define LOG_FRAMES 0
 
 using namespace std;
 using namespace cv;
 
 /* Function Headers */
 void detectFace(Mat frame);
-bool compareBigger(Rect face1, Rect face2);
-bool compareDistance(Rect face1, Rect face2); 
+void runFaceCascade(const Mat &gray, vector<Rect> &found, int minNeighbors, Size minSize, Size maxSize = Size());
+static bool compareDistanceToPrior(Rect face1, Rect face2); //compareBigger comes from trackingCore
 void writeToMbed(double angled, serial::Serial &mbed);
 void test();
 void testSerial(); 
 
 /* global variables */
 Rect priorFace(0, 0, 0, 0);
-CascadeClassifier face_cascade, eyes_cascade;
+CascadeClassifier face_cascade;
+TiledDetector *tiledDetector = NULL; //created in main() if TILED_DETECTION or VERIFY_FACES is set
+FaceVerifier *verifier = NULL;        //created in main() if VERIFY_FACES is set
 String display_window = "Display";
-String face_window = "Face View";
 int frame_width = 0;
-/*camera calibration matrices */
-Matx33f K_logitech(1517.6023, 0, 0, 0, 1517.6023, 0, 959.5, 539.5, 1);
-Matx33f K_facetime(1006.2413, 0, 0, 0, 1006.2413, 0, 639.5, 359.5, 1); //ordered by cols
+/*camera calibrations, each given at the capture resolution it was made at */
+const CameraCalibration K_logitech = CameraCalibration::pinhole(1517.6023, 959.5, 539.5, Size(1920, 1080));
+const CameraCalibration K_facetime = CameraCalibration::pinhole(1006.2413, 639.5, 359.5, Size(1280, 720));
+AngleTable angleTable; //pan/tilt per pixel of the frames detected on
 
 /*angle look-up tables*/
 //const float angleThreshold[15] = {26, 22, 18, 14, 10, 6, 2, -2, -6, -10, -14, -18, -22, -26, -30}; 
@@ -43,19 +58,39 @@ int main() {
   }
 
   VideoCapture cap(0); // capture from default camera
+  //at the resolution the calibration was made at, if the camera has it
+  cap.set(CV_CAP_PROP_FRAME_WIDTH, K_logitech.imageSize.width);
+  cap.set(CV_CAP_PROP_FRAME_HEIGHT, K_logitech.imageSize.height);
   Mat frame;
-  Mat displayFrame;
+  TrackResult result;
   Point faceCenter(0, 0);  
-  double angle = 0;
   double angled = 0;
 
-  if (!(face_cascade.load("src/classifiers/haarcascade_frontalface_alt.xml"))) {
+  if (!face_cascade.load(classifierPath("haarcascade_frontalface_alt.xml"))) {
     cout << "error loading face classifier" << endl;
     return -1;
   }
-  if (!(eyes_cascade.load("src/classifiers/haarcascade_eye_tree_eyeglasses.xml"))) {
-    cout << "error loading eye classifier" << endl;
-    return -1;
+  //the pool starts one thread per core, so only build it when something runs on it
+  unique_ptr<TiledDetector> detector;
+  unique_ptr<FaceVerifier> featureVerifier;
+  if (TILED_DETECTION || VERIFY_FACES) {
+    detector.reset(new TiledDetector(0, 4, 2, 3)); //one worker per core, 4x2 tiles, 3 scale bands
+    tiledDetector = detector.get();
+  }
+  if (VERIFY_FACES) {
+    featureVerifier.reset(new FaceVerifier(tiledDetector->threadPool()));
+    verifier = featureVerifier.get();
+    if (!verifier->load()) {
+      cout << "error loading feature classifiers" << endl;
+      return -1;
+    }
+  }
+  if (TILED_DETECTION) {
+    if (!tiledDetector->load(classifierPath("haarcascade_frontalface_alt.xml"))) {
+      cout << "error loading tiled face classifier" << endl;
+      return -1;
+    }
+    setNumThreads(1); //the detector pool already keeps every core busy
   }
 
   unsigned long baud = 9600;
@@ -72,11 +107,18 @@ int main() {
     printf("mbed opened with baud rate:%u\n", mbed.getBaudrate());
   }
 */
-  if (DISPLAY) {
-    namedWindow(display_window,
-          CV_WINDOW_AUTOSIZE |
-          CV_WINDOW_KEEPRATIO |
-          CV_GUI_EXPANDED);
+  PreviewParams previewParams;
+  previewParams.fps = PREVIEW_FPS;
+  previewParams.size = Size(960, 720);
+  previewParams.window = DISPLAY ? display_window : "";
+  previewParams.mjpegPath = PREVIEW_MJPEG;
+  previewParams.mjpegPort = PREVIEW_PORT;
+  PreviewRenderer preview(previewParams);
+  if (preview.enabled() && !preview.start()) {
+    return -1;
+  }
+  if (PREVIEW_PORT) {
+    printf("preview on http://127.0.0.1:%d/\n", preview.port());
   }
   
   // Loop to capture frames
@@ -88,24 +130,29 @@ int main() {
     frame_width = frame.cols;
     faceCenter.x = priorFace.x + priorFace.width/2;
     faceCenter.y = priorFace.y + priorFace.height/2;
-    angle = atan2(faceCenter.x - K_logitech(1, 3), K_logitech(1, 1));
-    angled = angle * 180 / PI;
+    if (angleTable.size() != frame.size()) {
+      //the table scales the calibration to the frame per axis, which only holds at its aspect ratio
+      Size calibrated = K_logitech.imageSize;
+      if (fabs((double)frame.cols * calibrated.height / ((double)frame.rows * calibrated.width) - 1) > 0.01) {
+        printf("frames are %dx%d but the calibration is for %dx%d, angles would be off\n",
+               frame.cols, frame.rows, calibrated.width, calibrated.height);
+        return -1;
+      }
+      angleTable.build(K_logitech, frame.size(), 1.0);
+    }
+    angled = angleTable.angles(faceCenter.x, faceCenter.y).x;
  //   writeToMbed(angled, mbed);
 
     //printf("faceX: %d, faceY: %d, angle: %.2f\n", faceCenter.x, faceCenter.y, angled); 
 
-    if (DISPLAY) {
-      ellipse(frame, faceCenter, Size(priorFace.width/2, priorFace.height/2),
-          0, 0, 360, Scalar( 255, 0, 255 ), 4, 8, 0);
-      cv::resize(frame, displayFrame, cv::Size(960, 720));
-      
-      imshow(display_window, displayFrame);
-    }
-      
-    
-    if(waitKey(30) >= 0) // spacebar
+    //the preview thread draws and shows at its own pace; frame is copied if one is due
+    result.frame = frame;
+    result.face = priorFace;
+    preview.publish(result);
+    if (preview.takeKey() >= 0) // spacebar
       break;
   }
+  preview.stop();
   return 0;
 }
 
@@ -122,7 +169,9 @@ void writeToMbed(double angled, serial::Serial &mbed) {
     if ((angled < angleThreshold[i]) && (mbed.isOpen())) {
       std::string angleString = std::to_string(i) + std::string("\n");
       mbed.flushOutput(); //only write the most recent value
-      cout << angleString;
+      if (LOG_FRAMES) {
+        cout << angleString;
+      }
       mbed.write(angleString);
       return;
     }
@@ -132,20 +181,12 @@ void writeToMbed(double angled, serial::Serial &mbed) {
   mbed.write(angleString);
 }
 
-/**
-compare function
-return area(face1) > area(face2)
-*/
-
-bool compareBigger(Rect face1, Rect face2) { //biggest -> smallest
-  return face1.width * face1.height > face2.width * face2.height;
-}
 /**
 compare function
 return distance_from_priorFace(face1) < distance_from_priorFace((face2)
 */
 
-bool compareDistance(Rect face1, Rect face2) { //sort smallest -- biggest
+static bool compareDistanceToPrior(Rect face1, Rect face2) { //sort smallest -- biggest
   Point2d priorFaceCenter(priorFace.x + priorFace.width/2, priorFace.y + priorFace.height/2);
 
   double sq_x1 = pow(face1.x + face1.width/2 - priorFaceCenter.x, 2);
@@ -162,6 +203,20 @@ bool comparePeripheral(Rect face1, Rect face2) {
   return (abs((face1.x + face1.width/2) - frame_width/2) > abs((face2.x + face2.width/2) - frame_width/2));
 }
 
+/**
+run the face cascade on a grayscale image, spread over the tiled detector's
+worker pool when TILED_DETECTION is set
+*/
+void runFaceCascade(const Mat &gray, vector<Rect> &found, int minNeighbors, Size minSize, Size maxSize) {
+  if (TILED_DETECTION) {
+    tiledDetector->detectMultiScale(gray, found, 1.1, minNeighbors,
+				0|CASCADE_SCALE_IMAGE, minSize, maxSize);
+  } else {
+    face_cascade.detectMultiScale(gray, found, 1.1, minNeighbors,
+				0|CASCADE_SCALE_IMAGE, minSize, maxSize);
+  }
+}
+
 /** 
 Detect face and sets the global variable priorFace 
 If priorFace is uninitialized, set to biggest face.
@@ -174,13 +229,14 @@ void detectFace(Mat frame) {
   Mat frame_gray, frame_lab;
   int minNeighbors = 2;
 
-  cvtColor(frame, frame_gray, COLOR_BGR2GRAY);   // Convert to gray
-  equalizeHist(frame_gray, frame_gray);          // Equalize histogram
+  frame_gray.create(frame.size(), CV_8UC1);
+  equalizedGray(frame, frame_gray);   // Convert to gray, equalize histogram
   
   // Detect face with open source cascade
-  face_cascade.detectMultiScale(frame_gray, faces,
-				1.1, minNeighbors,
-				0|CASCADE_SCALE_IMAGE, Size(30, 30));
+  runFaceCascade(frame_gray, faces, minNeighbors, Size(30, 30));
+  if (VERIFY_FACES) {
+    verifier->verify(frame, faces);
+  }
 
   if (faces.size() == 0) { //return old face
     return; 
@@ -192,7 +248,7 @@ void detectFace(Mat frame) {
     std::sort(faces.begin(), faces.end(), compareBigger); 
   } else {
     //sort by distance from prior face (farthest to nearest)
-    std::sort(faces.begin(), faces.end(), compareDistance); 
+    std::sort(faces.begin(), faces.end(), compareDistanceToPrior); 
   }
   priorFace = Rect_<double>(faces[0].x, faces[0].y, faces[0].width, faces[0].height);
   return;
@@ -214,11 +270,11 @@ void test(){
   assert(faces[2].x == 0);
   cout << "sort compareBigger passed" << endl;
 
-  std::sort(faces.begin(), faces.end(), compareDistance);
+  std::sort(faces.begin(), faces.end(), compareDistanceToPrior);
   assert(faces[0].x == -1);
   assert(faces[1].x == 0);
   assert(faces[2].x == 5);
-  cout << "sort compareDistance passed" << endl;
+  cout << "sort compareDistanceToPrior passed" << endl;
   
 } 
 
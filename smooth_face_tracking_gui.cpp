@@ -6,309 +6,1285 @@
 #include <cassert>
 #include <serial/serial.h>
 #include <string>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "cascade_cache.hpp"
+#include "gray_equalize.hpp"
+#include "metrics_server.hpp"
+#include "tracking_session.hpp"
+#include "preview_renderer.hpp"
 
 #define PI 3.14159
 #define SERIAL 1
 #define DISPLAY 0
 #define TEST 0
 #define CAM 1
+#define ROI_TRACKING 1
+#define TILED_DETECTION 1
+#define HYBRID_TRACKING 1
+#define VERIFY_FACES 0 // drop detections without eyes, nose or mouth
+#define MULTI_POSE 0 // also find faces turned to either side
+#define ACTIVITY_FILTER 0 // ActivityMode: 1 search moving parts, 2 skin-coloured, 3 either
+#define SCENE_CACHE 1 // reuse the last detection while the scene stays still
+#define LOG_FRAMES 0
+#define RECORD_FILE "" // record what detection sees for replayTracking, "" to disable
+#define METRICS_PORT 9105 // Prometheus text on 127.0.0.1, 0 to disable
 
 using namespace std;
 using namespace cv;
 
 /* Function Headers */
-void detectFace(Mat frame);
-bool compareBigger(Rect face1, Rect face2);
-bool compareDistance(Rect face1, Rect face2); 
-bool comparePeripheral(Rect face1, Rect face2); 
-void setMouseLocation(int event, int x, int y, int, void*); 
-void writeToMbed(double angled, serial::Serial &mbed);
+void setMouseLocation(int event, int x, int y, int, void* session); 
 void test();
 void testSerial(); 
+void testActuatorLink();
+void testTrackTable();
+void testSessionCommands();
+void testSceneCache();
+void testMetrics();
+void testPreviewRenderer();
+void testDetectionController();
+void testAngleTable();
+void testActivityFilter();
+void testFaceVerifier();
+void testSessionRecording();
+void testCameraCapture();
+void testCompiledCascade();
+void testTiledDetection();
+void testMultiPose();
+void testCascadeCache();
+void testEqualizedGray();
 
 /* global variables */
-Rect priorFace(0, 0, 0, 0);
-vector<Rect> faces;
-CascadeClassifier face_cascade, eyes_cascade;
 String display_window = "Display";
-Point mouseLocation(0, 0);
-int newMouseClick = 0;
-int frame_width = 0;
+const int statsInterval = 5;        // seconds between latency summaries
 
-int mouseCounter = 0;
-/*camera calibration matrices */
-Matx33f K_logitech(1517.6023, 0, 0, 0, 1517.6023, 0, 959.5, 539.5, 1);
-Matx33f K_facetime(1006.2413, 0, 0, 0, 1006.2413, 0, 639.5, 359.5, 1); //ordered by cols
+/*built-in camera calibrations, used without a calibration file */
+const CameraCalibration K_logitech = CameraCalibration::pinhole(1517.6023, 959.5, 539.5);
+const CameraCalibration K_facetime = CameraCalibration::pinhole(1006.2413, 639.5, 359.5);
 
-/*angle look-up tables*/
-const float angleThreshold[15] = {-26, -22, -18, -14, -10, -6, -2, 2, 6, 10, 14, 18, 22, 26, 30}; 
-
-int main() {
+/**
+usage: guiSmoothFaceTracking [calibration.yml]
+the calibration file (YAML or JSON, see camera_model.hpp) replaces the
+built-in matrix picked by CAM
+*/
+int main(int argc, char **argv) {
   if (TEST) {
+    testMultiPose();
+    testCompiledCascade();
+    testTiledDetection();
+    testCameraCapture();
+    testSessionRecording();
+    testFaceVerifier();
+    testActivityFilter();
+    testAngleTable();
+    testDetectionController();
+    testMetrics();
+    testPreviewRenderer();
+    testTrackTable();
+    testSessionCommands();
+    testSceneCache();
+    testEqualizedGray();
+    testCascadeCache();
+    testActuatorLink();
     testSerial();
     return 1;
   }
 
-  VideoCapture cap(0); // capture from default camera
-  cap.set(CV_CAP_PROP_FRAME_WIDTH, 1920);
-  cap.set(CV_CAP_PROP_FRAME_HEIGHT, 1080);
-
-  Mat frame;
-  Mat displayFrame;
-  double scale = 2.0;
-  Point faceCenter(0, 0);  
-  double angle = 0;
-  double angled = 0;
-  double w_half, h_half;
-  unsigned long baud = 9600;
-  serial::Timeout timeout = serial::Timeout::simpleTimeout(1000);
-  std::string port("/dev/ttyACM3");
-  serial::Serial mbed;
-  //serial::Serial mbed(port, baud, serial::Timeout::simpleTimeout(1000)); 
+  SessionConfig config;
+  config.camera = 0; // capture from default camera
+  config.captureSize = Size(1920, 1080);
+  config.scale = 2.0;
+  config.port = SERIAL ? "/dev/ttyACM3" : "";
+  config.baud = 9600;
+  config.display = DISPLAY;
+  config.logFrames = LOG_FRAMES;
+  config.recordPath = RECORD_FILE;
+  config.tracker.roiTracking = ROI_TRACKING;
+  config.tracker.hybridTracking = HYBRID_TRACKING;
+  config.tracker.activity.mode = ACTIVITY_FILTER;
+  config.tracker.sceneCache.enabled = SCENE_CACHE;
+  config.tracker.verifyFaces = VERIFY_FACES;
+  config.tracker.multiPose = MULTI_POSE;
+  if (argc > 1) {
+    if (!config.calibration.load(argv[1])) {
+      return -1;
+    }
+  } else if (CAM == 0) {
+    config.calibration = K_facetime; 
+  } else {
+    config.calibration = K_logitech;
+  }
 
+  const String displayText = "L-click a face to track it. R-click a point to lock onto it, M-click to release. "
+                             "N, B, P: target nearest, biggest, peripheral";
 
-  if (SERIAL) {
-    mbed.setPort(port);
-    mbed.setTimeout(timeout);
-    mbed.setBaudrate(baud);
-    mbed.open();
+  //one worker per core, 4x2 tiles and 3 scale bands; a single task otherwise
+  TiledDetector detector(TILED_DETECTION ? 0 : 1, TILED_DETECTION ? 4 : 1,
+                         TILED_DETECTION ? 2 : 1, TILED_DETECTION ? 3 : 1);
+  if (!detector.load(classifierPath("haarcascade_frontalface_alt.xml"))) {
+    cout << "error loading face classifier" << endl;
+    return -1;
   }
-
-  Matx33f K;
-  if (CAM == 0) {
-    K = K_facetime; 
-  } else {
-    K = K_logitech;
+  if (MULTI_POSE && !detector.loadProfile(classifierPath("haarcascade_profileface.xml"))) {
+    cout << "error loading profile classifier" << endl;
+    return -1;
+  }
+  FaceVerifier verifier(detector.threadPool());
+  if (VERIFY_FACES && !verifier.load()) {
+    cout << "error loading feature classifiers" << endl;
+    return -1;
+  }
+  if (TILED_DETECTION) {
+    setNumThreads(1); //the detector pool already keeps every core busy
   }
 
-  const String displayText = "L-click a face to track it. R-click a point to lock onto it";
-  Point org(50, 50);
-  //initialize frame dimensions
-  int displayW = cvRound(cap.get(CV_CAP_PROP_FRAME_WIDTH)/scale);
-  int displayH = cvRound(cap.get(CV_CAP_PROP_FRAME_HEIGHT)/scale);
-  
-  if (!(face_cascade.load("src/classifiers/haarcascade_frontalface_alt.xml"))) {
-    cout << "error loading face classifier" << endl;
+  TrackingSession session(config, detector, &verifier);
+  if (!session.open()) {
     return -1;
   }
-  if (!(eyes_cascade.load("src/classifiers/haarcascade_eye_tree_eyeglasses.xml"))) {
-    cout << "error loading eye classifier" << endl;
+  MetricsServer metrics;
+  if (METRICS_PORT && metrics.start(METRICS_PORT)) {
+    printf("metrics on http://127.0.0.1:%d/metrics\n", metrics.port());
+  }
+
+  //frames at their own size, so clicks land on frame pixels
+  PreviewParams previewParams;
+  previewParams.fps = 30;
+  previewParams.size = Size();
+  previewParams.window = DISPLAY ? display_window : "";
+  previewParams.caption = displayText;
+  previewParams.onMouse = setMouseLocation;
+  previewParams.mouseData = &session;
+  PreviewRenderer preview(previewParams);
+  if (preview.enabled() && !preview.start()) {
     return -1;
   }
+  // Capture, detection and serial output run on separate threads so a slow
+  // detectMultiScale pass never stalls the camera or the mbed command stream
+  atomic<bool> running(true);
+  vector<TrackingSession *> sessions(1, &session);
+  session.start();
+  thread detectThread(runDetectionScheduler, std::cref(sessions), std::cref(running));
 
-  if (SERIAL) {
-    if (!mbed.isOpen()) {
-      cout << "could not open connection with mbed" << endl;
-      return -1;
-    } else {
-      printf("mbed opened with baud rate:%u\n", mbed.getBaudrate());
+  TrackResult result;
+  int64_t lastReport = nowNs();
+  while (session.isRunning()) {
+    //the renderer copies the frame and draws the faces on its own thread
+    if (session.latestResult(result)) {
+      preview.publish(result);
+    }
+    int key = preview.takeKey();
+    const char policyKeys[] = "nbp"; //targetPolicyNames
+    const char *policyKey = key > 0 && key < 128 ? strchr(policyKeys, key) : NULL;
+    if (policyKey) {
+      session.setTargetPolicy(targetPolicyNames[policyKey - policyKeys]);
+    } else if (key >= 0) // spacebar
+      break;
+    this_thread::sleep_for(chrono::milliseconds(30));
+
+    if (nowNs() - lastReport > statsInterval * 1000000000LL) {
+      session.reportStats();
+      lastReport = nowNs();
     }
   }
 
-  if (DISPLAY) {
-    namedWindow(display_window,
-          CV_WINDOW_AUTOSIZE |
-          CV_WINDOW_KEEPRATIO |
-          CV_GUI_EXPANDED);
-    setMouseCallback(display_window, setMouseLocation, NULL);
+  preview.stop();
+  session.stop();
+  running = false;
+  detectThread.join();
+  return 0;
 
-  }
-  // Loop to capture frames
-  while(cap.read(frame)) {
-    cv::resize(frame, displayFrame, cv::Size(displayW, displayH));
+}
+
+/** 
+  callback function when mouse is clicked, on the preview render thread
+  queues the click as a command for the detection thread
+*/
+void setMouseLocation(int event, int x, int y, int, void* session) {
+  if (event == EVENT_LBUTTONDOWN || event == EVENT_RBUTTONDOWN || event == EVENT_MBUTTONDOWN) {
+    ((TrackingSession *)session)->click(event, x, y);
+    cout << "click" << event << endl;
     
-    // Apply the classifier to the frame, i.e. find face
-    detectFace(displayFrame);
-    w_half = priorFace.width/2;
-    h_half = priorFace.height/2;
-    faceCenter.x = priorFace.x + w_half;
-    faceCenter.y = priorFace.y + h_half;
-    //angled = fastAtan2(scale*faceCenter.x - K(1, 3), K(1, 1));
-    angled = atan2(scale*faceCenter.x - K(1, 3), K(1, 1));
-    angled = angled * 180 / PI;
-/*
-    if (angled > 180) {
-      angled = 360.0 - angled;
+  }
+}
+
+void test(){
+
+  Rect priorFace(0, 0, 0, 0);
+  Rect f1(0, 0, 1, 1);
+  Rect f2(5, 6, 3, 3);
+  Rect f3(-1, -1, 2, 2); 
+  std::vector<Rect> faces;
+  faces.push_back(f1);
+  faces.push_back(f2);
+  faces.push_back(f3);
+  std::sort(faces.begin(), faces.end(), compareBigger);
+  assert(faces[0].x == 5);
+  assert(faces[1].x == -1);
+  assert(faces[2].x == 0);
+  cout << "sort compareBigger passed" << endl;
+
+  std::sort(faces.begin(), faces.end(),
+            [priorFace](Rect a, Rect b) { return compareDistance(a, b, priorFace); });
+  assert(faces[0].x == -1);
+  assert(faces[1].x == 0);
+  assert(faces[2].x == 5);
+  cout << "sort compareDistance passed" << endl;
+  
+} 
+
+/**
+drive an ActuatorLink into a pseudo terminal standing in for the mbed and
+decode what arrives on the other end
+*/
+void testActuatorLink() {
+  uint8_t frame[angleFrameSize];
+  AngleFrame in, out;
+  in.seq = 200;
+  in.angle = -12.34;
+  in.flags = ANGLE_KEEPALIVE;
+  encodeAngleFrame(in, frame);
+  bool decoded = decodeAngleFrame(frame, out);
+  assert(decoded);
+  assert(out.seq == 200 && out.flags == ANGLE_KEEPALIVE && fabs(out.angle + 12.34) < 0.005);
+  frame[3] ^= 0x10;
+  decoded = decodeAngleFrame(frame, out);
+  assert(!decoded);
+  cout << "angle frame encoding passed" << endl;
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  bool granted = master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0;
+  assert(granted);
+  fcntl(master, F_SETFL, O_NONBLOCK);
+
+  LinkParams params;
+  params.keepaliveInterval = 0.05;
+  ActuatorLink link("pty", params);
+  bool opened = link.open(ptsname(master), 9600);
+  assert(opened);
+  link.start();
+
+  // submit must not wait on the port, even when called far faster than it drains
+  int64_t start = nowNs();
+  for (int i = 0; i < 1000; i++) {
+    link.submit(-10.0 + i * 0.00005); //all within the deadband of the first send
+  }
+  assert(nowNs() - start < 50000000LL);
+  this_thread::sleep_for(chrono::milliseconds(30));
+  link.submit(20.5);
+  this_thread::sleep_for(chrono::milliseconds(150)); //room for keepalives
+  link.stop();
+
+  vector<AngleFrame> frames;
+  uint8_t buf[256];
+  size_t have = 0;
+  ssize_t got;
+  while ((got = read(master, buf + have, sizeof(buf) - have)) > 0) {
+    have += got;
+    size_t used = 0;
+    for (; have - used >= angleFrameSize; used += angleFrameSize) {
+      decoded = decodeAngleFrame(buf + used, out);
+      assert(decoded);
+      frames.push_back(out);
     }
+    memmove(buf, buf + used, have - used);
+    have -= used;
+  }
+  close(master);
+
+  assert(have == 0 && frames.size() >= 3 && frames.size() == link.framesSent());
+  assert(frames[0].flags == 0 && fabs(frames[0].angle + 10.0) < 0.1);
+  bool keepalive = false, moved = false;
+  for (size_t i = 0; i < frames.size(); i++) {
+    assert(frames[i].seq == (uint8_t)(frames[0].seq + i));
+    keepalive |= frames[i].flags == ANGLE_KEEPALIVE;
+    moved |= frames[i].flags == 0 && fabs(frames[i].angle - 20.5) < 0.005;
+  }
+  assert(keepalive && moved);
+  cout << "actuator link passed" << endl;
+}
+
+/**
+frames, clicks and pressure come back from a recording as written, raw frames
+bit for bit; a recording whose index was never written is still readable;
+the session config survives the trip through the header
 */
-    if (SERIAL) {
-      writeToMbed(angled, mbed);
+void testSessionRecording() {
+  string path = "/tmp/ft_recording_test.ftr";
+  SessionConfig config;
+  config.name = "replayed";
+  config.tracker.hybridTracking = false;
+  config.tracker.activity.mode = ACTIVITY_SKIN;
+  config.tracker.targetPolicy = targetPolicyByName("biggest");
+  config.tracker.multiPose = true;
+  FileStorage out("config.yml", FileStorage::WRITE | FileStorage::MEMORY | FileStorage::FORMAT_YAML);
+  out << "session";
+  writeSessionConfig(out, config);
+  string configText = out.releaseAndGetString();
+
+  RNG rng(3);
+  vector<Mat> frames;
+  for (int quality = 0; quality <= 90; quality += 90) {
+    SessionRecorder recorder;
+    bool opened = recorder.open(path, configText, quality);
+    assert(opened);
+    frames.clear();
+    for (int i = 0; i < 5; i++) {
+      Mat frame(54, 96, CV_8UC3);
+      rng.fill(frame, RNG::UNIFORM, 0, 256);
+      frames.push_back(frame);
+      vector<RecordedClick> clicks;
+      if (i == 2) {
+        RecordedClick click = {EVENT_LBUTTONDOWN, 40, 20};
+        clicks.push_back(click);
+      }
+      recorder.write(100 + i, i * 33333333LL, 1.0 + i * 0.25, clicks, frame);
     }
+    recorder.close();
 
-    printf("faceX: %d, faceY: %d, angle: %.2f\n", faceCenter.x, faceCenter.y, angled); 
-
-    if (DISPLAY) {
-      //selected face is pink
-      ellipse(displayFrame, faceCenter, Size(w_half, h_half),
-          0, 0, 360, Scalar( 255, 0, 255 ), 4, 8, 0);
-      //other faces are white
-      for (int i = 1; i < faces.size(); i++) {
-        w_half = faces[i].width/2;
-        h_half = faces[i].height/2;
-        faceCenter.x = faces[i].x + w_half;
-        faceCenter.y = faces[i].y + h_half;
-        ellipse(displayFrame, faceCenter, Size(w_half, h_half),
-          0, 0, 360, Scalar( 255, 255, 255 ), 4, 8, 0);
+    SessionRecording recording;
+    opened = recording.open(path);
+    assert(opened && recording.frameCount() == 5);
+    RecordedFrame recorded;
+    for (size_t i = 0; i < 5; i++) {
+      bool fetched = recording.read(i, recorded);
+      assert(fetched);
+      assert(recorded.seq == 100 + i && recorded.captureNs == (int64_t)i * 33333333LL);
+      assert(recorded.pressure == 1.0 + i * 0.25 && recorded.clicks.size() == (i == 2 ? 1u : 0u));
+      assert(recorded.frame.size() == frames[i].size());
+      if (quality == 0) {
+        assert(norm(recorded.frame, frames[i], NORM_INF) == 0);
       }
-      putText(displayFrame, displayText, Point(30, 30), FONT_HERSHEY_PLAIN, 1.0, Scalar(0, 0, 0));
-      imshow(display_window, displayFrame);
-      
     }
+    bool fetched = recording.read(2, recorded);
+    assert(fetched && recorded.clicks[0].x == 40 && recorded.clicks[0].y == 20);
+    fetched = recording.read(5, recorded);
+    assert(!fetched);
+  }
 
-    faces.clear();
-      
-    if(waitKey(30) >= 0) // spacebar
-      break;
+  //cut the index and trailer off, and part of the last frame
+  FILE *f = fopen(path.c_str(), "r+");
+  fseek(f, 0, SEEK_END);
+  long end = ftell(f);
+  fclose(f);
+  int truncated = truncate(path.c_str(), end - sizeof(RecordingTrailer) - 5 * sizeof(uint64_t) - 100);
+  assert(truncated == 0);
+  SessionRecording cut;
+  bool opened = cut.open(path);
+  assert(opened && cut.frameCount() == 4);
+
+  SessionConfig readBack;
+  FileStorage in(cut.config(), FileStorage::READ | FileStorage::MEMORY | FileStorage::FORMAT_YAML);
+  bool parsed = readSessionConfig(in["session"], readBack);
+  assert(parsed);
+  assert(readBack.name == "replayed" && !readBack.tracker.hybridTracking && readBack.tracker.multiPose);
+  assert(readBack.tracker.activity.mode == ACTIVITY_SKIN);
+  assert(readBack.tracker.targetPolicy->name() == "biggest");
+  assert(readBack.calibration.K == config.calibration.K);
+  unlink(path.c_str());
+  cout << "session recording passed" << endl;
+}
+
+/**
+every compiled model finds exactly the raw hits CascadeClassifier finds in
+the XML it was generated from, over noise, smooth gradients and face-like
+blobs, whole frames and tiles, with every lane kernel the CPU supports; and
+the tiled detector groups them the same
+*/
+void testCompiledCascade() {
+  vector<Mat> corpus;
+  RNG rng(21);
+  for (int i = 0; i < 6; i++) {
+    Mat frame(240 + 20 * i, 320 + 40 * i, CV_8UC1);
+    rng.fill(frame, RNG::UNIFORM, 0, 256);
+    GaussianBlur(frame, frame, Size(), 1 + i % 3);
+    Point c(frame.cols / 2 + 10 * i, frame.rows / 2);
+    int side = 40 + 12 * i;
+    ellipse(frame, c, Size(side / 2, side * 6 / 10), 0, 0, 360, Scalar(170), -1);
+    ellipse(frame, c + Point(-side / 5, -side / 8), Size(side / 10, side / 20), 0, 0, 360, Scalar(40), -1);
+    ellipse(frame, c + Point(side / 5, -side / 8), Size(side / 10, side / 20), 0, 0, 360, Scalar(40), -1);
+    line(frame, c + Point(-side / 6, side / 4), c + Point(side / 6, side / 4), Scalar(60), 3);
+    corpus.push_back(frame);
   }
-  return 0;
 
+  vector<string> models = CompiledCascade::models();
+  assert(!models.empty());
+  size_t total = 0;
+  for (size_t m = 0; m < models.size(); m++) {
+    string path = classifierPath(models[m]);
+    unique_ptr<CompiledCascade> compiled = CompiledCascade::create(path);
+    CascadeClassifier reference;
+    bool loaded = reference.load(path);
+    assert(compiled && loaded && compiled->windowSize() == reference.getOriginalWindowSize());
+    const LaneKernel kernels[] = {LANE_SCALAR, LANE_AVX2};
+    for (int k = 0; k < 2; k++) {
+      if (!laneKernelSupported(kernels[k])) {
+        continue;
+      }
+      compiled->setKernel(kernels[k]);
+      for (size_t i = 0; i < corpus.size(); i++) {
+        for (int pass = 0; pass < 3; pass++) {
+          Mat gray = pass == 2 ? corpus[i](Rect(13, 7, corpus[i].cols / 2, corpus[i].rows / 2)) : corpus[i];
+          double scaleFactor = pass == 1 ? 1.2 : 1.1;
+          Size minSize = pass == 1 ? Size(30, 30) : Size();
+          vector<Rect> expected, found;
+          reference.detectMultiScale(gray, expected, scaleFactor, 0, CASCADE_SCALE_IMAGE, minSize);
+          compiled->detectMultiScale(gray, found, scaleFactor, minSize);
+          auto byPosition = [](const Rect &a, const Rect &b) {
+            return a.y != b.y ? a.y < b.y : a.x != b.x ? a.x < b.x : a.width < b.width;
+          };
+          sort(expected.begin(), expected.end(), byPosition);
+          sort(found.begin(), found.end(), byPosition);
+          assert(found == expected);
+          total += found.size();
+        }
+      }
+    }
+  }
+  assert(total > 0); //equal and empty proves nothing
+  unique_ptr<CompiledCascade> tree = CompiledCascade::create(classifierPath("haarcascade_eye_tree_eyeglasses.xml"));
+  assert(!tree);
+
+  TiledDetector detector(3, 4, 2, 3);
+  bool loaded = detector.load(classifierPath("haarcascade_frontalface_alt.xml"));
+  assert(loaded && detector.usesCompiled());
+  for (size_t i = 0; i < corpus.size(); i++) {
+    vector<Rect> compiledFaces, interpretedFaces;
+    detector.detectMultiScale(corpus[i], compiledFaces, 1.1, 2, 0, Size(30, 30));
+    detector.useCompiled(false);
+    detector.detectMultiScale(corpus[i], interpretedFaces, 1.1, 2, 0, Size(30, 30));
+    detector.useCompiled(true);
+    assert(compiledFaces.size() == interpretedFaces.size());
+    for (size_t f = 0; f < compiledFaces.size(); f++) {
+      assert(find(interpretedFaces.begin(), interpretedFaces.end(), compiledFaces[f]) != interpretedFaces.end());
+    }
+  }
+  cout << "compiled cascade passed (" << total << " raw hits, avx2: "
+       << laneKernelSupported(LANE_AVX2) << ")" << endl;
 }
 
-/** 
-  callback function when mouse is clicked
-  set priorFace to face closest to mouse click
+/* a light face side pixels wide around c, with dark brows, eyes and mouth and a light nose */
+static void drawSchematicFace(Mat &frame, Point c, int side) {
+  ellipse(frame, c, Size(side / 2, side * 6 / 10), 0, 0, 360, Scalar::all(200), -1);
+  for (int eye = -1; eye <= 1; eye += 2) {
+    Point e = c + Point(eye * side / 5, -side / 8);
+    line(frame, e + Point(-side / 8, -side / 8), e + Point(side / 8, -side / 8), Scalar::all(50), max(2, side / 25));
+    ellipse(frame, e, Size(side / 9, side / 18), 0, 0, 360, Scalar::all(35), -1);
+  }
+  line(frame, c + Point(0, -side / 10), c + Point(0, side / 8), Scalar::all(220), max(2, side / 20));
+  line(frame, c + Point(-side / 6, side / 4), c + Point(side / 6, side / 4), Scalar::all(60), max(3, side / 20));
+}
+
+/**
+the tiled detector finds what a single detectMultiScale call finds, at nearly
+the same place, on seeded frames of schematic faces of several sizes; faces
+near tile seams included
 */
-void setMouseLocation(int event, int x, int y, int, void*) {
-  if (event == EVENT_LBUTTONDOWN || event == EVENT_RBUTTONDOWN) {
-    mouseLocation.x = x;
-    mouseLocation.y = y;
-    newMouseClick = event;
-    cout << "click" << event << endl;
-    
+void testTiledDetection() {
+  vector<Mat> corpus;
+  RNG rng(3);
+  for (int i = 0; i < 6; i++) {
+    Mat frame(360 + 40 * i, 480 + 60 * i, CV_8UC1);
+    rng.fill(frame, RNG::UNIFORM, 40, 90);
+    int side = 60 + 16 * i;
+    // one face on the vertical tile seam, one inside a tile
+    Point centers[] = {Point(frame.cols / 2, frame.rows / 3), Point(frame.cols / 5, frame.rows * 2 / 3)};
+    for (int f = 0; f < 2; f++) {
+      drawSchematicFace(frame, centers[f], side);
+    }
+    GaussianBlur(frame, frame, Size(), 1.5);
+    corpus.push_back(frame);
+  }
+
+  CascadeClassifier cascade;
+  TiledDetector detector(0, 4, 2, 3);
+  bool loaded = cascade.load(classifierPath("haarcascade_frontalface_alt.xml"));
+  assert(loaded);
+  loaded = detector.load(classifierPath("haarcascade_frontalface_alt.xml"));
+  assert(loaded);
+
+  size_t total = 0;
+  double singleMs = 0, tiledMs = 0;
+  for (size_t i = 0; i < corpus.size(); i++) {
+    vector<Rect> single, tiled;
+    int64 start = getTickCount();
+    cascade.detectMultiScale(corpus[i], single, 1.1, 2, 0, Size(30, 30));
+    singleMs += (getTickCount() - start) * 1000.0 / getTickFrequency();
+    start = getTickCount();
+    detector.detectMultiScale(corpus[i], tiled, 1.1, 2, 0, Size(30, 30));
+    tiledMs += (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+    assert(single.size() == tiled.size());
+    for (size_t f = 0; f < single.size(); f++) {
+      double best = 0;
+      for (size_t t = 0; t < tiled.size(); t++) {
+        best = max(best, rectIoU(single[f], tiled[t]));
+      }
+      assert(best > 0.8);
+    }
+    total += single.size();
   }
+  assert(total > 0);
+  printf("tiled detection passed: %zu faces, single %.1f ms, tiled %.1f ms on %d workers\n",
+         total, singleMs, tiledMs, detector.threadPool().size());
 }
 
-/** 
-function that writes an int value to MBED based on angle value
-quantizes the angle into 16 ranges:
-{ -Inf to -26, -26 to 22, ... 26 to 30, 30 to Inf }
-write an int based on the input range index
+/**
+one pyramid scanned by frontal, profile and mirrored profile models finds
+what each model finds on its own, tagged with its pose; detectPoses matches
+between the compiled and interpreted frontal paths, and without a profile
+classifier it is detectMultiScale with every face frontal
 */
-void writeToMbed(double angled, serial::Serial &mbed) {
-  std::string angleString("15\n");
-  //only compare to second last threshold, since last is infinite
-  for (int i = 0; i < 15; i++) { 
-    if ((angled < angleThreshold[i]) && (mbed.isOpen())) {
-      angleString = std::to_string(i) + std::string("\n");
-      break;
+void testMultiPose() {
+  vector<Mat> corpus;
+  RNG rng(22);
+  for (int i = 0; i < 4; i++) {
+    Mat frame(240, 320 + 40 * i, CV_8UC1);
+    rng.fill(frame, RNG::UNIFORM, 0, 256);
+    GaussianBlur(frame, frame, Size(), 1 + i % 2);
+    int side = 50 + 15 * i;
+    Point c(frame.cols / 3, frame.rows / 2);
+    ellipse(frame, c, Size(side / 2, side * 6 / 10), 0, 0, 360, Scalar(170), -1);
+    ellipse(frame, c + Point(-side / 5, -side / 8), Size(side / 10, side / 20), 0, 0, 360, Scalar(40), -1);
+    ellipse(frame, c + Point(side / 5, -side / 8), Size(side / 10, side / 20), 0, 0, 360, Scalar(40), -1);
+    //a head turned to the left: one eye near the edge, the nose sticking out
+    Point p(frame.cols * 2 / 3, frame.rows / 2);
+    ellipse(frame, p, Size(side * 4 / 10, side * 6 / 10), 0, 0, 360, Scalar(160), -1);
+    ellipse(frame, p + Point(-side / 5, -side / 8), Size(side / 12, side / 20), 0, 0, 360, Scalar(40), -1);
+    fillConvexPoly(frame, vector<Point>{p + Point(-side * 4 / 10, -side / 10), p + Point(-side / 2, side / 8),
+                                        p + Point(-side * 4 / 10, side / 8)}, Scalar(190));
+    corpus.push_back(frame);
+  }
+
+  string frontalPath = classifierPath("haarcascade_frontalface_alt.xml");
+  string profilePath = classifierPath("haarcascade_profileface.xml");
+  unique_ptr<CompiledCascade> models[3] = {CompiledCascade::create(frontalPath),
+                                           CompiledCascade::create(profilePath),
+                                           CompiledCascade::create(profilePath, true)};
+  assert(models[0] && models[1] && models[2]);
+  CompiledCascadeSet set;
+  for (int pose = POSE_FRONTAL; pose <= POSE_RIGHT_PROFILE; pose++) {
+    set.add(models[pose]->clone(), pose);
+  }
+  auto byPosition = [](const Rect &a, const Rect &b) {
+    return a.y != b.y ? a.y < b.y : a.x != b.x ? a.x < b.x : a.width < b.width;
+  };
+  size_t tagged[3] = {0, 0, 0};
+  for (size_t i = 0; i < corpus.size(); i++) {
+    vector<Rect> all;
+    vector<int> tags;
+    set.detectMultiScale(corpus[i], all, tags, 1.1, Size(30, 30));
+    assert(tags.size() == all.size());
+    for (int pose = POSE_FRONTAL; pose <= POSE_RIGHT_PROFILE; pose++) {
+      vector<Rect> expected, found;
+      models[pose]->detectMultiScale(corpus[i], expected, 1.1, Size(30, 30));
+      for (size_t k = 0; k < all.size(); k++) {
+        if (tags[k] == pose) {
+          found.push_back(all[k]);
+        }
+      }
+      sort(expected.begin(), expected.end(), byPosition);
+      sort(found.begin(), found.end(), byPosition);
+      assert(found == expected);
+      tagged[pose] += found.size();
     }
   }
-//write 15 if haven't written yet
-  cout << angleString;
-  mbed.flushOutput(); //only write the most recent value
-  mbed.write(angleString);
-  
+
+  TiledDetector detector(3, 4, 2, 3);
+  bool loaded = detector.load(frontalPath);
+  assert(loaded && !detector.hasProfile());
+  for (size_t i = 0; i < corpus.size(); i++) {
+    vector<Rect> faces, posed;
+    vector<int> poses;
+    detector.detectMultiScale(corpus[i], faces, 1.1, 2, 0, Size(30, 30));
+    detector.detectPoses(corpus[i], posed, poses, 1.1, 2, 0, Size(30, 30));
+    assert(posed == faces && poses == vector<int>(faces.size(), POSE_FRONTAL));
+  }
+  loaded = detector.loadProfile(classifierPath("haarcascade_eye_tree_eyeglasses.xml"));
+  assert(!loaded && !detector.hasProfile());
+  loaded = detector.loadProfile(profilePath);
+  assert(loaded && detector.hasProfile());
+  for (size_t i = 0; i < corpus.size(); i++) {
+    vector<Rect> compiledFaces, interpretedFaces;
+    vector<int> compiledPoses, interpretedPoses;
+    detector.detectPoses(corpus[i], compiledFaces, compiledPoses, 1.1, 2, 0, Size(30, 30));
+    detector.useCompiled(false);
+    detector.detectPoses(corpus[i], interpretedFaces, interpretedPoses, 1.1, 2, 0, Size(30, 30));
+    detector.useCompiled(true);
+    assert(compiledFaces.size() == compiledPoses.size() && compiledFaces.size() == interpretedFaces.size());
+    for (size_t f = 0; f < compiledFaces.size(); f++) {
+      size_t k = find(interpretedFaces.begin(), interpretedFaces.end(), compiledFaces[f]) - interpretedFaces.begin();
+      assert(k < interpretedFaces.size() && interpretedPoses[k] == compiledPoses[f]);
+      assert(compiledPoses[f] >= POSE_FRONTAL && compiledPoses[f] <= POSE_RIGHT_PROFILE);
+    }
+  }
+  cout << "multi-pose passed (" << tagged[0] << " frontal, " << tagged[1] << " left and "
+       << tagged[2] << " right profile raw hits)" << endl;
 }
 
 /**
-compare function
-return area(face1) > area(face2)
+fake YUYV and NV12 cameras: frames come back in a loop, converted like
+cvtColor does at full size and like cvtColor + INTER_AREA at half size
 */
+void testCameraCapture() {
+  string path = "/tmp/ft_capture_test.raw";
+  RNG rng(11);
+  const char *formats[] = {"YUYV", "NV12"};
+  for (int f = 0; f < 2; f++) {
+    uint32_t format = fourcc(formats[f][0], formats[f][1], formats[f][2], formats[f][3]);
+    bool nv12 = f == 1;
+    vector<Mat> frames;
+    for (int i = 0; i < 3; i++) {
+      Mat frame(nv12 ? 72 * 3 / 2 : 72, 128, nv12 ? CV_8UC1 : CV_8UC2);
+      rng.fill(frame, RNG::UNIFORM, 16, 240);
+      GaussianBlur(frame, frame, Size(5, 5), 0); //camera-like, smooth chroma
+      frames.push_back(frame);
+    }
+    bool written = writeFakeCapture(path, format, frames);
+    assert(written);
 
-bool compareBigger(Rect face1, Rect face2) { //biggest -> smallest
-  return face1.width * face1.height > face2.width * face2.height;
+    CameraCapture camera;
+    bool opened = camera.open(0, path, Size(128, 72));
+    assert(opened && camera.size() == Size(128, 72));
+    assert(string(camera.backend()) == (nv12 ? "V4L2 NV12" : "V4L2 YUYV"));
+    Mat out, expected, half;
+    for (int i = 0; i < 4; i++) { //the fourth frame is the first again
+      Mat &frame = frames[i % 3];
+      cvtColor(frame, expected, nv12 ? COLOR_YUV2BGR_NV12 : COLOR_YUV2BGR_YUYV);
+      bool got = camera.read(out, Size(128, 72));
+      assert(got);
+      assert(norm(out, expected, NORM_INF) <= 1);
+      resize(expected, half, Size(64, 36), 0, 0, INTER_AREA);
+      got = camera.retrieve(out, Size(64, 36));
+      assert(got && out.size() == half.size());
+      assert(norm(out, half, NORM_INF) <= 4 && norm(out, half, NORM_L1) / out.total() < 3.0);
+      got = camera.retrieve(out, Size(50, 30));
+      assert(got && out.size() == Size(50, 30)); //not a whole fraction
+    }
+  }
+  unlink(path.c_str());
+  CameraCapture missing;
+  bool opened = missing.open(0, "/tmp/ft_no_such_camera", Size(640, 480));
+  assert(!opened);
+  cout << "camera capture passed" << endl;
 }
+
+/**
+every feature classifier loads, including the old-format mcs cascades, for
+every worker; featureless candidates are dropped whatever their size
+*/
+void testFaceVerifier() {
+  ThreadPool pool(3);
+  FaceVerifier verifier(pool);
+  assert(verifier.empty());
+  bool loaded = verifier.load();
+  assert(loaded && !verifier.empty());
+  RNG rng(5);
+  Mat frame(540, 960, CV_8UC3);
+  rng.fill(frame, RNG::UNIFORM, 0, 256);
+  frame(Rect(0, 0, 480, 540)).setTo(Scalar(128, 128, 128));
+  vector<Rect> faces;
+  verifier.verify(frame, faces);
+  assert(faces.empty());
+  faces.push_back(Rect(50, 50, 40, 40));     //flat wall, upscaled
+  faces.push_back(Rect(100, 200, 300, 300)); //flat wall, downscaled
+  faces.push_back(Rect(900, 500, 100, 100)); //mostly outside the frame
+  verifier.verify(frame, faces);
+  assert(faces.empty());
+  int features = verifier.countFeatures(frame, Rect(2000, 0, 50, 50), 0);
+  assert(features == 0);
+  cout << "face verifier passed" << endl;
+}
+
 /**
-compare function
-return distance_from_priorFace(face1) < distance_from_priorFace((face2)
+a static frame is not searched and keeps its faces, a moving patch is
+searched on its own, and a face that moves is searched again
+a skin-coloured patch on a gray wall is searched without moving
 */
+void testActivityFilter() {
+  ActivityParams params;
+  params.mode = ACTIVITY_MOTION;
+  params.refreshInterval = 0;
+  ActivityFilter motion(params);
+  Mat frame(540, 960, CV_8UC3, Scalar(90, 90, 90));
+  Rect whole(Point(0, 0), frame.size()), face(100, 100, 60, 60), mover(600, 300, 80, 80);
+  vector<Rect> parts, faces;
 
-bool compareDistance(Rect face1, Rect face2) { //sort smallest -- biggest
-  Point2d priorFaceCenter(priorFace.x + priorFace.width/2, priorFace.y + priorFace.height/2);
+  motion.update(frame);
+  motion.regions(whole, 30, parts);
+  assert(parts.size() == 1 && parts[0] == whole); //nothing to compare the first frame with
+  motion.remember(vector<Rect>(1, face), whole);
 
-  double sq_x1 = pow(face1.x + face1.width/2 - priorFaceCenter.x, 2);
-  double sq_y1 = pow(face1.y + face1.height/2 - priorFaceCenter.y, 2);
+  motion.update(frame);
+  motion.regions(whole, 30, parts);
+  assert(parts.empty() && motion.activeShare() == 0);
+  motion.carry(whole, faces);
+  assert(faces.size() == 1 && faces[0] == face);
 
-  double sq_x2 = pow(face2.x + face2.width/2 - priorFaceCenter.x, 2);
-  double sq_y2 = pow(face2.y + face2.height/2 - priorFaceCenter.y, 2);
+  rectangle(frame, mover, Scalar(200, 200, 200), -1);
+  motion.update(frame);
+  motion.regions(whole, 30, parts);
+  assert(parts.size() == 1 && (parts[0] & mover) == mover && parts[0].area() < whole.area() / 4);
+  faces.clear();
+  motion.carry(whole, faces);
+  assert(faces.size() == 1); //the face didn't move
 
-  return (sq_x1 + sq_y1) < (sq_x2 + sq_y2);
+  rectangle(frame, face + Point(10, 10), Scalar(30, 30, 30), -1);
+  motion.update(frame);
+  faces.clear();
+  motion.carry(whole, faces);
+  assert(faces.empty());
 
+  params.mode = ACTIVITY_SKIN;
+  ActivityFilter skin(params);
+  Mat wall(540, 960, CV_8UC3, Scalar(128, 128, 128));
+  Rect patch(300, 200, 64, 64);
+  wall(patch).setTo(Scalar(120, 150, 220)); //BGR skin tone
+  skin.update(wall); //first frame: everything
+  skin.update(wall);
+  skin.regions(whole, 0, parts);
+  assert(parts.size() == 1 && (parts[0] & patch) == patch && parts[0].area() < 4 * patch.area());
+  assert(activityModeByName("any") == ACTIVITY_ANY && activityModeByName("sometimes") < 0);
+  cout << "activity filter passed" << endl;
 }
 
-bool comparePeripheral(Rect face1, Rect face2) {
-  return (abs((face1.x + face1.width/2) - frame_width/2) > abs((face2.x + face2.width/2) - frame_width/2));
+/**
+a pinhole table matches the old atan2 model, a calibration file round-trips,
+and distortion moves the corners but not the principal point
+*/
+void testAngleTable() {
+  AngleTable pinhole;
+  pinhole.build(K_logitech, Size(960, 540), 2.0);
+  for (int x = 0; x < 960; x += 97) {
+    double expected = atan2(2.0*x - 959.5, 1517.6023) * 180 / CV_PI;
+    assert(fabs(pinhole.angles(x, 270).x - expected) < 1e-3);
+  }
+  assert(pinhole.angles(-50, -50) == pinhole.angles(0, 0)); //clamped to the frame
+  assert(pinhole.angles(480, 100).y < 0 && pinhole.angles(480, 500).y > 0);
+
+  string path = "/tmp/ft_calibration_test.yml";
+  {
+    FileStorage fs(path, FileStorage::WRITE);
+    fs << "image_width" << 1920 << "image_height" << 1080;
+    fs << "camera_matrix" << Mat(Matx33d(1517.6023, 0, 959.5, 0, 1517.6023, 539.5, 0, 0, 1));
+    fs << "distortion_coefficients" << (Mat_<double>(1, 5) << -0.2, 0.05, 0, 0, 0);
+  }
+  CameraCalibration loaded;
+  bool read = loaded.load(path);
+  assert(read);
+  unlink(path.c_str());
+  assert(loaded.imageSize == Size(1920, 1080) && loaded.distortion.cols == 5);
+  AngleTable distorted;
+  distorted.build(loaded, Size(960, 540), 0); //scale taken from image_width/height
+  Point2f center = distorted.angles(479.75, 269.75), corner = distorted.angles(0, 0);
+  assert(fabs(center.x) < 0.05 && fabs(center.y) < 0.05);
+  assert(fabs(corner.x - pinhole.angles(0, 0).x) > 0.5); //barrel distortion widens the view
+  cout << "angle table passed" << endl;
 }
 
-/** 
-Detect face and sets the global variable priorFace 
-If priorFace is uninitialized, set to biggest face.
-If multiple faces are found, set to face with nearest distance to priorFace.
-If no face is found, don't set to new value.
+/**
+large faces are searched for on a shrunk image, lost ones at full resolution,
+and passes over budget coarsen the plan until they are back under it
 */
-void detectFace(Mat frame) {
-  
-  Mat frame_gray, frame_lab;
-  int minNeighbors = 2;
+void testDetectionController() {
+  DetectionControlParams params;
+  DetectionController control(params, Size(30, 30), Size(20, 20));
+  DetectionPlan lost = control.plan(Rect(), 0);
+  assert(lost.downscale == 1 && lost.scaleFactor == params.scaleFactor);
+  assert(lost.minSize == Size(30, 30) && lost.maxSize == Size());
+  DetectionPlan small = control.plan(Rect(100, 100, 50, 50), 0.3);
+  assert(small.downscale == 1 && small.minSize == Size(35, 35) && small.maxSize == Size(65, 65));
+  DetectionPlan large = control.plan(Rect(100, 100, 200, 200), 0.3);
+  assert(fabs(large.downscale - 140.0 / params.detectFaceSide) < 1e-9);
+  assert(large.minSize == Size(140, 140) && large.maxSize == Size(260, 260));
 
-  cvtColor(frame, frame_gray, COLOR_BGR2GRAY);   // Convert to gray
-  equalizeHist(frame_gray, frame_gray);          // Equalize histogram
-  
-  // Detect face with open source cascade
-  face_cascade.detectMultiScale(frame_gray, faces,
-				1.1, minNeighbors,
-				0|CASCADE_SCALE_IMAGE, Size(30, 30));
-
-//if mouse has been left clicked, set priorFace to that face (Track that face)
-//if mouse has been right clicked, set face to that location and don't track
-  if (newMouseClick) {
-    //arbitrary size needed in case click is R to draw the ellipse
-    priorFace.x = mouseLocation.x - 50;
-    priorFace.y = mouseLocation.y - 50;
-    priorFace.width = 100;
-    priorFace.height = 100;
-  //only L click deactivates the lock
-    if (newMouseClick == EVENT_RBUTTONDOWN) {
-      faces.clear();
-      return;
-    }  else {
-      newMouseClick = 0; 
+  for (int i = 0; i < 20; i++) {
+    control.record((int64_t)(params.budget * 2e9));
+  }
+  assert(control.pressure() == params.maxPressure);
+  DetectionPlan pressed = control.plan(Rect(), 0);
+  assert(pressed.downscale > 1 && pressed.scaleFactor > lost.scaleFactor);
+  assert(pressed.minSize.width > 30 && pressed.minSize.width / pressed.downscale >= 20);
+  assert(control.plan(Rect(100, 100, 200, 200), 0.3).downscale <= params.maxDownscale);
+  for (int i = 0; i < 100; i++) {
+    control.record((int64_t)(params.budget * 0.5e9));
+  }
+  assert(control.pressure() == 1);
+
+  params.adaptive = false;
+  DetectionController fixed(params, Size(30, 30));
+  fixed.record((int64_t)(params.budget * 2e9));
+  assert(fixed.plan(Rect(100, 100, 200, 200), 0.3).downscale == 1);
+  cout << "detection controller passed" << endl;
+}
+
+/**
+a recorded latency lands in its bucket, and the local endpoint serves it
+*/
+void testMetrics() {
+  StageStats stats("test", "stage");
+  stats.record(3000); //3 us
+  stats.drop();
+  string text = renderMetrics();
+  assert(text.find("ft_stage_seconds_bucket{session=\"test\",stage=\"stage\",le=\"2e-06\"} 0") != string::npos);
+  assert(text.find("ft_stage_seconds_bucket{session=\"test\",stage=\"stage\",le=\"4e-06\"} 1") != string::npos);
+  assert(text.find("ft_stage_drops_total{session=\"test\",stage=\"stage\"} 1") != string::npos);
+
+  MetricsServer server;
+  bool started = server.start(0);
+  assert(started);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(server.port());
+  int connected = connect(fd, (sockaddr *)&addr, sizeof(addr));
+  assert(connected == 0);
+  const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+  ssize_t sent = send(fd, request, sizeof(request) - 1, 0);
+  assert(sent > 0);
+  string response;
+  char buf[4096];
+  ssize_t got;
+  while ((got = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    response.append(buf, got);
+  }
+  close(fd);
+  server.stop();
+  assert(response.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+  assert(response.find("stage=\"stage\",le=\"4e-06\"} 1") != string::npos);
+  cout << "metrics export passed" << endl;
+}
+
+/**
+previews are decimated to fps, rendered off the caller's thread at the
+preview size, and come out of the MJPEG file and the HTTP stream as JPEGs
+*/
+void testPreviewRenderer() {
+  string path = "/tmp/ft_preview_test.mjpeg";
+  PreviewParams params;
+  params.fps = 20;
+  params.size = Size(160, 90);
+  params.mjpegPath = path;
+  params.mjpegPort = -1;
+  PreviewRenderer preview(params, "test");
+  assert(preview.enabled());
+  bool started = preview.start();
+  assert(started && preview.port() > 0);
+
+  TrackResult result;
+  result.frame = Mat(360, 640, CV_8UC3, Scalar(40, 80, 120));
+  result.face = Rect(200, 100, 80, 80);
+  result.faces.assign(2, result.face);
+  result.faces[1] = Rect(400, 120, 60, 60);
+  bool published = preview.publish(result);
+  assert(published);
+  published = preview.publish(result);
+  assert(!published); //not due for another 50 ms
+  result.frame.setTo(Scalar(0, 0, 0)); //the published copy is unaffected
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(preview.port());
+  int connected = connect(fd, (sockaddr *)&addr, sizeof(addr));
+  assert(connected == 0);
+  const char request[] = "GET / HTTP/1.0\r\n\r\n";
+  ssize_t sent = send(fd, request, sizeof(request) - 1, 0);
+  assert(sent > 0);
+
+  this_thread::sleep_for(chrono::milliseconds(60));
+  published = preview.publish(result);
+  assert(published);
+  for (int i = 0; i < 200 && preview.rendered() < 2; i++) {
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  int key = preview.takeKey();
+  assert(preview.rendered() == 2 && key == -1);
+  preview.stop();
+
+  string response;
+  char buf[4096];
+  ssize_t got;
+  while ((got = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    response.append(buf, got);
+  }
+  close(fd);
+  assert(response.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+  assert(response.find("multipart/x-mixed-replace") != string::npos);
+  size_t body = response.find("\r\n\r\n", response.rfind("image/jpeg")); //the last frame sent
+  assert(body != string::npos);
+  vector<uchar> streamed(response.begin() + body + 4, response.end());
+  Mat streamedFrame = imdecode(streamed, IMREAD_COLOR);
+  assert(streamedFrame.size() == params.size && mean(streamedFrame)[0] < 20); //the black frame
+
+  ifstream in(path, ios::binary);
+  vector<uchar> file((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  Mat first = imdecode(file, IMREAD_COLOR); //the first of the two concatenated JPEGs
+  assert(first.size() == params.size && fabs(mean(first)[2] - 120) < 20);
+  unlink(path.c_str());
+
+  // a 16:9 frame on a 4:3 preview: x shrinks by 0.75, y stays
+  params.size = Size(960, 720);
+  params.mjpegPort = 0;
+  PreviewRenderer stretched(params, "test");
+  started = stretched.start();
+  assert(started);
+  TrackResult wide;
+  wide.frame = Mat(720, 1280, CV_8UC3, Scalar(0, 0, 0));
+  wide.face = Rect(600, 300, 120, 120);
+  stretched.publish(wide);
+  for (int i = 0; i < 200 && stretched.rendered() < 1; i++) {
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  stretched.stop();
+  ifstream wideIn(path, ios::binary);
+  vector<uchar> wideFile((istreambuf_iterator<char>(wideIn)), istreambuf_iterator<char>());
+  Mat drawn = imdecode(wideFile, IMREAD_COLOR);
+  assert(drawn.size() == params.size);
+  auto pink = [&drawn](int x, int y) {
+    Vec3b p = drawn.at<Vec3b>(y, x);
+    return p[0] > 150 && p[1] < 100 && p[2] > 150;
+  };
+  assert(pink(495, 300) && pink(495, 420) && pink(450, 360) && pink(540, 360)); //the ellipse's extremes
+  assert(!pink(495, 225)); //where one scale for both axes put its top
+  unlink(path.c_str());
+  cout << "preview renderer passed" << endl;
+}
+
+/* cascade passes session has run so far, from the metrics it exports */
+static unsigned long cascadePasses(const string &session) {
+  string text = renderMetrics();
+  string key = "ft_stage_seconds_count{session=\"" + session + "\",stage=\"cascade\"} ";
+  size_t at = text.find(key);
+  assert(at != string::npos);
+  return strtoul(text.c_str() + at + key.size(), NULL, 10);
+}
+
+/**
+commands from several threads all arrive, each thread's in order; a lock
+holds the point and skips the cascade until a release or a track command,
+commands queued for one frame apply in order, and a new target policy picks
+the next target
+*/
+void testSessionCommands() {
+  const int producers = 4, perProducer = 20000;
+  CommandQueue<int> queue(16);
+  vector<thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.push_back(thread([&queue, p]() {
+      for (int i = 0; i < perProducer; i++) {
+        while (!queue.push(p * perProducer + i)) {
+          this_thread::yield(); //full, wait for the consumer
+        }
+      }
+    }));
+  }
+  vector<int> next(producers, 0);
+  for (int received = 0; received < producers * perProducer; ) {
+    int value;
+    if (!queue.pop(value)) {
+      this_thread::yield();
+      continue;
     }
-  } 
+    int p = value / perProducer;
+    assert(value % perProducer == next[p]);
+    next[p]++;
+    received++;
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  int value;
+  bool popped = queue.pop(value);
+  assert(!popped);
+
+  TiledDetector detector(2, 2, 1, 1);
+  bool loaded = detector.load(classifierPath("haarcascade_frontalface_alt.xml"));
+  assert(loaded);
+  SessionConfig config;
+  config.name = "commands";
+  config.tracker.roiTracking = false;
+  config.tracker.hybridTracking = false;
+  TrackingSession session(config, detector);
+  Mat frame(180, 320, CV_8UC3, Scalar(90, 90, 90)); //nothing to find
+  TrackResult result;
+  int64_t t = 0;
+  session.process(frame, t += 33333333, 0, result);
+  unsigned long passes = cascadePasses("commands");
+  assert(passes > 0);
 
-  if (faces.size() == 0) { // no face detected return old face
-    return; 
+  session.click(EVENT_RBUTTONDOWN, 120, 80);
+  for (int i = 0; i < 3; i++) {
+    session.process(frame, t += 33333333, 0, result);
+    assert(session.locked() && result.face == Rect(70, 30, 100, 100) && result.faces.empty());
   }
+  assert(cascadePasses("commands") == passes);
+  session.click(EVENT_MBUTTONDOWN, 0, 0);
+  session.process(frame, t += 33333333, 0, result);
+  assert(!session.locked() && cascadePasses("commands") > passes);
 
-  //if priorCenter is not initalized, initialize to most peripheral face
-  if (priorFace.x == 0) { 
-    std::sort(faces.begin(), faces.end(), comparePeripheral); 
-  } else {
-    //sort by distance from prior face (farthest to nearest)
-    std::sort(faces.begin(), faces.end(), compareDistance); 
+  session.click(EVENT_RBUTTONDOWN, 120, 80);
+  session.click(EVENT_LBUTTONDOWN, 200, 100); //applied after the lock, ends it
+  passes = cascadePasses("commands");
+  session.process(frame, t += 33333333, 0, result);
+  assert(!session.locked() && cascadePasses("commands") > passes && result.face == Rect(150, 50, 100, 100));
+
+  //a small face at the lock point, a big one away from it; the policy picks
+  //again once a release drops the target
+  Mat gray(360, 480, CV_8UC1, Scalar(70)), faces;
+  drawSchematicFace(gray, Point(120, 120), 80);
+  drawSchematicFace(gray, Point(340, 200), 140);
+  GaussianBlur(gray, gray, Size(), 1.5);
+  cvtColor(gray, faces, COLOR_GRAY2BGR);
+  session.click(EVENT_RBUTTONDOWN, 120, 120);
+  session.click(EVENT_MBUTTONDOWN, 0, 0);
+  session.process(faces, t += 33333333, 0, result);
+  Rect nearest = result.face;
+  assert(result.targetId >= 0 && nearest.contains(Point(120, 120)));
+
+  bool queued = session.setTargetPolicy("tallest");
+  assert(!queued);
+  queued = session.setTargetPolicy("biggest");
+  assert(queued);
+  session.process(faces, t += 33333333, 0, result);
+  assert(result.face == nearest); //the target stays while it is in view
+  session.click(EVENT_RBUTTONDOWN, 120, 120);
+  session.click(EVENT_MBUTTONDOWN, 0, 0);
+  session.process(faces, t += 33333333, 0, result);
+  assert(result.targetId >= 0 && result.face.contains(Point(340, 200)) && !result.face.contains(Point(120, 120)));
+  cout << "session commands passed" << endl;
+}
+
+/**
+a still scene reuses the last result without a cascade pass, through sensor
+noise, until maxAge frames passed; a changed block or a command runs the
+cascade on the frame it arrives with
+*/
+void testSceneCache() {
+  SceneCacheParams params;
+  params.enabled = true;
+  params.maxAge = 5;
+  SceneCache cache(params);
+  Mat still(180, 320, CV_8UC3, Scalar(90, 90, 90));
+  bool matched = cache.matches(still);
+  assert(!matched && cache.lastChange() == -1); //nothing stored yet
+  cache.store();
+  Mat noisy = still.clone();
+  randu(noisy, Scalar(88, 88, 88), Scalar(93, 93, 93)); //+-2 levels per pixel
+  matched = cache.matches(noisy);
+  assert(matched && cache.lastChange() <= 1);
+  Mat moved = still.clone();
+  rectangle(moved, Rect(150, 60, 20, 20), Scalar(200, 200, 200), -1);
+  matched = cache.matches(moved);
+  assert(!matched && cache.lastChange() > params.maxChange);
+  cache.invalidate();
+  matched = cache.matches(still);
+  assert(!matched);
+
+  TiledDetector detector(2, 2, 1, 1);
+  bool loaded = detector.load(classifierPath("haarcascade_frontalface_alt.xml"));
+  assert(loaded);
+  SessionConfig config;
+  config.name = "scene";
+  config.tracker.roiTracking = false;
+  config.tracker.hybridTracking = false;
+  config.tracker.sceneCache = params;
+  TrackingSession session(config, detector);
+  TrackResult result;
+  int64_t t = 0;
+  session.process(still, t += 33333333, 0, result);
+  unsigned long passes = cascadePasses("scene");
+  assert(passes > 0);
+  for (int i = 0; i < params.maxAge; i++) {
+    session.process(i % 2 ? noisy : still, t += 33333333, 0, result);
   }
+  assert(cascadePasses("scene") == passes);
+  session.process(still, t += 33333333, 0, result); //too old, refreshed
+  assert(cascadePasses("scene") > passes);
 
-  //record face0 as priorFace for future sorting
-  priorFace.x = faces[0].x; 
-  priorFace.y = faces[0].y;
-  priorFace.width = faces[0].width;
-  priorFace.height = faces[0].height;
-  return;
+  passes = cascadePasses("scene");
+  session.process(moved, t += 33333333, 0, result);
+  assert(cascadePasses("scene") > passes);
+  passes = cascadePasses("scene");
+  session.process(moved, t += 33333333, 0, result);
+  assert(cascadePasses("scene") == passes);
+  bool queued = session.setTargetPolicy("biggest");
+  assert(queued);
+  session.process(moved, t += 33333333, 0, result);
+  assert(cascadePasses("scene") > passes);
+  cout << "scene cache passed" << endl;
 }
 
-void test(){
+/**
+ids stay with their faces as they move and cross, only faces that were
+searched for age out, and the target policies pick without sorting
+*/
+void testTrackTable() {
+  TrackTable table;
+  Rect frame(0, 0, 960, 540);
+  vector<Rect> faces;
+  faces.push_back(Rect(100, 100, 80, 80));
+  faces.push_back(Rect(600, 120, 90, 90));
+  table.update(faces, frame);
+  assert(table.tracks().size() == 2);
+  int left = table.tracks()[0].id, right = table.tracks()[1].id;
+  assert(left != right);
 
-  priorFace = Rect_<double>(0, 0, 0, 0);
-  Rect f1(0, 0, 1, 1);
-  Rect f2(5, 6, 3, 3);
-  Rect f3(-1, -1, 2, 2); 
-  std::vector<Rect> faces;
-  faces.push_back(f1);
-  faces.push_back(f2);
-  faces.push_back(f3);
-  std::sort(faces.begin(), faces.end(), compareBigger);
-  assert(faces[0].x == 5);
-  assert(faces[1].x == -1);
-  assert(faces[2].x == 0);
-  cout << "sort compareBigger passed" << endl;
+  // listed in the other order and moved a little: same ids
+  swap(faces[0], faces[1]);
+  faces[0] += Point(-8, 4);
+  faces[1] += Point(10, 0);
+  table.update(faces, frame);
+  assert(table.tracks().size() == 2);
+  assert(table.find(right)->detection == 0 && table.find(left)->detection == 1);
+  assert(table.find(left)->box == faces[1] && table.find(left)->hits == 2);
 
-  std::sort(faces.begin(), faces.end(), compareDistance);
-  assert(faces[0].x == -1);
-  assert(faces[1].x == 0);
-  assert(faces[2].x == 5);
-  cout << "sort compareDistance passed" << endl;
-  
-} 
+  // a newcomer next to the left face gets a new id instead of taking its place
+  faces.push_back(Rect(190, 100, 80, 80));
+  table.update(faces, frame);
+  assert(table.tracks().size() == 3 && table.find(left)->detection == 1);
+  int newcomer = table.nearest(Point(230, 140));
+  assert(newcomer != left && newcomer != right);
+
+  // only the right face is searched and not found: it ages, the others don't
+  faces.clear();
+  TrackTableParams params;
+  for (int i = 0; i <= params.maxMisses; i++) {
+    table.update(faces, Rect(500, 0, 460, 540));
+  }
+  assert(!table.find(right) && table.find(left) && table.find(newcomer));
+  cout << "track table association passed" << endl;
+
+  TrackTable crowd;
+  faces.clear();
+  faces.push_back(Rect(400, 200, 60, 60));
+  faces.push_back(Rect(20, 200, 40, 40));
+  faces.push_back(Rect(700, 200, 120, 120));
+  crowd.update(faces, frame);
+  const vector<FaceTrack> &tracks = crowd.tracks();
+  assert(BiggestTarget().select(tracks, Rect(), frame.size()) == 2);
+  assert(PeripheralTarget().select(tracks, Rect(), frame.size()) == 1);
+  assert(NearestTarget().select(tracks, Rect(), frame.size()) == 1);
+  assert(NearestTarget().select(tracks, Rect(390, 190, 50, 50), frame.size()) == 0);
+  assert(targetPolicyByName("biggest") && !targetPolicyByName("tallest"));
+  cout << "target policies passed" << endl;
+}
+
+/**
+every kernel the CPU supports must match cvtColor + equalizeHist bit for bit,
+on odd widths (SIMD tails), regions of larger frames, low-contrast and flat images
+*/
+void testEqualizedGray() {
+  RNG rng(12);
+  Mat big(1080, 1920, CV_8UC3);
+  rng.fill(big, RNG::UNIFORM, 0, 256);
+  vector<Mat> inputs;
+  inputs.push_back(big);
+  inputs.push_back(big(Rect(3, 5, 961, 537)));
+  for (int width = 1; width <= 70; width++) {
+    inputs.push_back(big(Rect(width, 0, width, 3)));
+  }
+  Mat narrow(240, 320, CV_8UC3);
+  rng.fill(narrow, RNG::NORMAL, 128, 6);
+  inputs.push_back(narrow);
+  inputs.push_back(Mat(40, 50, CV_8UC3, Scalar(17, 90, 200)));
+
+  GrayKernel kernels[] = {GRAY_SCALAR, GRAY_SSSE3, GRAY_AVX2, GRAY_AUTO};
+  for (size_t i = 0; i < inputs.size(); i++) {
+    Mat expected, storage;
+    cvtColor(inputs[i], expected, COLOR_BGR2GRAY);
+    equalizeHist(expected, expected);
+    for (int k = 0; k < 4; k++) {
+      if (!grayKernelSupported(kernels[k])) {
+        continue;
+      }
+      Mat gray = reuseBuffer(storage, inputs[i].size(), CV_8UC1);
+      equalizedGray(inputs[i], gray, kernels[k]);
+      assert(norm(gray, expected, NORM_INF) == 0);
+    }
+  }
+  cout << "fused gray equalization passed (avx2: " << grayKernelSupported(GRAY_AVX2)
+       << ", ssse3: " << grayKernelSupported(GRAY_SSSE3) << ")" << endl;
+}
+
+/**
+compile a copy of a stump classifier that isn't built in, check the model
+read from its cache finds exactly CascadeClassifier's raw hits, that an edited
+XML bypasses the cache and that tree cascades aren't compiled
+*/
+void testCascadeCache() {
+  string xmlPath = "/tmp/ft_cascade_test.xml";
+  string cachePath = cascadeCachePath(xmlPath);
+  MappedFile original;
+  bool opened = original.open(classifierPath("haarcascade_frontalface_default.xml"));
+  assert(opened);
+  FILE *copy = fopen(xmlPath.c_str(), "wb");
+  assert(copy);
+  size_t wrote = fwrite(original.data(), 1, original.size(), copy);
+  fclose(copy);
+  assert(wrote == original.size());
+  bool compiledCache = compileCascadeCache(xmlPath, cachePath);
+  assert(compiledCache);
+
+  CascadeClassifier fromXml;
+  bool loaded = fromXml.load(xmlPath);
+  unique_ptr<CompiledCascade> fromCache = CompiledCascade::createCached(xmlPath);
+  assert(loaded && fromCache);
+  assert(fromCache->windowSize() == fromXml.getOriginalWindowSize());
+
+  Mat frame(360, 640, CV_8UC1);
+  RNG rng(7);
+  rng.fill(frame, RNG::UNIFORM, 0, 256);
+  GaussianBlur(frame, frame, Size(5, 5), 0);
+  for (int i = 0; i < 3; i++) {
+    Point c(120 + 200 * i, 180);
+    int side = 60 + 30 * i;
+    ellipse(frame, c, Size(side / 2, side * 6 / 10), 0, 0, 360, Scalar(170), -1);
+    ellipse(frame, c + Point(-side / 5, -side / 8), Size(side / 10, side / 20), 0, 0, 360, Scalar(40), -1);
+    ellipse(frame, c + Point(side / 5, -side / 8), Size(side / 10, side / 20), 0, 0, 360, Scalar(40), -1);
+    line(frame, c + Point(-side / 6, side / 4), c + Point(side / 6, side / 4), Scalar(60), 3);
+  }
+  vector<Rect> expected, found;
+  fromXml.detectMultiScale(frame, expected, 1.1, 0, CASCADE_SCALE_IMAGE);
+  fromCache->detectMultiScale(frame, found, 1.1);
+  auto byPosition = [](const Rect &a, const Rect &b) {
+    return a.y != b.y ? a.y < b.y : a.x != b.x ? a.x < b.x : a.width < b.width;
+  };
+  sort(expected.begin(), expected.end(), byPosition);
+  sort(found.begin(), found.end(), byPosition);
+  assert(found == expected);
+  cout << "cascade cache load passed (" << found.size() << " raw hits)" << endl;
+
+  copy = fopen(xmlPath.c_str(), "ab");
+  assert(copy);
+  int appended = fputs("\n", copy);
+  fclose(copy);
+  assert(appended >= 0);
+  unique_ptr<CompiledCascade> stale = CompiledCascade::createCached(xmlPath);
+  assert(!stale);
+  unlink(xmlPath.c_str());
+  unlink(cachePath.c_str());
+
+  string treePath = classifierPath("haarcascade_eye_tree_eyeglasses.xml");
+  string treeCache = "/tmp/ft_cascade_tree.ftc";
+  bool compiledTree = compileCascadeCache(treePath, treeCache);
+  assert(!compiledTree);
+  cout << "cascade cache fallback passed" << endl;
+}
 
 void testSerial() {
   unsigned long baud = 9600;
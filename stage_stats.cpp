@@ -0,0 +1,130 @@
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* live stages, for renderMetrics() */
+static std::mutex registryLock;
+static std::vector<const StageStats *> registry;
+
+StageStats::StageStats(const std::string &session, const std::string &stage)
+  : session(session), stage(stage), count(0), drops(0), totalNs(0), maxNs(0),
+    allDrops(0), allNs(0) {
+  for (int b = 0; b < bucketCount; b++) {
+    buckets[b] = 0;
+    reported[b] = 0;
+  }
+  std::lock_guard<std::mutex> guard(registryLock);
+  registry.push_back(this);
+}
+
+StageStats::~StageStats() {
+  std::lock_guard<std::mutex> guard(registryLock);
+  registry.erase(std::find(registry.begin(), registry.end(), this));
+}
+
+/* histogram bucket of a duration: 0 up to 1 us, b up to 2^b us */
+static int bucketOf(int64_t elapsedNs) {
+  uint64_t us = elapsedNs > 0 ? (uint64_t)(elapsedNs + 999) / 1000 : 0;
+  if (us <= 1) {
+    return 0;
+  }
+  int b = 64 - __builtin_clzll(us - 1); //smallest b with 2^b >= us
+  return std::min(b, StageStats::bucketCount - 1);
+}
+
+void StageStats::record(int64_t elapsedNs) {
+  count.fetch_add(1, std::memory_order_relaxed);
+  totalNs.fetch_add(elapsedNs, std::memory_order_relaxed);
+  int64_t prevMax = maxNs.load(std::memory_order_relaxed);
+  while (elapsedNs > prevMax &&
+         !maxNs.compare_exchange_weak(prevMax, elapsedNs, std::memory_order_relaxed)) {
+  }
+  buckets[bucketOf(elapsedNs)].fetch_add(1, std::memory_order_relaxed);
+  allNs.fetch_add(elapsedNs, std::memory_order_relaxed);
+}
+
+void StageStats::drop(unsigned long n) {
+  drops.fetch_add(n, std::memory_order_relaxed);
+  allDrops.fetch_add(n, std::memory_order_relaxed);
+}
+
+/**
+print count, mean, median, p99 and max latency since the last report, then reset
+the percentiles are the upper edges of their histogram buckets
+*/
+void StageStats::report() {
+  unsigned long n = count.exchange(0, std::memory_order_relaxed);
+  int64_t total = totalNs.exchange(0, std::memory_order_relaxed);
+  int64_t worst = maxNs.exchange(0, std::memory_order_relaxed);
+  unsigned long dropped = drops.exchange(0, std::memory_order_relaxed);
+  double avgMs = n ? total / 1e6 / n : 0.0;
+
+  unsigned long interval[bucketCount], seen = 0;
+  for (int b = 0; b < bucketCount; b++) {
+    unsigned long now = buckets[b].load(std::memory_order_relaxed);
+    interval[b] = now - reported[b];
+    reported[b] = now;
+    seen += interval[b];
+  }
+  double p50Ms = 0, p99Ms = 0;
+  unsigned long below = 0;
+  for (int b = 0; b < bucketCount && seen; b++) {
+    below += interval[b];
+    double edgeMs = b < bucketCount - 1 ? (1 << b) / 1e3 : worst / 1e6;
+    if (p50Ms == 0 && below * 2 >= seen) {
+      p50Ms = edgeMs;
+    }
+    if (p99Ms == 0 && below * 100 >= seen * 99) {
+      p99Ms = edgeMs;
+    }
+  }
+  printf("%-10s n: %5lu, avg: %7.2f ms, p50 <= %7.2f ms, p99 <= %7.2f ms, max: %7.2f ms, dropped: %lu\n",
+         (session + " " + stage).c_str(), n, avgMs, p50Ms, p99Ms, worst / 1e6, dropped);
+}
+
+void StageStats::renderMetrics(std::string &histogram, std::string &dropCounter) const {
+  char labels[256], line[384];
+  snprintf(labels, sizeof(labels), "session=\"%s\",stage=\"%s\"", session.c_str(), stage.c_str());
+  unsigned long cumulative = 0;
+  for (int b = 0; b < bucketCount; b++) {
+    cumulative += buckets[b].load(std::memory_order_relaxed);
+    if (b < bucketCount - 1) {
+      snprintf(line, sizeof(line), "ft_stage_seconds_bucket{%s,le=\"%g\"} %lu\n",
+               labels, (1 << b) / 1e6, cumulative);
+    } else {
+      snprintf(line, sizeof(line), "ft_stage_seconds_bucket{%s,le=\"+Inf\"} %lu\n",
+               labels, cumulative);
+    }
+    histogram += line;
+  }
+  //the count is the +Inf bucket, so the two always agree
+  snprintf(line, sizeof(line), "ft_stage_seconds_sum{%s} %.9f\n",
+           labels, allNs.load(std::memory_order_relaxed) / 1e9);
+  histogram += line;
+  snprintf(line, sizeof(line), "ft_stage_seconds_count{%s} %lu\n", labels, cumulative);
+  histogram += line;
+  snprintf(line, sizeof(line), "ft_stage_drops_total{%s} %lu\n",
+           labels, allDrops.load(std::memory_order_relaxed));
+  dropCounter += line;
+}
+
+std::string renderMetrics() {
+  std::string histogram = "# HELP ft_stage_seconds Time spent in one pipeline stage.\n"
+                          "# TYPE ft_stage_seconds histogram\n";
+  std::string dropCounter = "# HELP ft_stage_drops_total Frames a stage dropped or failed.\n"
+                            "# TYPE ft_stage_drops_total counter\n";
+  std::lock_guard<std::mutex> guard(registryLock);
+  for (size_t i = 0; i < registry.size(); i++) {
+    registry[i]->renderMetrics(histogram, dropCounter);
+  }
+  return histogram + dropCounter;
+}
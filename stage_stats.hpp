@@ -0,0 +1,54 @@
+#ifndef STAGE_STATS_HPP
+#define STAGE_STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/* monotonic clock in nanoseconds, used to timestamp frames across stages */
+int64_t nowNs();
+
+/**
+Latency counters for one pipeline stage.
+record() is called from the thread running the stage and report() from the
+thread printing the summary; everything is atomic so neither side locks.
+Each report() covers the interval since the previous one.
+Besides the interval counters, every stage keeps a cumulative histogram with
+power-of-two buckets from 1 us, which renderMetrics() exports. Every live
+StageStats is listed in a registry for that; registering is the only lock.
+*/
+class StageStats {
+public:
+  static const int bucketCount = 22;  // <= 1 us, <= 2 us, ... <= 2^20 us, above
+
+  StageStats(const std::string &session, const std::string &stage);
+  ~StageStats();
+
+  void record(int64_t elapsedNs);
+  void drop(unsigned long n = 1);
+  void report();
+
+  /* append this stage's histogram and drop counter lines in the Prometheus text format */
+  void renderMetrics(std::string &histogram, std::string &dropCounter) const;
+
+private:
+  StageStats(const StageStats &);
+  StageStats &operator=(const StageStats &);
+
+  std::string session, stage;
+  std::atomic<unsigned long> count;
+  std::atomic<unsigned long> drops;
+  std::atomic<int64_t> totalNs;
+  std::atomic<int64_t> maxNs;
+
+  /* cumulative, never reset */
+  std::atomic<unsigned long> buckets[bucketCount];
+  std::atomic<unsigned long> allDrops;
+  std::atomic<int64_t> allNs;
+  unsigned long reported[bucketCount];  // bucket counts at the last report(), report thread only
+};
+
+/* every registered stage in the Prometheus text exposition format */
+std::string renderMetrics();
+
+#endif
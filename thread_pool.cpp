@@ -0,0 +1,111 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int workers) : queued(0), nextQueue(0), stopping(false) {
+  if (workers <= 0) {
+    workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < workers; i++) {
+    queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+  }
+  for (int i = 0; i < workers; i++) {
+    threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+int ThreadPool::size() const {
+  return (int)threads.size();
+}
+
+/**
+queue a task on the next worker in round-robin order
+idle workers steal it if that worker is busy
+*/
+void ThreadPool::submit(const Task &task) {
+  WorkQueue &queue = *queues[nextQueue.fetch_add(1) % queues.size()];
+  {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.tasks.push_back(task);
+  }
+  {
+    //count under sleepLock so a worker about to sleep can't miss it
+    std::lock_guard<std::mutex> guard(sleepLock);
+    queued++;
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::run(const std::vector<Task> &tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  std::mutex doneLock;
+  std::condition_variable done;
+  int remaining = (int)tasks.size();
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const Task &task = tasks[i];
+    submit([&, task](int worker) {
+      task(worker);
+      std::lock_guard<std::mutex> guard(doneLock);
+      if (--remaining == 0) {
+        done.notify_one();
+      }
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(doneLock);
+  done.wait(lock, [&]{ return remaining == 0; });
+}
+
+/**
+take a task from the back of our own queue, otherwise steal one from the
+front of another worker's queue
+*/
+bool ThreadPool::popTask(int self, Task &task) {
+  int n = (int)queues.size();
+  for (int i = 0; i < n; i++) {
+    WorkQueue &queue = *queues[(self + i) % n];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    } else {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    queued--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::workerLoop(int self) {
+  for (;;) {
+    Task task;
+    if (popTask(self, task)) {
+      task(self);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepLock);
+    wake.wait(lock, [this]{ return stopping || queued.load() > 0; });
+    if (stopping && queued.load() == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+Fixed-size work-stealing thread pool.
+Every worker owns a task deque: it takes its own work from the back and, when
+that runs dry, steals from the front of the other workers' deques, so uneven
+tasks (e.g. small-scale vs large-scale cascade tiles) still keep all cores busy.
+Tasks get the index of the worker running them, which lets callers keep
+per-worker state such as a CascadeClassifier that must not be shared.
+*/
+class ThreadPool {
+public:
+  typedef std::function<void(int)> Task;
+
+  /* workers <= 0 starts one worker per hardware thread */
+  explicit ThreadPool(int workers = 0);
+  ~ThreadPool();
+
+  int size() const;
+  void submit(const Task &task);
+  /* submit every task and block until all of them have finished */
+  void run(const std::vector<Task> &tasks);
+
+private:
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+
+  bool popTask(int self, Task &task);
+  void workerLoop(int self);
+
+  std::vector<std::unique_ptr<WorkQueue> > queues;
+  std::vector<std::thread> threads;
+  std::mutex sleepLock;
+  std::condition_variable wake;
+  std::atomic<int> queued;
+  std::atomic<unsigned> nextQueue;
+  bool stopping;
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include "tiled_detector.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include "cascade_cache.hpp"
+
+using namespace std;
+using namespace cv;
+
+TiledDetector::TiledDetector(int workers, int tilesX, int tilesY, int scaleBands)
+  : pool(new ThreadPool(workers)), compiledEnabled(true), tilesX(max(1, tilesX)),
+    tilesY(max(1, tilesY)), scaleBands(max(1, scaleBands)) {
+}
+
+const char *facePoseName(int pose) {
+  const char *names[] = {"frontal", "left profile", "right profile"};
+  return pose >= 0 && pose <= POSE_RIGHT_PROFILE ? names[pose] : "unknown";
+}
+
+bool TiledDetector::load(const String &cascadePath) {
+  cascadeFile = cascadePath;
+  cascades.clear();
+  compiled.clear();
+  profiles.clear();
+  poseSets.clear();
+  // a compiled or cached model needs no XML parse; each worker gets its own evaluator
+  unique_ptr<CompiledCascade> model = CompiledCascade::create(cascadePath);
+  for (int i = 0; model && i < pool->size(); i++) {
+    compiled.push_back(model->clone());
+  }
+  return usesCompiled() || loadInterpreted();
+}
+
+bool TiledDetector::loadInterpreted() {
+  // parse the file once and build every worker's classifier from the same tree
+  FileStorage fs(cascadeFile, FileStorage::READ);
+  if (!fs.isOpened()) {
+    return false;
+  }
+  cascades.assign(pool->size(), CascadeClassifier());
+  for (size_t i = 0; i < cascades.size(); i++) {
+    if (!cascades[i].read(fs.getFirstTopLevelNode())) {
+      cascades.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TiledDetector::loadProfile(const String &profilePath) {
+  profiles.clear();
+  poseSets.clear();
+  unique_ptr<CompiledCascade> profile = CompiledCascade::create(profilePath);
+  if (empty() || !profile || profile->windowSize() != windowSize()) {
+    cout << profilePath << " is not a compiled classifier with the frontal window size" << endl;
+    return false;
+  }
+  unique_ptr<CompiledCascade> mirrored = CompiledCascade::create(profilePath, true);
+  profiles.resize(pool->size());
+  poseSets.resize(pool->size());
+  for (size_t i = 0; i < profiles.size(); i++) {
+    profiles[i].add(profile->clone(), POSE_LEFT_PROFILE);
+    profiles[i].add(mirrored->clone(), POSE_RIGHT_PROFILE);
+    if (!compiled.empty()) {
+      poseSets[i].add(compiled[i]->clone(), POSE_FRONTAL);
+      poseSets[i].add(profile->clone(), POSE_LEFT_PROFILE);
+      poseSets[i].add(mirrored->clone(), POSE_RIGHT_PROFILE);
+    }
+  }
+  return true;
+}
+
+bool TiledDetector::hasProfile() const {
+  return !profiles.empty();
+}
+
+bool TiledDetector::empty() const {
+  return compiled.empty() && cascades.empty();
+}
+
+Size TiledDetector::windowSize() const {
+  if (!compiled.empty()) {
+    return compiled[0]->windowSize();
+  }
+  return cascades.empty() ? Size() : cascades[0].getOriginalWindowSize();
+}
+
+void TiledDetector::useCompiled(bool use) {
+  compiledEnabled = use;
+  if (!use && cascades.empty() && !compiled.empty() && !loadInterpreted()) {
+    cout << "error loading " << cascadeFile << ", detecting with the compiled model" << endl;
+    compiledEnabled = true;
+  }
+}
+
+bool TiledDetector::usesCompiled() const {
+  return compiledEnabled && !compiled.empty();
+}
+
+ThreadPool &TiledDetector::threadPool() {
+  return *pool;
+}
+
+void TiledDetector::detectMultiScale(const Mat &gray, vector<Rect> &objects,
+                                     double scaleFactor, int minNeighbors, int flags,
+                                     Size minSize, Size maxSize) {
+  detect(gray, objects, NULL, scaleFactor, minNeighbors, flags, minSize, maxSize);
+}
+
+void TiledDetector::detectPoses(const Mat &gray, vector<Rect> &objects, vector<int> &poses,
+                                double scaleFactor, int minNeighbors, int flags,
+                                Size minSize, Size maxSize) {
+  detect(gray, objects, &poses, scaleFactor, minNeighbors, flags, minSize, maxSize);
+}
+
+/* share of the smaller of two rectangles covered by both */
+static double overlapOfSmaller(const Rect &a, const Rect &b) {
+  int smaller = min(a.area(), b.area());
+  return smaller > 0 ? (double)(a & b).area() / smaller : 0.0;
+}
+
+void TiledDetector::detect(const Mat &gray, vector<Rect> &objects, vector<int> *poses,
+                           double scaleFactor, int minNeighbors, int flags,
+                           Size minSize, Size maxSize) {
+  objects.clear();
+  if (poses) {
+    poses->clear();
+  }
+  if (empty() || gray.empty()) {
+    return;
+  }
+  if (maxSize.width <= 0 || maxSize.height <= 0) {
+    maxSize = gray.size();
+  }
+
+  // Window sizes a single detectMultiScale call would visit, and their cost
+  Size baseWindow = windowSize();
+  vector<Size> windows;
+  vector<double> cost;
+  double totalCost = 0;
+  for (double factor = 1; ; factor *= scaleFactor) {
+    Size window(cvRound(baseWindow.width*factor), cvRound(baseWindow.height*factor));
+    if (window.width > maxSize.width || window.height > maxSize.height ||
+        window.width > gray.cols || window.height > gray.rows) {
+      break;
+    }
+    if (window.width < minSize.width || window.height < minSize.height) {
+      continue;
+    }
+    windows.push_back(window);
+    cost.push_back(1.0 / (factor * factor));
+    totalCost += cost.back();
+  }
+  if (windows.empty()) {
+    return;
+  }
+
+  // Split the pyramid into bands of roughly equal cost, and each band into tiles
+  struct Job {
+    Rect tile;   // region scanned
+    Rect cell;   // hits must start here
+    Size minWindow, maxWindow;
+  };
+  vector<Job> jobs;
+  size_t first = 0;
+  double bandCost = 0;
+  for (size_t i = 0; i < windows.size(); i++) {
+    bandCost += cost[i];
+    bool lastInBand = i + 1 == windows.size() || bandCost >= totalCost / scaleBands;
+    if (!lastInBand) {
+      continue;
+    }
+    Size maxWindow = windows[i];
+    //keep tiles at least twice the largest window of the band
+    int nx = max(1, min(tilesX, gray.cols / (2 * maxWindow.width)));
+    int ny = max(1, min(tilesY, gray.rows / (2 * maxWindow.height)));
+    for (int ty = 0; ty < ny; ty++) {
+      for (int tx = 0; tx < nx; tx++) {
+        int x0 = tx * gray.cols / nx, x1 = (tx + 1) * gray.cols / nx;
+        int y0 = ty * gray.rows / ny, y1 = (ty + 1) * gray.rows / ny;
+        Job job;
+        job.cell = Rect(x0, y0, x1 - x0, y1 - y0);
+        job.tile = Rect(x0, y0, x1 - x0 + maxWindow.width, y1 - y0 + maxWindow.height) &
+                   Rect(0, 0, gray.cols, gray.rows);
+        job.minWindow = windows[first];
+        job.maxWindow = maxWindow;
+        jobs.push_back(job);
+      }
+    }
+    first = i + 1;
+    bandCost = 0;
+  }
+
+  // Run the tasks, each writing raw (ungrouped) hits, and their poses, into its own slot
+  vector<vector<Rect> > hits(jobs.size());
+  vector<vector<int> > hitPoses(jobs.size());
+  vector<ThreadPool::Task> tasks;
+  bool useCompiled = usesCompiled();
+  bool withPoses = poses && hasProfile();
+  for (size_t j = 0; j < jobs.size(); j++) {
+    tasks.push_back([&, j](int worker) {
+      const Job &job = jobs[j];
+      Mat tile = gray(job.tile);
+      vector<Rect> found;
+      vector<int> tags;
+      if (withPoses && useCompiled) {
+        // frontal and both profiles over one pyramid
+        poseSets[worker].detectMultiScale(tile, found, tags, scaleFactor, job.minWindow, job.maxWindow);
+      } else {
+        if (useCompiled) {
+          compiled[worker]->detectMultiScale(tile, found, scaleFactor, job.minWindow, job.maxWindow);
+        } else {
+          cascades[worker].detectMultiScale(tile, found, scaleFactor, 0, flags,
+                                            job.minWindow, job.maxWindow);
+        }
+        tags.assign(found.size(), POSE_FRONTAL);
+        if (withPoses) {
+          vector<Rect> profileFound;
+          vector<int> profileTags;
+          profiles[worker].detectMultiScale(tile, profileFound, profileTags, scaleFactor,
+                                            job.minWindow, job.maxWindow);
+          found.insert(found.end(), profileFound.begin(), profileFound.end());
+          tags.insert(tags.end(), profileTags.begin(), profileTags.end());
+        }
+      }
+      for (size_t k = 0; k < found.size(); k++) {
+        Rect hit = found[k] + job.tile.tl();
+        if (job.cell.contains(hit.tl())) {
+          hits[j].push_back(hit);
+          hitPoses[j].push_back(tags[k]);
+        }
+      }
+    });
+  }
+  pool->run(tasks);
+
+  if (!withPoses) {
+    for (size_t j = 0; j < hits.size(); j++) {
+      objects.insert(objects.end(), hits[j].begin(), hits[j].end());
+    }
+    // same grouping CascadeClassifier::detectMultiScale applies to its raw hits
+    groupRectangles(objects, minNeighbors, 0.2);
+    if (poses) {
+      poses->assign(objects.size(), POSE_FRONTAL);
+    }
+    return;
+  }
+
+  // Group each pose's hits on its own, then let the best supported pose win where they overlap
+  struct Candidate {
+    Rect rect;
+    int pose, weight;
+  };
+  vector<Candidate> candidates;
+  for (int pose = POSE_FRONTAL; pose <= POSE_RIGHT_PROFILE; pose++) {
+    vector<Rect> rects;
+    for (size_t j = 0; j < hits.size(); j++) {
+      for (size_t k = 0; k < hits[j].size(); k++) {
+        if (hitPoses[j][k] == pose) {
+          rects.push_back(hits[j][k]);
+        }
+      }
+    }
+    vector<int> weights;
+    groupRectangles(rects, weights, minNeighbors, 0.2);
+    for (size_t i = 0; i < rects.size(); i++) {
+      Candidate candidate = {rects[i], pose, weights[i]};
+      candidates.push_back(candidate);
+    }
+  }
+  stable_sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+    return a.weight > b.weight;
+  });
+  for (size_t i = 0; i < candidates.size(); i++) {
+    bool covered = false;
+    for (size_t k = 0; k < objects.size() && !covered; k++) {
+      covered = overlapOfSmaller(candidates[i].rect, objects[k]) > 0.5;
+    }
+    if (!covered) {
+      objects.push_back(candidates[i].rect);
+      poses->push_back(candidates[i].pose);
+    }
+  }
+}
+
+double rectIoU(const Rect &a, const Rect &b) {
+  int unionArea = a.area() + b.area() - (a & b).area();
+  return unionArea > 0 ? (double)(a & b).area() / unionArea : 0.0;
+}
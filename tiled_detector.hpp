@@ -0,0 +1,91 @@
+#ifndef TILED_DETECTOR_HPP
+#define TILED_DETECTOR_HPP
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <vector>
+#include "thread_pool.hpp"
+#include "compiled_cascade.hpp"
+
+/* which model found a face */
+enum FacePose {
+  POSE_FRONTAL = 0,         // the frontal classifier
+  POSE_LEFT_PROFILE = 1,    // the profile classifier as trained
+  POSE_RIGHT_PROFILE = 2    // the profile classifier mirrored
+};
+
+const char *facePoseName(int pose);
+
+/**
+Cascade detection spread over a worker pool.
+The scale pyramid is split into bands and, within each band, the frame into
+overlapping tiles; every (band, tile) pair is one task. Tiles overlap by the
+largest window of their band and only keep hits that start inside their own
+cell, so each window position is evaluated once. The raw hits of all tasks are
+then grouped with the same groupRectangles step CascadeClassifier applies
+internally, so results match a single detectMultiScale call up to the
+sub-pixel shift of the window lattice at tile borders.
+Classifiers compiled into the program or into a cascade cache
+(compiled_cascade.hpp) are evaluated by their compiled model, which finds the
+same raw hits faster.
+With a profile classifier loaded, detectPoses() also finds faces turned to
+either side: every tile is resized and integrated once per pyramid level and
+scanned by the frontal, profile and mirrored profile models in turn.
+*/
+class TiledDetector {
+public:
+  /* workers <= 0 uses one worker per core */
+  TiledDetector(int workers = 0, int tilesX = 4, int tilesY = 2, int scaleBands = 3);
+
+  /* loads one classifier per worker; CascadeClassifier is not thread safe
+     a compiled model, or the one in a cascade cache that matches (cascade_cache.hpp),
+     is used without parsing the XML at all */
+  bool load(const cv::String &cascadePath);
+  bool empty() const;
+  /* the classifier's window, the smallest face it can find */
+  cv::Size windowSize() const;
+  /*
+  profile classifier for detectPoses(); it must be compiled into the program
+  and share the frontal classifier's window size
+  */
+  bool loadProfile(const cv::String &profilePath);
+  bool hasProfile() const;
+  /* evaluate with the compiled model when the classifier has one (default);
+     false parses the XML for CascadeClassifier if load() didn't need to */
+  void useCompiled(bool use);
+  bool usesCompiled() const;
+
+  /* same contract as CascadeClassifier::detectMultiScale */
+  void detectMultiScale(const cv::Mat &gray, std::vector<cv::Rect> &objects,
+                        double scaleFactor = 1.1, int minNeighbors = 3, int flags = 0,
+                        cv::Size minSize = cv::Size(), cv::Size maxSize = cv::Size());
+  /**
+  frontal and, with a profile classifier, profile faces facing either way;
+  hits are grouped per pose, then of overlapping faces of different poses only
+  the one with the most neighbors is kept; poses[i] is the FacePose of objects[i]
+  */
+  void detectPoses(const cv::Mat &gray, std::vector<cv::Rect> &objects, std::vector<int> &poses,
+                   double scaleFactor = 1.1, int minNeighbors = 3, int flags = 0,
+                   cv::Size minSize = cv::Size(), cv::Size maxSize = cv::Size());
+
+  ThreadPool &threadPool();
+
+private:
+  bool loadInterpreted();
+  void detect(const cv::Mat &gray, std::vector<cv::Rect> &objects, std::vector<int> *poses,
+              double scaleFactor, int minNeighbors, int flags, cv::Size minSize, cv::Size maxSize);
+
+  std::unique_ptr<ThreadPool> pool;
+  cv::String cascadeFile;
+  std::vector<cv::CascadeClassifier> cascades;  // one per worker, only parsed when needed
+  std::vector<std::unique_ptr<CompiledCascade> > compiled; // one per worker, empty if none matches
+  std::vector<CompiledCascadeSet> profiles;   // per worker: profile and mirrored profile
+  std::vector<CompiledCascadeSet> poseSets;   // per worker: frontal, profile and mirrored profile
+  bool compiledEnabled;
+  int tilesX, tilesY, scaleBands;
+};
+
+/* intersection over union of two rectangles */
+double rectIoU(const cv::Rect &a, const cv::Rect &b);
+
+#endif
@@ -0,0 +1,246 @@
+#include "track_table.hpp"
+#include "tiled_detector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+using namespace cv;
+
+const double gatedCost = 1e3;   // pairs outside the gate, and padding
+
+TrackTableParams::TrackTableParams()
+  : metric(ASSOCIATE_IOU), minIoU(0.2), maxCenterDistance(0.5), maxMisses(5) {
+}
+
+TrackTable::TrackTable(const TrackTableParams &params, size_t maxTracks)
+  : params(params), maxTracks(maxTracks), nextId(1) {
+  size_t n = maxTracks + 1;
+  table.reserve(maxTracks);
+  costs.reserve(n * n);
+  u.reserve(n);
+  v.reserve(n);
+  minv.reserve(n);
+  p.reserve(n);
+  way.reserve(n);
+  used.reserve(n);
+}
+
+static Point2d center(const Rect &r) {
+  return Point2d(r.x + r.width/2.0, r.y + r.height/2.0);
+}
+
+double TrackTable::cost(const Rect &track, const Rect &detection) const {
+  if (params.metric == ASSOCIATE_IOU) {
+    double iou = rectIoU(track, detection);
+    return iou >= params.minIoU ? 1 - iou : gatedCost;
+  }
+  Point2d d = center(track) - center(detection);
+  double distance = sqrt(d.dot(d)) / max(track.width, 1);
+  return distance <= params.maxCenterDistance ? distance : gatedCost;
+}
+
+/**
+minimum cost assignment on the square n x n matrix in costs (1-based, row
+i at costs[i*(n+1)]), O(n^3) shortest augmenting paths with potentials
+afterwards p[j] is the row assigned to column j
+*/
+void TrackTable::assign(size_t rows, size_t cols) {
+  size_t n = max(rows, cols);
+  const double inf = numeric_limits<double>::infinity();
+  u.assign(n + 1, 0);
+  v.assign(n + 1, 0);
+  p.assign(n + 1, 0);
+  way.assign(n + 1, 0);
+  for (size_t i = 1; i <= n; i++) {
+    p[0] = i;
+    size_t j0 = 0;
+    minv.assign(n + 1, inf);
+    used.assign(n + 1, 0);
+    do {
+      used[j0] = 1;
+      size_t i0 = p[j0], j1 = 0;
+      double delta = inf;
+      for (size_t j = 1; j <= n; j++) {
+        if (used[j]) {
+          continue;
+        }
+        double cur = costs[i0*(n + 1) + j] - u[i0] - v[j];
+        if (cur < minv[j]) {
+          minv[j] = cur;
+          way[j] = j0;
+        }
+        if (minv[j] < delta) {
+          delta = minv[j];
+          j1 = j;
+        }
+      }
+      for (size_t j = 0; j <= n; j++) {
+        if (used[j]) {
+          u[p[j]] += delta;
+          v[j] -= delta;
+        } else {
+          minv[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (p[j0] != 0);
+    do {
+      size_t j1 = way[j0];
+      p[j0] = p[j1];
+      j0 = j1;
+    } while (j0);
+  }
+}
+
+void TrackTable::update(const vector<Rect> &detections, const Rect &searched) {
+  size_t rows = table.size(), cols = detections.size();
+  for (size_t t = 0; t < rows; t++) {
+    table[t].detection = -1;
+  }
+
+  if (rows > 0 && cols > 0) {
+    size_t n = max(rows, cols);
+    costs.assign((n + 1) * (n + 1), gatedCost);
+    for (size_t t = 0; t < rows; t++) {
+      for (size_t d = 0; d < cols; d++) {
+        costs[(t + 1)*(n + 1) + d + 1] = cost(table[t].box, detections[d]);
+      }
+    }
+    assign(rows, cols);
+    for (size_t j = 1; j <= cols; j++) {
+      size_t t = p[j] - 1;
+      if (p[j] != 0 && t < rows && costs[p[j]*(n + 1) + j] < gatedCost) {
+        table[t].detection = j - 1;
+      }
+    }
+  }
+
+  // matched tracks move, unmatched ones age if they were looked for
+  vector<char> &taken = used; //free again after assign()
+  taken.assign(cols, 0);
+  size_t kept = 0;
+  for (size_t t = 0; t < rows; t++) {
+    FaceTrack &track = table[t];
+    if (track.detection >= 0) {
+      track.box = detections[track.detection];
+      track.hits++;
+      track.misses = 0;
+      taken[track.detection] = 1;
+    } else if (searched.contains(center(track.box))) {
+      track.misses++;
+    }
+    if (track.misses <= params.maxMisses) {
+      table[kept++] = track;
+    }
+  }
+  table.resize(kept);
+
+  for (size_t d = 0; d < cols && table.size() < maxTracks; d++) {
+    if (!taken[d]) {
+      FaceTrack track;
+      track.id = nextId++;
+      track.box = detections[d];
+      track.hits = 1;
+      track.misses = 0;
+      track.detection = d;
+      table.push_back(track);
+    }
+  }
+}
+
+void TrackTable::follow(int id, const Rect &box) {
+  for (size_t t = 0; t < table.size(); t++) {
+    if (table[t].id == id) {
+      table[t].box = box;
+    }
+  }
+}
+
+void TrackTable::clear() {
+  table.clear();
+}
+
+const vector<FaceTrack> &TrackTable::tracks() const {
+  return table;
+}
+
+const FaceTrack *TrackTable::find(int id) const {
+  for (size_t t = 0; t < table.size(); t++) {
+    if (table[t].id == id) {
+      return &table[t];
+    }
+  }
+  return NULL;
+}
+
+int TrackTable::nearest(Point p) const {
+  int best = -1;
+  double bestDistance = 0;
+  for (size_t t = 0; t < table.size(); t++) {
+    if (table[t].detection < 0) {
+      continue;
+    }
+    Point2d d = center(table[t].box) - Point2d(p);
+    double distance = d.dot(d);
+    if (best < 0 || distance < bestDistance) {
+      best = table[t].id;
+      bestDistance = distance;
+    }
+  }
+  return best;
+}
+
+/*
+index of the visible track with the highest score, -1 if none is visible
+one linear scan, no sorting
+*/
+template <typename Score>
+static int bestTrack(const vector<FaceTrack> &tracks, Score score) {
+  int best = -1;
+  double bestScore = 0;
+  for (size_t t = 0; t < tracks.size(); t++) {
+    if (tracks[t].detection < 0) {
+      continue;
+    }
+    double s = score(tracks[t].box);
+    if (best < 0 || s > bestScore) {
+      best = t;
+      bestScore = s;
+    }
+  }
+  return best;
+}
+
+int BiggestTarget::select(const vector<FaceTrack> &tracks, const Rect &, Size) const {
+  return bestTrack(tracks, [](const Rect &box) { return (double)box.area(); });
+}
+
+int PeripheralTarget::select(const vector<FaceTrack> &tracks, const Rect &, Size frameSize) const {
+  double middle = frameSize.width / 2.0;
+  return bestTrack(tracks, [middle](const Rect &box) { return fabs(center(box).x - middle); });
+}
+
+int NearestTarget::select(const vector<FaceTrack> &tracks, const Rect &lastTarget,
+                          Size frameSize) const {
+  if (lastTarget.area() == 0) {
+    return PeripheralTarget().select(tracks, lastTarget, frameSize);
+  }
+  Point2d last = center(lastTarget);
+  return bestTrack(tracks, [last](const Rect &box) {
+    Point2d d = center(box) - last;
+    return -d.dot(d);
+  });
+}
+
+shared_ptr<TargetPolicy> targetPolicyByName(const string &name) {
+  if (name == "biggest") {
+    return make_shared<BiggestTarget>();
+  } else if (name == "peripheral") {
+    return make_shared<PeripheralTarget>();
+  } else if (name == "nearest") {
+    return make_shared<NearestTarget>();
+  }
+  return shared_ptr<TargetPolicy>();
+}
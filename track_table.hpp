@@ -0,0 +1,117 @@
+#ifndef TRACK_TABLE_HPP
+#define TRACK_TABLE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* one face followed across frames */
+struct FaceTrack {
+  int id;           // stable for the life of the track
+  cv::Rect box;     // last matched (or followed) position
+  int hits;         // detections matched so far
+  int misses;       // searched frames since the last match
+  int detection;    // index of the detection matched this frame, -1 if none
+};
+
+enum AssociationMetric {
+  ASSOCIATE_IOU,      // cost 1 - IoU, gated by minIoU
+  ASSOCIATE_CENTER    // center distance in track widths, gated by maxCenterDistance
+};
+
+struct TrackTableParams {
+  TrackTableParams();
+
+  AssociationMetric metric;
+  double minIoU;
+  double maxCenterDistance;
+  int maxMisses;            // searched frames a track survives unmatched
+};
+
+/**
+Table of every face in view, with IDs that stay put from frame to frame.
+update() matches the detections of a frame to the tracks by an optimal
+(Hungarian) assignment over the gated cost, opens a track for every
+unmatched detection and ages the unmatched tracks. A track is only aged when
+its center lay in the region that was searched, so an ROI search around one
+face doesn't wear out the others. Storage is reserved for maxTracks faces;
+beyond that new faces are not tracked.
+*/
+class TrackTable {
+public:
+  explicit TrackTable(const TrackTableParams &params = TrackTableParams(), size_t maxTracks = 64);
+
+  void update(const std::vector<cv::Rect> &detections, const cv::Rect &searched);
+  /* move a track to a position found by other means, e.g. template tracking */
+  void follow(int id, const cv::Rect &box);
+  void clear();
+
+  const std::vector<FaceTrack> &tracks() const;
+  /* the track with this id, NULL once it has been dropped */
+  const FaceTrack *find(int id) const;
+  /* id of the track matched this frame whose center is closest to p, -1 if none */
+  int nearest(cv::Point p) const;
+
+private:
+  double cost(const cv::Rect &track, const cv::Rect &detection) const;
+  void assign(size_t rows, size_t cols);
+
+  TrackTableParams params;
+  size_t maxTracks;
+  std::vector<FaceTrack> table;
+  int nextId;
+
+  /* assignment scratch, reserved once */
+  std::vector<double> costs, u, v, minv;
+  std::vector<int> p, way;
+  std::vector<char> used;
+};
+
+/**
+Picks which track drives the actuator. Only asked when there is no target
+yet or the target's track was dropped; as long as the target is in the table
+it stays the target, so a face walking past can't take over.
+Policies are stateless and may be shared between sessions.
+*/
+class TargetPolicy {
+public:
+  virtual ~TargetPolicy() {}
+  /*
+  index into tracks of the new target, -1 for none
+  lastTarget is where the previous target was last seen, empty if there was none
+  */
+  virtual int select(const std::vector<FaceTrack> &tracks, const cv::Rect &lastTarget,
+                     cv::Size frameSize) const = 0;
+  /* what targetPolicyByName() knows it as, empty if it doesn't */
+  virtual std::string name() const { return std::string(); }
+};
+
+/* largest face in view */
+class BiggestTarget : public TargetPolicy {
+public:
+  int select(const std::vector<FaceTrack> &tracks, const cv::Rect &lastTarget,
+             cv::Size frameSize) const;
+  std::string name() const { return "biggest"; }
+};
+
+/* face furthest from the vertical center line */
+class PeripheralTarget : public TargetPolicy {
+public:
+  int select(const std::vector<FaceTrack> &tracks, const cv::Rect &lastTarget,
+             cv::Size frameSize) const;
+  std::string name() const { return "peripheral"; }
+};
+
+/* face nearest to where the last target was, the most peripheral one at first */
+class NearestTarget : public TargetPolicy {
+public:
+  int select(const std::vector<FaceTrack> &tracks, const cv::Rect &lastTarget,
+             cv::Size frameSize) const;
+  std::string name() const { return "nearest"; }
+};
+
+/* "biggest", "peripheral" or "nearest"; NULL for anything else */
+std::shared_ptr<TargetPolicy> targetPolicyByName(const std::string &name);
+
+#endif
@@ -0,0 +1,770 @@
+#include "tracking_session.hpp"
+#include "gray_equalize.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdio.h>
+
+using namespace std;
+using namespace cv;
+
+const size_t queueDepth = 2;        // frames buffered between stages
+const size_t commandDepth = 64;     // UI commands queued between frames
+const int pointFaceSide = 100;      // size of the face drawn around a clicked or locked point
+
+const char *const targetPolicyNames[targetPolicyCount] = {"nearest", "biggest", "peripheral"};
+//capture buffers: both queues, the frame in detection, and the display's copy
+const size_t framePoolSize = 2 * queueDepth + 4;
+
+TrackerParams::TrackerParams()
+  : minNeighbors(2), minFaceSize(30, 30), verifyFaces(false), multiPose(false),
+    roiTracking(true), fullScanInterval(15), roiExpand(1.0), roiSizeMargin(0.3),
+    hybridTracking(true), detectInterval(5), minTrackConfidence(0.6),
+    processNoise(5000.0), measurementNoise(16.0), maxCoast(0.5) {
+}
+
+SessionConfig::SessionConfig()
+  : name("cam0"), camera(0), directCapture(true), captureSize(1920, 1080), scale(2.0),
+    calibration(CameraCalibration::pinhole(1517.6023, 959.5, 539.5)),
+    baud(9600), display(false), logFrames(false), recordQuality(0) {
+}
+
+TrackingSession::TrackingSession(const SessionConfig &config, TiledDetector &detector,
+                                 FaceVerifier *verifier)
+  : cfg(config), detector(detector), verifier(verifier), mbed(config.name, config.link), running(false),
+    detectQueue(queueDepth), actuateQueue(queueDepth), displayQueue(queueDepth),
+    priorFace(0, 0, 0, 0), priorPose(POSE_FRONTAL), faceTracks(config.tracker.tracks), targetId(-1),
+    targetPolicy(config.tracker.targetPolicy ? config.tracker.targetPolicy
+                                             : make_shared<NearestTarget>()),
+    commands(commandDepth), trackRequested(false), lockActive(false),
+    framesSinceFullScan(0), framesSinceDetection(0),
+    detectControl(config.tracker.detection, config.tracker.minFaceSize,
+                  detector.empty() ? Size(24, 24) : detector.windowSize()),
+    activity(config.tracker.activity), sceneCache(config.tracker.sceneCache), cachedFound(false),
+    faceTracker(0.5, 32),
+    faceFilter(config.tracker.processNoise, config.tracker.measurementNoise, config.tracker.maxCoast),
+    captureStats(config.name, "capture"), resizeStats(config.name, "resize"),
+    detectStats(config.name, "detect"), sceneStats(config.name, "scene"), activityStats(config.name, "activity"),
+    grayStats(config.name, "gray"),
+    cascadeStats(config.name, "cascade"), verifyStats(config.name, "verify"),
+    selectStats(config.name, "select"),
+    trackStats(config.name, "track"), actuateStats(config.name, "actuate"),
+    latencyStats(config.name, "end-to-end"), detectDrops(0), actuateDrops(0) {
+}
+
+TrackingSession::~TrackingSession() {
+  stop();
+}
+
+bool TrackingSession::open() {
+  if (!camera.open(cfg.camera, cfg.device, cfg.captureSize, cfg.directCapture)) {
+    cout << cfg.name << ": could not open camera " << cfg.camera << endl;
+    return false;
+  }
+  //initialize frame dimensions
+  Size cameraSize = camera.size();
+  displaySize.width = cvRound(cameraSize.width/cfg.scale);
+  displaySize.height = cvRound(cameraSize.height/cfg.scale);
+  cout << cfg.name << ": " << cameraSize.width << "x" << cameraSize.height
+       << " through " << camera.backend() << endl;
+  angleTable.build(cfg.calibration, displaySize, cfg.scale);
+
+  if (!cfg.port.empty() && !mbed.open(cfg.port, cfg.baud)) {
+    return false;
+  }
+  if (!cfg.recordPath.empty()) {
+    FileStorage fs("config.yml", FileStorage::WRITE | FileStorage::MEMORY | FileStorage::FORMAT_YAML);
+    fs << "session";
+    writeSessionConfig(fs, cfg);
+    if (!recorder.open(cfg.recordPath, fs.releaseAndGetString(), cfg.recordQuality)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TrackingSession::start() {
+  running = true;
+  mbed.start();
+  captureThread = thread(&TrackingSession::captureLoop, this);
+  actuateThread = thread(&TrackingSession::actuateLoop, this);
+}
+
+void TrackingSession::stop() {
+  running = false;
+  if (captureThread.joinable()) {
+    captureThread.join();
+  }
+  if (actuateThread.joinable()) {
+    actuateThread.join();
+  }
+  mbed.stop();
+  recorder.close(); //the scheduler must no longer process this session
+}
+
+bool TrackingSession::isRunning() const {
+  return running;
+}
+
+const SessionConfig &TrackingSession::config() const {
+  return cfg;
+}
+
+Size TrackingSession::frameSize() const {
+  return displaySize;
+}
+
+Rect TrackingSession::face() const {
+  return priorFace;
+}
+
+/**
+capture stage: read and downscale frames as fast as the camera delivers them,
+straight from the driver's buffer where CameraCapture can
+if detection falls behind, the oldest queued frame is dropped
+every frame also ticks the actuator, which runs at camera rate
+*/
+void TrackingSession::captureLoop() {
+  unsigned long seq = 0;
+  FramePool pool(framePoolSize); //only downscaled frames leave this thread
+  while (running) {
+    int64_t start = nowNs();
+    if (!camera.grab()) {
+      break;
+    }
+    CapturedFrame captured;
+    captured.frame = pool.next();
+    int64_t resizeStart = nowNs();
+    if (!camera.retrieve(captured.frame, displaySize)) {
+      break;
+    }
+    captured.seq = seq++;
+    captured.captureNs = start;
+    int64_t end = nowNs();
+    resizeStats.record(end - resizeStart);
+    captureStats.record(end - start);
+    detectQueue.push(captured);
+
+    FrameTick tick;
+    tick.seq = captured.seq;
+    tick.captureNs = captured.captureNs;
+    actuateQueue.push(tick);
+  }
+  running = false;
+}
+
+/**
+detection stage: find faces in the newest frame and feed the selected face
+to the motion filter, stamped with the frame's capture time
+*/
+bool TrackingSession::detectNext() {
+  CapturedFrame captured;
+  if (!detectQueue.popLatest(captured)) {
+    return false;
+  }
+  process(captured.frame, captured.captureNs, captured.seq, current);
+  if (cfg.display) {
+    displayQueue.push(current);
+  }
+  return true;
+}
+
+TrackResult TrackingSession::process(const Mat &frame, int64_t captureNs, unsigned long seq) {
+  TrackResult result;
+  process(frame, captureNs, seq, result);
+  return result;
+}
+
+void TrackingSession::process(const Mat &frame, int64_t captureNs, unsigned long seq,
+                              TrackResult &result) {
+  int64_t start = nowNs();
+  bool clicked = applyCommands(); //the one point UI commands touch tracker state
+  if (!cfg.recordPath.empty()) {
+    recorder.write(seq, captureNs, detectControl.pressure(), frameClicks, frame);
+  }
+  // Apply the classifier to the frame, i.e. find face
+  bool found = detectFace(frame);
+  {
+    lock_guard<mutex> guard(filterLock);
+    if (angleTable.size() != frame.size()) { //offline use skips open()
+      angleTable.build(cfg.calibration, frame.size(), cfg.scale);
+    }
+    if (found && clicked) {
+      faceFilter.reset(priorFace, captureNs / 1e9); //jump, don't smooth
+    } else if (found) {
+      faceFilter.correct(priorFace, captureNs / 1e9);
+    }
+    result.tracking = faceFilter.initialized();
+    Rect2d filtered = faceFilter.predict(captureNs / 1e9);
+    Point2f angles = result.tracking ? viewAngles(filtered) : Point2f(0, 0);
+    result.angled = angles.x;
+    result.tiltd = angles.y;
+  }
+  result.face = priorFace;
+  result.targetId = targetId;
+  result.pose = priorPose;
+  result.faceCenter.x = priorFace.x + priorFace.width/2;
+  result.faceCenter.y = priorFace.y + priorFace.height/2;
+  result.faces.assign(ctx.faces.begin(), ctx.faces.end());
+  result.poses.assign(ctx.poses.begin(), ctx.poses.end());
+  result.frame = frame;
+  result.seq = seq;
+  result.captureNs = captureNs;
+  ctx.faces.clear();
+  ctx.poses.clear();
+  if (framesSinceDetection > 0) {
+    trackStats.record(nowNs() - start);
+  } else {
+    detectStats.record(nowNs() - start);
+  }
+}
+
+Point2f TrackingSession::viewAngles(const Rect2d &face) const {
+  return angleTable.angles(face.x + face.width/2, face.y + face.height/2);
+}
+
+/**
+actuator stage: for the freshest frame, predict where the face is at its
+capture time and hand that angle to the serial writer, so the mbed gets a
+smooth update every frame even while the detector runs at a lower rate
+*/
+void TrackingSession::actuateLoop() {
+  FrameTick tick;
+  while (actuateQueue.waitPop(tick, running, true)) {
+    int64_t start = nowNs();
+    Rect2d face;
+    Point2f angles;
+    {
+      lock_guard<mutex> guard(filterLock);
+      if (!faceFilter.initialized()) {
+        continue; //no face seen yet
+      }
+      face = faceFilter.predict(tick.captureNs / 1e9);
+      angles = viewAngles(face);
+    }
+    if (mbed.isOpen()) {
+      mbed.submit(angles.x); //never waits on the port; the mbed only pans
+    }
+
+    if (cfg.logFrames) { //blocking console I/O, off unless asked for
+      printf("%s faceX: %.1f, faceY: %.1f, pan: %.2f, tilt: %.2f\n", cfg.name.c_str(),
+             face.x + face.width/2, face.y + face.height/2, angles.x, angles.y);
+    }
+    int64_t end = nowNs();
+    actuateStats.record(end - start);
+    latencyStats.record(end - tick.captureNs);
+  }
+}
+
+bool TrackingSession::command(const SessionCommand &command) {
+  return commands.push(command);
+}
+
+/**
+  set priorFace to face closest to mouse click (left),
+  lock onto the clicked point (right) or release the lock (middle)
+*/
+void TrackingSession::click(int event, int x, int y) {
+  SessionCommand cmd = {0, x, y};
+  if (event == EVENT_LBUTTONDOWN) {
+    cmd.type = COMMAND_TRACK_FACE_AT;
+  } else if (event == EVENT_RBUTTONDOWN) {
+    cmd.type = COMMAND_LOCK_POINT;
+  } else if (event == EVENT_MBUTTONDOWN) {
+    cmd.type = COMMAND_RELEASE;
+  } else {
+    return;
+  }
+  if (!command(cmd)) {
+    cout << cfg.name << ": too many commands queued, click dropped" << endl;
+  }
+}
+
+bool TrackingSession::setTargetPolicy(const string &name) {
+  for (int i = 0; i < targetPolicyCount; i++) {
+    if (name == targetPolicyNames[i]) {
+      SessionCommand cmd = {COMMAND_SET_POLICY, i, 0};
+      return command(cmd);
+    }
+  }
+  return false;
+}
+
+bool TrackingSession::locked() const {
+  return lockActive;
+}
+
+/**
+apply the queued commands in order, listing them in frameClicks for the
+recorder; true if one of them moved priorFace, so the motion filter jumps
+instead of smoothing
+*/
+bool TrackingSession::applyCommands() {
+  frameClicks.clear();
+  bool moved = false;
+  SessionCommand cmd;
+  while (commands.pop(cmd)) {
+    sceneCache.invalidate(); //the cached result predates the command
+    RecordedClick recorded = {cmd.type, cmd.x, cmd.y};
+    frameClicks.push_back(recorded);
+    switch (cmd.type) {
+    case COMMAND_TRACK_FACE_AT: // resolved against this frame's detections
+      lockActive = false;
+      trackRequested = true;
+      trackPoint = Point(cmd.x, cmd.y);
+      moved = true;
+      break;
+    case COMMAND_LOCK_POINT:
+      lockActive = true;
+      trackRequested = false;
+      lockPoint = Point(cmd.x, cmd.y);
+      priorFace = Rect(cmd.x - pointFaceSide/2, cmd.y - pointFaceSide/2, pointFaceSide, pointFaceSide);
+      priorPose = POSE_FRONTAL;
+      targetId = -1;
+      faceTracker.reset();
+      moved = true;
+      break;
+    case COMMAND_RELEASE:
+      if (lockActive) { //the policy picks the face nearest the lock point
+        lockActive = false;
+        targetId = -1;
+      }
+      break;
+    case COMMAND_SET_POLICY:
+      if (cmd.x >= 0 && cmd.x < targetPolicyCount) {
+        targetPolicy = targetPolicyByName(targetPolicyNames[cmd.x]);
+      }
+      break;
+    }
+  }
+  return moved;
+}
+
+void TrackingSession::setDetectionPressure(double pressure) {
+  detectControl.setPressure(pressure);
+}
+
+bool TrackingSession::latestResult(TrackResult &result) {
+  return displayQueue.popLatest(result);
+}
+
+void TrackingSession::reportStats() {
+  captureStats.drop(detectQueue.dropCount() - detectDrops);
+  actuateStats.drop(actuateQueue.dropCount() - actuateDrops);
+  detectDrops = detectQueue.dropCount();
+  actuateDrops = actuateQueue.dropCount();
+  captureStats.report();
+  resizeStats.report();
+  detectStats.report();
+  sceneStats.report();
+  activityStats.report();
+  grayStats.report();
+  cascadeStats.report();
+  verifyStats.report();
+  selectStats.report();
+  trackStats.report();
+  actuateStats.report();
+  latencyStats.report();
+  if (mbed.isOpen()) {
+    mbed.reportStats();
+  }
+}
+
+/**
+window searched in ROI tracking mode: priorFace padded by roiExpand face
+sizes on every side, clipped to the frame
+*/
+Rect TrackingSession::searchWindow(Rect face, Size frameSize) const {
+  int padX = cvRound(face.width * cfg.tracker.roiExpand);
+  int padY = cvRound(face.height * cfg.tracker.roiExpand);
+  Rect window(face.x - padX, face.y - padY, face.width + 2*padX, face.height + 2*padY);
+  return window & Rect(Point(0, 0), frameSize);
+}
+
+/**
+Detect faces, update the track table and set priorFace to the target.
+The target is the track picked by targetPolicy (by default the most
+peripheral face at first, later the face nearest the lost target) and stays
+the target for as long as its track lives, even when other faces come closer.
+While the target's track is not matched, priorFace keeps its old value.
+Returns true if priorFace was set this frame, from a detection or a command.
+While a lock-point command holds, priorFace stays on the point and nothing
+is detected. With sceneCache, a frame that looks like the one the last result
+came from gets that result again, without a search, until maxAge frames
+passed or a command arrives.
+With roiTracking, only the window around priorFace is searched, at the last
+face scale +- roiSizeMargin. detectControl picks the resolution and pyramid
+step of every pass, and activity the parts of the searched region that are
+worth a pass. The whole frame is rescanned every
+fullScanInterval frames, after a click, or when the window search finds nothing.
+With hybridTracking, the cascade only runs every detectInterval frames or
+when the template tracker's confidence drops below minTrackConfidence; in
+between, priorFace follows the template tracker.
+*/
+bool TrackingSession::detectFace(const Mat &frame) {
+
+  vector<Rect> &faces = ctx.faces;
+  vector<int> &poses = ctx.poses;
+
+  if (lockActive) { //held on a point: nothing to detect
+    faces.clear();
+    poses.clear();
+    return true;
+  }
+  if (sceneCache.enabled()) {
+    int64_t sceneStart = nowNs();
+    bool unchanged = sceneCache.matches(frame);
+    sceneStats.record(nowNs() - sceneStart);
+    if (unchanged) {
+      faces.assign(cachedFaces.begin(), cachedFaces.end());
+      poses.assign(cachedPoses.begin(), cachedPoses.end());
+      framesSinceDetection++; //counted as a tracked frame
+      return cachedFound;
+    }
+  }
+  bool found = searchFaces(frame);
+  //every pass of the frame was planned at the pressure it started with, the one recordings store
+  for (size_t i = 0; i < passTimes.size(); i++) {
+    detectControl.record(passTimes[i]);
+  }
+  passTimes.clear();
+  if (sceneCache.enabled()) {
+    cachedFaces.assign(faces.begin(), faces.end());
+    cachedPoses.assign(poses.begin(), poses.end());
+    cachedFound = found;
+    sceneCache.store();
+  }
+  return found;
+}
+
+/**
+detectFace() without the lock and the scene cache: track or detect, and
+select the target
+*/
+bool TrackingSession::searchFaces(const Mat &frame) {
+  const TrackerParams &params = cfg.tracker;
+  vector<Rect> &faces = ctx.faces;
+  vector<int> &poses = ctx.poses;
+
+  if (params.hybridTracking && !trackRequested && faceTracker.valid() &&
+      framesSinceDetection < params.detectInterval) {
+    Rect tracked = priorFace;
+    if (faceTracker.track(frame, tracked) >= params.minTrackConfidence) {
+      priorFace = tracked;
+      faceTracks.follow(targetId, priorFace);
+      faces.assign(1, priorFace);
+      poses.assign(1, priorPose);
+      framesSinceDetection++;
+      return true;
+    }
+  }
+  framesSinceDetection = 0;
+  if (activity.enabled()) {
+    int64_t activityStart = nowNs();
+    activity.update(frame);
+    activityStats.record(nowNs() - activityStart);
+  }
+  faces.clear();
+  poses.clear();
+
+  bool fullScan = !params.roiTracking || priorFace.width == 0 || trackRequested ||
+                  framesSinceFullScan >= params.fullScanInterval;
+  Rect searched(Point(0, 0), frame.size());
+
+  if (!fullScan) {
+    Rect window = searchWindow(priorFace, frame.size());
+    searchRegion(frame, window, detectControl.plan(priorFace, params.roiSizeMargin));
+    framesSinceFullScan++;
+    fullScan = faces.empty(); //lost the face, look everywhere
+    searched = window;
+  }
+
+  if (fullScan) {
+    searched = Rect(Point(0, 0), frame.size());
+    // Detect face with open source cascade
+    searchRegion(frame, searched, detectControl.plan(Rect(), 0));
+    framesSinceFullScan = 0;
+  }
+  activity.remember(faces, searched, &poses);
+  int64_t selectStart = nowNs();
+  faceTracks.update(faces, searched);
+
+  //target the face nearest to a track-face-at command
+  if (trackRequested) {
+    trackRequested = false;
+    //arbitrary size in case no face is near, to draw the ellipse
+    priorFace = Rect(trackPoint.x - pointFaceSide/2, trackPoint.y - pointFaceSide/2,
+                     pointFaceSide, pointFaceSide);
+    targetId = faceTracks.nearest(trackPoint);
+    if (targetId < 0) { // no face near the click, track the clicked point
+      faceTracker.reset();
+      return true;
+    }
+  }
+
+  const FaceTrack *target = faceTracks.find(targetId);
+  if (!target) { // first face, or the target's track was dropped
+    const vector<FaceTrack> &tracks = faceTracks.tracks();
+    int picked = targetPolicy->select(tracks, priorFace, frame.size());
+    target = picked >= 0 ? &tracks[picked] : NULL;
+    targetId = target ? target->id : -1;
+  }
+  selectStats.record(nowNs() - selectStart);
+
+  if (!target || target->detection < 0) { // target not seen, return old face
+    faceTracker.reset();
+    return false;
+  }
+
+  //selected face goes first
+  swap(faces[0], faces[target->detection]);
+  swap(poses[0], poses[target->detection]);
+  priorFace = target->box;
+  priorPose = poses[0];
+  if (params.hybridTracking) {
+    faceTracker.init(frame, priorFace);
+  }
+  return true;
+}
+
+/**
+search region of frame as planned: a cascade pass over each active part of
+it, verification of what the passes found, plus the faces remembered from
+static parts, into ctx.faces
+*/
+void TrackingSession::searchRegion(const Mat &frame, const Rect &region, const DetectionPlan &plan) {
+  int64_t start = nowNs();
+  //a face overlapping an active cell must fit in the searched part
+  int margin = max(plan.minSize.width, plan.maxSize.width / 2);
+  activity.regions(region, margin, ctx.regions);
+  for (size_t i = 0; i < ctx.regions.size(); i++) {
+    runCascade(frame, ctx.regions[i], plan);
+  }
+  if (!ctx.regions.empty()) { //a skipped search says nothing about the budget
+    passTimes.push_back(nowNs() - start);
+  }
+  if (cfg.tracker.verifyFaces && verifier && !ctx.faces.empty()) {
+    int64_t verifyStart = nowNs();
+    verifier->verify(frame, ctx.faces, &ctx.poses); //carried faces were verified when found
+    verifyStats.record(nowNs() - verifyStart);
+  }
+  activity.carry(region, ctx.faces, &ctx.poses);
+}
+
+/**
+one cascade pass over region of frame as planned: shrink, convert to gray
+and equalize, detect, and append the faces in frame coordinates to ctx.faces
+*/
+void TrackingSession::runCascade(const Mat &frame, const Rect &region, const DetectionPlan &plan) {
+  vector<Rect> &hits = ctx.hits;
+  double d = plan.downscale;
+  int64_t start = nowNs();
+  Mat frame_gray;
+  if (d > 1) {
+    Size small(max(1, cvRound(region.width / d)), max(1, cvRound(region.height / d)));
+    Mat scaled = ctx.scaled(small);
+    cv::resize(frame(region), scaled, small, 0, 0, INTER_AREA);
+    frame_gray = ctx.gray(small);
+    equalizedGray(scaled, frame_gray);   // Convert to gray, equalize histogram
+  } else {
+    frame_gray = ctx.gray(region.size());
+    equalizedGray(frame(region), frame_gray);
+  }
+  int64_t grayEnd = nowNs();
+
+  Size minSize(cvRound(plan.minSize.width / d), cvRound(plan.minSize.height / d));
+  Size maxSize(cvRound(plan.maxSize.width / d), cvRound(plan.maxSize.height / d));
+  if (cfg.tracker.multiPose && detector.hasProfile()) {
+    detector.detectPoses(frame_gray, hits, ctx.hitPoses, plan.scaleFactor, cfg.tracker.minNeighbors,
+                         0|CASCADE_SCALE_IMAGE, minSize, maxSize);
+  } else {
+    detector.detectMultiScale(frame_gray, hits, plan.scaleFactor, cfg.tracker.minNeighbors,
+				0|CASCADE_SCALE_IMAGE, minSize, maxSize);
+    ctx.hitPoses.assign(hits.size(), POSE_FRONTAL);
+  }
+  for (size_t i = 0; i < hits.size(); i++) {
+    const Rect &f = hits[i];
+    Rect face(cvRound(f.x * d), cvRound(f.y * d), cvRound(f.width * d), cvRound(f.height * d));
+    ctx.faces.push_back(face + region.tl()); //back to frame coordinates
+    ctx.poses.push_back(ctx.hitPoses[i]);
+  }
+  int64_t end = nowNs();
+  grayStats.record(grayEnd - start);
+  cascadeStats.record(end - grayEnd);
+}
+
+void runDetectionScheduler(const vector<TrackingSession *> &sessions,
+                           const atomic<bool> &running) {
+  while (running) {
+    bool busy = false;
+    for (size_t i = 0; i < sessions.size(); i++) {
+      if (sessions[i]->isRunning() && sessions[i]->detectNext()) {
+        busy = true;
+      }
+    }
+    if (!busy) {
+      this_thread::sleep_for(chrono::microseconds(500));
+    }
+  }
+}
+
+/**
+fill config from one entry of a session list, e.g.
+  { name: left, camera: 0, port: "/dev/ttyACM0", width: 1920, height: 1080,
+    scale: 2.0, fx: 1517.6023, cx: 959.5, cy: 539.5, ascii: 0, keepalive: 0.25,
+    target: nearest, adaptive: 1, budget: 0.025, prefilter: motion, verify: 1,
+    poses: 0, cache: 1, cacheChange: 3, cacheAge: 30, roi: 1, hybrid: 1, record: left.ftr }
+calibration: file.yml, or a map with the keys of a calibration file, replaces
+fx, cx and cy with a full calibration
+missing keys keep the SessionConfig defaults
+*/
+bool readSessionConfig(const FileNode &node, SessionConfig &config) {
+  String name, port;
+  read(node["name"], name, config.name);
+  read(node["port"], port, config.port);
+  read(node["camera"], config.camera, config.camera);
+  String device;
+  int direct;
+  read(node["device"], device, config.device);
+  read(node["direct"], direct, (int)config.directCapture); //0 to capture through VideoCapture
+  config.device = device;
+  config.directCapture = direct != 0;
+  read(node["width"], config.captureSize.width, config.captureSize.width);
+  read(node["height"], config.captureSize.height, config.captureSize.height);
+  read(node["scale"], config.scale, config.scale);
+  config.name = name;
+  config.port = port;
+
+  String record;
+  read(node["record"], record, config.recordPath);
+  read(node["recordQuality"], config.recordQuality, config.recordQuality);
+  config.recordPath = record;
+
+  int roi, hybrid;
+  read(node["roi"], roi, (int)config.tracker.roiTracking);
+  read(node["hybrid"], hybrid, (int)config.tracker.hybridTracking);
+  config.tracker.roiTracking = roi != 0;
+  config.tracker.hybridTracking = hybrid != 0;
+
+  int ascii;
+  read(node["ascii"], ascii, (int)config.link.asciiProtocol); //firmware without binary frames
+  config.link.asciiProtocol = ascii != 0;
+  read(node["keepalive"], config.link.keepaliveInterval, config.link.keepaliveInterval);
+
+  int adaptive;
+  DetectionControlParams &detection = config.tracker.detection;
+  read(node["adaptive"], adaptive, (int)detection.adaptive); //0 for fixed detection settings
+  detection.adaptive = adaptive != 0;
+  read(node["budget"], detection.budget, detection.budget);
+
+  int verify;
+  read(node["verify"], verify, (int)config.tracker.verifyFaces); //eyes, nose or mouth required
+  config.tracker.verifyFaces = verify != 0;
+  int poses;
+  read(node["poses"], poses, (int)config.tracker.multiPose); //profile faces too
+  config.tracker.multiPose = poses != 0;
+  int cache;
+  SceneCacheParams &sceneCache = config.tracker.sceneCache;
+  read(node["cache"], cache, (int)sceneCache.enabled); //reuse results while the scene is still
+  sceneCache.enabled = cache != 0;
+  read(node["cacheChange"], sceneCache.maxChange, sceneCache.maxChange);
+  read(node["cacheAge"], sceneCache.maxAge, sceneCache.maxAge);
+
+  String prefilter;
+  read(node["prefilter"], prefilter, "");
+  if (!prefilter.empty() && (config.tracker.activity.mode = activityModeByName(prefilter)) < 0) {
+    cout << config.name << ": unknown prefilter " << prefilter << endl;
+    return false;
+  }
+
+  String target;
+  read(node["target"], target, "");
+  if (!target.empty() && !(config.tracker.targetPolicy = targetPolicyByName(target))) {
+    cout << config.name << ": unknown target policy " << target << endl;
+    return false;
+  }
+
+  FileNode calibration = node["calibration"];
+  if (calibration.isMap()) {
+    if (!config.calibration.read(calibration)) {
+      cout << config.name << ": calibration needs a 3x3 camera_matrix" << endl;
+      return false;
+    }
+  } else if (calibration.isString()) {
+    if (!config.calibration.load(calibration)) {
+      return false;
+    }
+  } else { //inline pinhole model
+    double fx, cx, cy;
+    read(node["fx"], fx, config.calibration.K(0, 0));
+    read(node["cx"], cx, config.calibration.K(0, 2));
+    read(node["cy"], cy, config.calibration.K(1, 2));
+    config.calibration = CameraCalibration::pinhole(fx, cx, cy);
+  }
+
+  if (config.scale <= 0) {
+    cout << config.name << ": scale must be positive" << endl;
+    return false;
+  }
+  return true;
+}
+
+void writeSessionConfig(FileStorage &fs, const SessionConfig &config) {
+  const char *prefilters[] = {"off", "motion", "skin", "any"};
+  const TrackerParams &tracker = config.tracker;
+  fs << "{";
+  fs << "name" << config.name << "camera" << config.camera << "port" << config.port;
+  fs << "device" << config.device << "direct" << (int)config.directCapture;
+  fs << "width" << config.captureSize.width << "height" << config.captureSize.height;
+  fs << "scale" << config.scale;
+  fs << "ascii" << (int)config.link.asciiProtocol << "keepalive" << config.link.keepaliveInterval;
+  fs << "adaptive" << (int)tracker.detection.adaptive << "budget" << tracker.detection.budget;
+  fs << "verify" << (int)tracker.verifyFaces << "poses" << (int)tracker.multiPose;
+  fs << "cache" << (int)tracker.sceneCache.enabled << "cacheChange" << tracker.sceneCache.maxChange;
+  fs << "cacheAge" << tracker.sceneCache.maxAge;
+  fs << "prefilter" << prefilters[tracker.activity.mode & ACTIVITY_ANY];
+  if (tracker.targetPolicy && !tracker.targetPolicy->name().empty()) {
+    fs << "target" << tracker.targetPolicy->name();
+  }
+  fs << "roi" << (int)tracker.roiTracking << "hybrid" << (int)tracker.hybridTracking;
+  fs << "calibration" << "{";
+  config.calibration.write(fs);
+  fs << "}";
+  fs << "}";
+}
+
+/**
+compare function
+return area(face1) > area(face2)
+*/
+
+bool compareBigger(Rect face1, Rect face2) { //biggest -> smallest
+  return face1.width * face1.height > face2.width * face2.height;
+}
+/**
+compare function
+return distance_from_prior(face1) < distance_from_prior(face2)
+*/
+
+bool compareDistance(Rect face1, Rect face2, Rect prior) { //sort smallest -- biggest
+  Point2d priorFaceCenter(prior.x + prior.width/2, prior.y + prior.height/2);
+
+  double sq_x1 = pow(face1.x + face1.width/2 - priorFaceCenter.x, 2);
+  double sq_y1 = pow(face1.y + face1.height/2 - priorFaceCenter.y, 2);
+
+  double sq_x2 = pow(face2.x + face2.width/2 - priorFaceCenter.x, 2);
+  double sq_y2 = pow(face2.y + face2.height/2 - priorFaceCenter.y, 2);
+
+  return (sq_x1 + sq_y1) < (sq_x2 + sq_y2);
+
+}
+
+/**
+compare function
+return true if face1 is further from the vertical center line than face2
+*/
+bool comparePeripheral(Rect face1, Rect face2, int frameWidth) {
+  return (abs((face1.x + face1.width/2) - frameWidth/2) > abs((face2.x + face2.width/2) - frameWidth/2));
+}
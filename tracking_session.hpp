@@ -0,0 +1,268 @@
+#ifndef TRACKING_SESSION_HPP
+#define TRACKING_SESSION_HPP
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ring_buffer.hpp"
+#include "command_queue.hpp"
+#include "actuator_link.hpp"
+#include "stage_stats.hpp"
+#include "tiled_detector.hpp"
+#include "motion_filter.hpp"
+#include "face_tracker.hpp"
+#include "frame_context.hpp"
+#include "track_table.hpp"
+#include "detection_controller.hpp"
+#include "camera_model.hpp"
+#include "activity_filter.hpp"
+#include "scene_cache.hpp"
+#include "face_verifier.hpp"
+#include "session_recording.hpp"
+#include "camera_capture.hpp"
+
+/* frame handed from the capture stage to the detection stage */
+struct CapturedFrame {
+  cv::Mat frame;            // downscaled frame
+  unsigned long seq;
+  int64_t captureNs;
+};
+
+/* capture time of every frame, handed to the actuator stage */
+struct FrameTick {
+  unsigned long seq;
+  int64_t captureNs;
+};
+
+/* detection result handed to the display stage */
+struct TrackResult {
+  cv::Mat frame;                 // the frame detection ran on, shared with capture: copy before drawing
+  std::vector<cv::Rect> faces;   // faces[0] is the selected face
+  cv::Rect face;
+  std::vector<int> poses;        // FacePose of each face
+  int targetId;                  // track id of the selected face, -1 if none
+  int pose;                      // FacePose of the selected face
+  cv::Point faceCenter;
+  bool tracking;                 // false until the first face is seen
+  double angled;                 // pan angle of the filtered face
+  double tiltd;                  // tilt angle of the filtered face, positive down
+  unsigned long seq;
+  int64_t captureNs;
+};
+
+/*
+what the UI asks a session to do; recordings store commands by these codes,
+the first two being the mouse events they were recorded as before
+*/
+enum SessionCommandType {
+  COMMAND_TRACK_FACE_AT = cv::EVENT_LBUTTONDOWN, // target the face nearest to (x, y), ending a lock
+  COMMAND_LOCK_POINT = cv::EVENT_RBUTTONDOWN,    // hold (x, y) and stop detecting until released
+  COMMAND_RELEASE = 100,                         // end a lock; the policy picks the next target
+  COMMAND_SET_POLICY = 101                       // x: index of the policy in targetPolicyNames
+};
+
+struct SessionCommand {
+  int type;                    // SessionCommandType
+  int x, y;
+};
+
+/* names of the policies COMMAND_SET_POLICY can switch to, see targetPolicyByName() */
+extern const char *const targetPolicyNames[];
+const int targetPolicyCount = 3;
+
+/* how a session finds and follows its face */
+struct TrackerParams {
+  TrackerParams();
+
+  int minNeighbors;
+  cv::Size minFaceSize;
+  DetectionControlParams detection; // resolution, pyramid step and time budget per pass
+  ActivityParams activity;    // cascade only on moving or skin-coloured parts, off by default
+  SceneCacheParams sceneCache; // reuse the last result while the scene stays still, off by default
+  bool verifyFaces;           // drop detections without facial features, needs a FaceVerifier
+  bool multiPose;             // profile faces too, needs a profile classifier (TiledDetector::loadProfile)
+
+  /* ROI tracking: search near priorFace, rescan the whole frame periodically */
+  bool roiTracking;
+  int fullScanInterval;       // frames between full-frame rescans
+  double roiExpand;           // search window padding, in face sizes per side
+  double roiSizeMargin;       // allowed relative face size change between frames
+
+  /* hybrid mode: template tracking between cascade runs */
+  bool hybridTracking;
+  int detectInterval;         // run the cascade at least every N frames
+  double minTrackConfidence;  // NCC peak below this triggers the cascade
+
+  /* every face in view keeps an id; the target keeps its id while it is tracked */
+  TrackTableParams tracks;
+  std::shared_ptr<TargetPolicy> targetPolicy; // picks a new target, NearestTarget if unset
+
+  /* motion model between detections */
+  double processNoise;        // acceleration noise, (pixels/s^2)^2 per Hz
+  double measurementNoise;    // detection jitter, pixels^2
+  double maxCoast;            // seconds to extrapolate without a detection
+};
+
+/* one camera, its calibration and the mbed it drives */
+struct SessionConfig {
+  SessionConfig();
+
+  std::string name;
+  int camera;                 // camera index, /dev/video<camera>
+  std::string device;         // V4L2 device or fake capture file instead, empty for none
+  bool directCapture;         // convert V4L2 buffers in place, false for VideoCapture
+  cv::Size captureSize;       // requested camera resolution
+  double scale;               // frames are downscaled by this before detection
+  CameraCalibration calibration;
+  std::string port;           // serial port of the mbed, empty for no output
+  unsigned long baud;
+  bool display;               // keep results for a preview window
+  bool logFrames;             // print every actuator update to the console
+  std::string recordPath;     // record every frame detection runs on, empty for none
+  int recordQuality;          // JPEG quality of recorded frames, 0 (default) to store them raw
+  TrackerParams tracker;
+  LinkParams link;
+};
+
+/* fill config from one entry of a session list; false, printing why, if it is invalid */
+bool readSessionConfig(const cv::FileNode &node, SessionConfig &config);
+/* config as a session list entry, a map readSessionConfig() reads back */
+void writeSessionConfig(cv::FileStorage &fs, const SessionConfig &config);
+
+/**
+One tracking session: a camera, the face it follows, and the mbed it drives.
+Each session runs its own capture and actuator threads, plus the serial
+writer thread of its ActuatorLink. Detection is not
+threaded per session: a scheduler calls detectNext() on every session in turn,
+and all sessions share one TiledDetector (worker pool and loaded classifiers)
+and, if faces are verified, one FaceVerifier on the same pool.
+All tracker state is only touched from the scheduler thread, except for the
+motion filter, which the actuator thread reads under filterLock.
+*/
+class TrackingSession {
+public:
+  TrackingSession(const SessionConfig &config, TiledDetector &detector,
+                  FaceVerifier *verifier = NULL);
+  ~TrackingSession();
+
+  /* open camera and serial port, printing what failed */
+  bool open();
+  void start();
+  void stop();
+  bool isRunning() const;
+
+  /* detect on the newest captured frame; returns false if there was none */
+  bool detectNext();
+  /*
+  run one downscaled frame through detection and the motion filter on the
+  calling thread; detectNext() uses it, offline processing calls it directly
+  */
+  TrackResult process(const cv::Mat &frame, int64_t captureNs, unsigned long seq = 0);
+  /* same, filling result in place so its face list keeps its capacity */
+  void process(const cv::Mat &frame, int64_t captureNs, unsigned long seq, TrackResult &result);
+  /* find and select the face in frame; true if priorFace was set this frame */
+  bool detectFace(const cv::Mat &frame);
+  /* pan and tilt in degrees of the center of a face in the downscaled frame */
+  cv::Point2f viewAngles(const cv::Rect2d &face) const;
+
+  /*
+  queue a command from any thread, false if too many are queued; commands are
+  applied in order at the start of the next frame process() runs
+  */
+  bool command(const SessionCommand &command);
+  /* a mouse event as a command: left button tracks the face at the click, right locks the point, middle releases */
+  void click(int event, int x, int y);
+  /* queue a switch to the policy targetPolicyByName() knows as name; false if it knows none */
+  bool setTargetPolicy(const std::string &name);
+  /* true while a COMMAND_LOCK_POINT holds and detection is skipped */
+  bool locked() const;
+  /* detection controller pressure, set by replays before process() */
+  void setDetectionPressure(double pressure);
+  bool latestResult(TrackResult &result);
+  void reportStats();
+
+  const SessionConfig &config() const;
+  cv::Size frameSize() const;
+  cv::Rect face() const;
+
+private:
+  TrackingSession(const TrackingSession &);
+  TrackingSession &operator=(const TrackingSession &);
+
+  void captureLoop();
+  void actuateLoop();
+  bool applyCommands();
+  bool searchFaces(const cv::Mat &frame);
+  cv::Rect searchWindow(cv::Rect face, cv::Size frameSize) const;
+  void searchRegion(const cv::Mat &frame, const cv::Rect &region, const DetectionPlan &plan);
+  void runCascade(const cv::Mat &frame, const cv::Rect &region, const DetectionPlan &plan);
+
+  SessionConfig cfg;
+  TiledDetector &detector;
+  FaceVerifier *verifier;     // NULL or empty: detections are not verified
+  CameraCapture camera;
+  ActuatorLink mbed;
+  cv::Size displaySize;
+  AngleTable angleTable;      // written before start() or under filterLock
+  SessionRecorder recorder;   // open while recording cfg.recordPath
+
+  std::atomic<bool> running;
+  std::thread captureThread, actuateThread;
+  RingBuffer<CapturedFrame> detectQueue;
+  RingBuffer<FrameTick> actuateQueue;
+  RingBuffer<TrackResult> displayQueue;
+
+  /* tracker state, owned by the scheduler thread */
+  FrameContext ctx;
+  TrackResult current;
+  cv::Rect priorFace;
+  int priorPose;              // FacePose of priorFace
+  TrackTable faceTracks;
+  int targetId;               // -1 while no track is the target
+  std::shared_ptr<TargetPolicy> targetPolicy;
+  CommandQueue<SessionCommand> commands;   // from UI threads
+  std::vector<RecordedClick> frameClicks;  // commands applied this frame, as recorded
+  bool trackRequested;        // target the face nearest to trackPoint on this frame's detection
+  cv::Point trackPoint;
+  bool lockActive;            // priorFace held on lockPoint, no detection
+  cv::Point lockPoint;
+  int framesSinceFullScan;
+  int framesSinceDetection;
+  DetectionController detectControl;
+  std::vector<int64_t> passTimes;     // this frame's search passes, recorded once it is done
+  ActivityFilter activity;
+  SceneCache sceneCache;
+  std::vector<cv::Rect> cachedFaces;  // detectFace() result on the frame sceneCache holds
+  std::vector<int> cachedPoses;
+  bool cachedFound;
+  TemplateTracker faceTracker;
+  FaceMotionFilter faceFilter;
+  std::mutex filterLock;
+
+  /* capture thread: capture (grab + resize), resize (conversion to the detection size)
+     scheduler: detect (whole cascade frame) = scene + activity + gray + cascade + verify + select,
+                or track (template tracking or a cached result)
+     actuator thread: actuate, end-to-end (capture to serial hand-off) */
+  StageStats captureStats, resizeStats;
+  StageStats detectStats, sceneStats, activityStats, grayStats, cascadeStats, verifyStats;
+  StageStats selectStats, trackStats;
+  StageStats actuateStats, latencyStats;
+  unsigned long detectDrops, actuateDrops;
+};
+
+/**
+round-robin detection over all sessions until running is cleared: each pass
+gives every session at most one frame, so a busy camera can't starve the others
+*/
+void runDetectionScheduler(const std::vector<TrackingSession *> &sessions,
+                           const std::atomic<bool> &running);
+
+bool compareBigger(cv::Rect face1, cv::Rect face2);
+bool compareDistance(cv::Rect face1, cv::Rect face2, cv::Rect prior);
+bool comparePeripheral(cv::Rect face1, cv::Rect face2, int frameWidth);
+
+#endif